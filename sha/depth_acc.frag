@@ -3,14 +3,14 @@
 
 layout(set = 0, binding = 0) uniform sampler2D depth;
 
-layout(location = 0) out float out_depth;
+layout(location = 0) out vec2 out_depth;
 
 void main(void)
 {
 	ivec2 pos = ivec2(gl_FragCoord.xy) * 2;
-	out_depth = max(max(max(
-		texelFetch(depth, pos, 0).x,
-		texelFetch(depth, pos + ivec2(1, 0), 0).x),
-		texelFetch(depth, pos + ivec2(1, 1), 0).x),
-		texelFetch(depth, pos + ivec2(1, 1), 0).x);
+	vec2 a = texelFetch(depth, pos, 0).xy;
+	vec2 b = texelFetch(depth, pos + ivec2(1, 0), 0).xy;
+	vec2 c = texelFetch(depth, pos + ivec2(0, 1), 0).xy;
+	vec2 d = texelFetch(depth, pos + ivec2(1, 1), 0).xy;
+	out_depth = vec2(max(max(max(a.x, b.x), c.x), d.x), min(min(min(a.y, b.y), c.y), d.y));
 }
\ No newline at end of file
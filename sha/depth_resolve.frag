@@ -5,10 +5,12 @@ layout(constant_id = 0) const int sample_count = 1;
 
 layout(set = 0, binding = 0) uniform sampler2D cdepth;
 
-layout(location = 0) out float out_depth;
+layout(location = 0) out vec2 out_depth;
 
 void main(void)
 {
 	ivec2 pos = ivec2(gl_FragCoord.xy);
-	out_depth = texelFetch(cdepth, pos, 0).x;
+	float d = texelFetch(cdepth, pos, 0).x;
+	// past the screen nothing is known to occlude
+	out_depth = vec2(d, all(lessThan(pos, textureSize(cdepth, 0))) ? d : 0.0);
 }
\ No newline at end of file
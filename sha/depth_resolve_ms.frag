@@ -5,18 +5,20 @@ layout(constant_id = 0) const int sample_count = 1;
 
 layout(set = 0, binding = 0) uniform sampler2DMS cdepth;
 
-layout(location = 0) out float out_depth;
+layout(location = 0) out vec2 out_depth;
 
 void main(void)
 {
 	ivec2 pos = ivec2(gl_FragCoord.xy);
-	out_depth = 2.0;
+	out_depth = vec2(2.0);
 	float depth_l = 2.0;
 	for (int i = 0; i < sample_count; i++) {
 		float d = texelFetch(cdepth, pos, i).x;
-		out_depth = min(out_depth, d);
+		out_depth = min(out_depth, vec2(d));
 		depth_l = min(depth_l, d == 0.0 ? 2.0 : d);
 	}
 	if (depth_l != 2.0)
-		out_depth = depth_l;
+		out_depth.x = depth_l;
+	if (any(greaterThanEqual(pos, textureSize(cdepth))))
+		out_depth.y = 0.0;
 }
\ No newline at end of file
@@ -0,0 +1,9 @@
+// Material pool of the renderer, the index comes from the visible instance
+struct Material {
+	int albedo;
+	int data[31];	// 128 bytes, as Rosee::Material
+};
+
+layout(set = 1, binding = 6) readonly buffer Materials {
+	Material m[];
+} materials;
\ No newline at end of file
@@ -3,14 +3,13 @@
 
 #include "0_frag.set"
 
-layout(push_constant) uniform PushConstant {
-	int albedo;
-} p;
+#include "material.glsl"
 
 layout(location = 0) in vec3 in_n;
 layout(location = 1) in vec3 in_t;
 layout(location = 2) in vec3 in_b;
 layout(location = 3) in vec2 in_u;
+layout(location = 4) flat in uint in_material;
 
 layout(location = 0) out float out_depth;
 layout(location = 1) out vec4 out_albedo;
@@ -21,7 +20,7 @@ const float height_scale = 0.05;
 
 #include "rt.glsl"
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, int heightMap)
 {
 	const float minLayers = 8.0;
 	const float maxLayers = 32.0;
@@ -38,14 +37,14 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 	// get initial values
 	vec2  currentTexCoords     = texCoords;
-	float currentDepthMapValue = texture(samplers[p.albedo + 1], currentTexCoords).w;
+	float currentDepthMapValue = texture(samplers[heightMap], currentTexCoords).w;
 
 	while (currentLayerDepth < currentDepthMapValue)
 	{
 		// shift texture coordinates along direction of P
 		currentTexCoords -= deltaTexCoords;
 		// get depthmap value at current texture coordinates
-		currentDepthMapValue = texture(samplers[p.albedo + 1], currentTexCoords).w;
+		currentDepthMapValue = texture(samplers[heightMap], currentTexCoords).w;
 		// get depth of next layer
 		currentLayerDepth += layerDepth;
 	}
@@ -55,7 +54,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 	// get depth after and before collision for linear interpolation
 	float afterDepth  = currentDepthMapValue - currentLayerDepth;
-	float beforeDepth = texture(samplers[p.albedo + 1], prevTexCoords).w - currentLayerDepth + layerDepth;
+	float beforeDepth = texture(samplers[heightMap], prevTexCoords).w - currentLayerDepth + layerDepth;
 
 	// interpolation of texture coordinates
 	float weight = afterDepth / (afterDepth - beforeDepth);
@@ -66,6 +65,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 
 void main(void)
 {
+	int albedo = materials.m[in_material].albedo;
 	vec2 uv = vec2(in_u.x, -in_u.y);
 
 	vec3 n = normalize(in_n);
@@ -76,14 +76,14 @@ void main(void)
 		t, b, n
 	)) * rt_pos_view(gl_FragCoord.xy, gl_FragCoord.z));
 
-	uv = ParallaxMapping(uv, view_norm);
+	uv = ParallaxMapping(uv, view_norm, albedo + 1);
 
-	vec4 te = texture(samplers[p.albedo], uv);
+	vec4 te = texture(samplers[albedo], uv);
 	if (te.w < 0.01)
 		discard;
 	out_depth = gl_FragCoord.z;
 	out_albedo = vec4(te.xyz, 1.0);
-	vec3 nmap = texture(samplers[p.albedo + 1], uv).xyz * 2.0 - 1.0;
+	vec3 nmap = texture(samplers[albedo + 1], uv).xyz * 2.0 - 1.0;
 	//nmap.z *= 0.6;
 	nmap = normalize(nmap);
 	out_normal = vec4(t * nmap.x + b * nmap.y + n * nmap.z, 1.0);
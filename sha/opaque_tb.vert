@@ -10,6 +10,11 @@ layout(set = 1, binding = 0) readonly buffer Dyn {
 	Frame f[];
 } d;
 
+// x: entity slot, y: material
+layout(set = 1, binding = 1) readonly buffer Visible {
+	uvec2 i[];
+} v;
+
 layout(location = 0) in vec3 in_p;
 layout(location = 1) in vec3 in_n;
 layout(location = 2) in vec3 in_t;
@@ -20,12 +25,16 @@ layout(location = 0) out vec3 out_n;
 layout(location = 1) out vec3 out_t;
 layout(location = 2) out vec3 out_b;
 layout(location = 3) out vec2 out_u;
+layout(location = 4) flat out uint out_material;
 
 void main(void)
 {
-	gl_Position = d.f[gl_InstanceIndex].mvp * vec4(in_p, 1.0);
-	out_n = d.f[gl_InstanceIndex].mv_normal * in_n;
-	out_t = d.f[gl_InstanceIndex].mv_normal * in_t;
-	out_b = d.f[gl_InstanceIndex].mv_normal * in_b;
+	uvec2 vi = v.i[gl_InstanceIndex];
+	uint i = vi.x;
+	gl_Position = d.f[i].mvp * vec4(in_p, 1.0);
+	out_n = d.f[i].mv_normal * in_n;
+	out_t = d.f[i].mv_normal * in_t;
+	out_b = d.f[i].mv_normal * in_b;
 	out_u = in_u;
+	out_material = vi.y;
 }
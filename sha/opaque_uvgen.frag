@@ -3,12 +3,11 @@
 
 #include "0_frag.set"
 
-layout(push_constant) uniform PushConstant {
-	int albedo;
-} p;
+#include "material.glsl"
 
 layout(location = 0) in vec3 in_n;
 layout(location = 1) in vec3 in_w;
+layout(location = 2) flat in uint in_material;
 
 layout(location = 0) out float out_depth;
 layout(location = 1) out vec4 out_albedo;
@@ -19,7 +18,7 @@ layout(location = 3) out vec3 out_normal_geom;
 
 void main(void)
 {
-	vec4 t = texture(samplers[p.albedo], tex_3dmap(in_w));
+	vec4 t = texture(samplers[materials.m[in_material].albedo], tex_3dmap(in_w));
 	//vec4 t = vec4(vec3(v), 1.0);
 	if (t.w < 0.01)
 		discard;
@@ -11,15 +11,24 @@ layout(set = 1, binding = 0) readonly buffer Dyn {
 	Frame f[];
 } d;
 
+// x: entity slot, y: material
+layout(set = 1, binding = 1) readonly buffer Visible {
+	uvec2 i[];
+} v;
+
 layout(location = 0) in vec3 in_p;
 layout(location = 1) in vec3 in_n;
 
 layout(location = 0) out vec3 out_n;
 layout(location = 1) out vec3 out_w;
+layout(location = 2) flat out uint out_material;
 
 void main(void)
 {
-	gl_Position = d.f[gl_InstanceIndex].mvp * vec4(in_p, 1.0);
-	out_n = d.f[gl_InstanceIndex].mv_normal * in_n;
-	out_w = d.f[gl_InstanceIndex].model_world_local * in_p;
+	uvec2 vi = v.i[gl_InstanceIndex];
+	uint i = vi.x;
+	gl_Position = d.f[i].mvp * vec4(in_p, 1.0);
+	out_n = d.f[i].mv_normal * in_n;
+	out_w = d.f[i].model_world_local * in_p;
+	out_material = vi.y;
 }
@@ -0,0 +1,63 @@
+#include "Arena.hpp"
+
+namespace Rosee {
+
+Arena::Arena(size_t capacity) :
+	m_capacity(capacity)
+{
+	if (capacity > 0)
+		m_free.emplace(Range{0, capacity});
+}
+
+size_t Arena::alloc(size_t size, size_t align)
+{
+	for (size_t i = 0; i < m_free.size(); i++) {
+		auto &r = m_free[i];
+		size_t off = (r.offset + align - 1) / align * align;
+		size_t end = r.offset + r.size;
+		if (off > end || end - off < size)
+			continue;
+		size_t pad = off - r.offset;
+		size_t tail = end - (off + size);
+		// the alignment padding stays free in place, the tail goes right after it
+		if (pad > 0) {
+			r.size = pad;
+			if (tail > 0)
+				m_free.insert(m_free.begin() + (i + 1), Range{off + size, tail});
+		} else if (tail > 0) {
+			r.offset = off + size;
+			r.size = tail;
+		} else
+			m_free.erase(m_free.begin() + i, m_free.begin() + (i + 1));
+		return off;
+	}
+	return npos;
+}
+
+void Arena::free(size_t offset, size_t size)
+{
+	// first free range after the freed one
+	size_t lo = 0;
+	size_t hi = m_free.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (m_free[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	bool prev = lo > 0 && m_free[lo - 1].offset + m_free[lo - 1].size == offset;
+	bool next = lo < m_free.size() && offset + size == m_free[lo].offset;
+	if (prev && next) {
+		m_free[lo - 1].size += size + m_free[lo].size;
+		m_free.erase(m_free.begin() + lo, m_free.begin() + (lo + 1));
+	} else if (prev)
+		m_free[lo - 1].size += size;
+	else if (next) {
+		m_free[lo].offset = offset;
+		m_free[lo].size += size;
+	} else
+		m_free.insert(m_free.begin() + lo, Range{offset, size});
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "vector.hpp"
+
+namespace Rosee {
+
+// Offset allocator over [0, capacity), owns no memory
+// Free ranges are kept sorted by offset, a freed range is merged with its free neighbours
+class Arena
+{
+	struct Range
+	{
+		size_t offset;
+		size_t size;
+	};
+
+	size_t m_capacity = 0;
+	vector<Range> m_free;
+
+public:
+	static inline constexpr size_t npos = ~static_cast<size_t>(0);
+
+	Arena(void) = default;
+	Arena(size_t capacity);
+
+	size_t capacity(void) const
+	{
+		return m_capacity;
+	}
+
+	// First fit, align is any non-zero value, npos when no free range is large enough
+	size_t alloc(size_t size, size_t align);
+	void free(size_t offset, size_t size);
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include "math.hpp"
+
+namespace Rosee {
+
+struct Sphere
+{
+	glm::dvec3 center = glm::dvec3(0.0);
+	double radius = -1.0;	// < 0: unbounded
+};
+
+struct Aabb
+{
+	glm::dvec3 min = glm::dvec3(std::numeric_limits<double>::infinity());
+	glm::dvec3 max = glm::dvec3(-std::numeric_limits<double>::infinity());
+
+	bool empty(void) const
+	{
+		return min[0] > max[0];
+	}
+
+	void extend(const glm::dvec3 &p)
+	{
+		for (size_t i = 0; i < 3; i++) {
+			min[i] = Rosee::min(min[i], p[i]);
+			max[i] = Rosee::max(max[i], p[i]);
+		}
+	}
+
+	void extend(const Aabb &other)
+	{
+		for (size_t i = 0; i < 3; i++) {
+			min[i] = Rosee::min(min[i], other.min[i]);
+			max[i] = Rosee::max(max[i], other.max[i]);
+		}
+	}
+
+	Aabb merged(const Aabb &other) const
+	{
+		Aabb res = *this;
+		res.extend(other);
+		return res;
+	}
+
+	bool contains(const Aabb &other) const
+	{
+		for (size_t i = 0; i < 3; i++)
+			if (other.min[i] < min[i] || other.max[i] > max[i])
+				return false;
+		return true;
+	}
+
+	bool overlaps(const Aabb &other) const
+	{
+		for (size_t i = 0; i < 3; i++)
+			if (other.max[i] < min[i] || other.min[i] > max[i])
+				return false;
+		return true;
+	}
+
+	Aabb grown(double margin) const
+	{
+		Aabb res = *this;
+		for (size_t i = 0; i < 3; i++) {
+			res.min[i] -= margin;
+			res.max[i] += margin;
+		}
+		return res;
+	}
+
+	// Encloses the box, not the tightest sphere of the points in it
+	Sphere sphere(void) const
+	{
+		Sphere res;
+		if (empty())
+			return res;
+		res.center = (min + max) * 0.5;
+		auto d = (max - min) * 0.5;
+		res.radius = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+		return res;
+	}
+
+	// Where the segment origin + t * dir, 0 <= t <= max_t, enters the box, < 0 when it misses, inv is 1 / dir
+	double rayEnter(const glm::dvec3 &origin, const glm::dvec3 &inv, double max_t) const
+	{
+		double t0 = 0.0, t1 = max_t;
+		for (size_t i = 0; i < 3; i++) {
+			double a = (min[i] - origin[i]) * inv[i];
+			double b = (max[i] - origin[i]) * inv[i];
+			if (a > b)
+				std::swap(a, b);
+			t0 = Rosee::max(t0, a);
+			t1 = Rosee::min(t1, b);
+			if (t0 > t1)
+				return -1.0;
+		}
+		return t0;
+	}
+
+	// Half the surface area, insertion cost of the tree
+	double halfArea(void) const
+	{
+		auto d = max - min;
+		return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+	}
+
+	// Box enclosing the transformed box: center is transformed, extents are summed along absolute axes
+	Aabb transformed(const glm::dmat4 &m) const
+	{
+		Aabb res;
+		for (size_t i = 0; i < 3; i++) {
+			double c = m[3][i], e = 0.0;
+			for (size_t j = 0; j < 3; j++) {
+				c += m[j][i] * (min[j] + max[j]) * 0.5;
+				e += abs(m[j][i]) * (max[j] - min[j]) * 0.5;
+			}
+			res.min[i] = c - e;
+			res.max[i] = c + e;
+		}
+		return res;
+	}
+};
+
+// Planes a * x + b * y + c * z + d >= 0 inside, for a clip space with 0 <= z <= w, (a, b, c) is unit length
+struct Frustum
+{
+	glm::dvec4 planes[6];
+
+	static Frustum fromMatrix(const glm::dmat4 &vp)
+	{
+		Frustum res;
+		glm::dvec4 rows[4];
+		for (size_t i = 0; i < 4; i++)
+			rows[i] = glm::dvec4(vp[0][i], vp[1][i], vp[2][i], vp[3][i]);
+		res.planes[0] = rows[3] + rows[0];
+		res.planes[1] = rows[3] - rows[0];
+		res.planes[2] = rows[3] + rows[1];
+		res.planes[3] = rows[3] - rows[1];
+		res.planes[4] = rows[2];
+		res.planes[5] = rows[3] - rows[2];
+		for (auto &p : res.planes) {
+			double len = std::sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+			if (len > 0.0)
+				p = p * (1.0 / len);
+		}
+		return res;
+	}
+
+	// visible[i] is 0 when sphere i is fully outside of a plane, spheres are given as SoA so the loops vectorize
+	void cullSpheres(const double *x, const double *y, const double *z, const double *r, size_t count, uint8_t *visible) const
+	{
+		for (size_t i = 0; i < count; i++)
+			visible[i] = 1;
+		for (auto &p : planes) {
+			double a = p[0], b = p[1], c = p[2], d = p[3];
+			for (size_t i = 0; i < count; i++)
+				visible[i] &= a * x[i] + b * y[i] + c * z[i] + d >= -r[i];
+		}
+	}
+
+	// Bit i is set when the box is fully inside plane i, ~0U when the box is outside of any plane
+	uint32_t classify(const Aabb &box, uint32_t inside = 0) const
+	{
+		for (uint32_t i = 0; i < 6; i++) {
+			if (inside & (1U << i))
+				continue;
+			auto &p = planes[i];
+			// most and least inside corners along the plane normal
+			double pos = p[3], neg = p[3];
+			for (size_t j = 0; j < 3; j++) {
+				pos += p[j] * (p[j] >= 0.0 ? box.max[j] : box.min[j]);
+				neg += p[j] * (p[j] >= 0.0 ? box.min[j] : box.max[j]);
+			}
+			if (pos < 0.0)
+				return ~0U;
+			if (neg >= 0.0)
+				inside |= 1U << i;
+		}
+		return inside;
+	}
+
+	static inline constexpr uint32_t all_inside = 0x3F;
+};
+
+}
\ No newline at end of file
@@ -1,97 +1,217 @@
 #include <stdexcept>
 #include "Brush.hpp"
 #include "Map.hpp"
-#include "StaticMap.hpp"
+#include "math.hpp"
 
 namespace Rosee {
 
-Brush::Brush(Map &map, array<cmp_id> cmps) :
-	m_map(map)
+Brush::Brush(Map &map, const Cmp::Signature &sig) :
+	m_map(map),
+	m_sig(sig)
 {
-	m_cmp_ids.resize(cmps.size);
-	std::memcpy(m_cmp_ids.data(), cmps.data, cmps.size * sizeof(cmp_id));
-	std::memset(m_comps, 0, sizeof(m_comps));
-	std::memset(m_cmp_pres, 0, Cmp::max);
+	m_cmp_ids.reserve(m_sig.count());
+	m_sig.each([&](cmp_id c){
+		m_cmp_ids.emplace(c);
+	});
+	std::memset(m_col_offsets, 0, sizeof(m_col_offsets));
+	std::memset(m_add_edges, 0, sizeof(m_add_edges));
+	std::memset(m_remove_edges, 0, sizeof(m_remove_edges));
+
+	size_t row_size = 0;
 	for (auto &c : m_cmp_ids)
-		m_cmp_pres[c] = true;
+		row_size += Cmp::size[c];
+	m_chunk_capacity = row_size > 0 ? max(chunk_size / row_size, static_cast<size_t>(1)) : chunk_size;
+	while (m_chunk_capacity > 1 && layout(m_chunk_capacity) > chunk_size)
+		m_chunk_capacity--;
+	m_chunk_bytes = max(layout(m_chunk_capacity), chunk_size);
 }
 
 Brush::~Brush(void)
 {
+	for (auto &ch : m_chunks) {
+		for (auto &c : m_cmp_ids)
+			Cmp::destr[c](ch.m_comps[c], ch.m_size);
+		::operator delete(ch.m_data, std::align_val_t(column_align));
+	}
+}
+
+uint64_t Brush::version(void) const
+{
+	return m_map.version();
+}
+
+size_t Brush::layout(size_t capacity)
+{
+	size_t res = 0;
 	for (auto &c : m_cmp_ids) {
-		auto data = m_comps[c];
-		Cmp::destr[c](data, m_size);
-		std::free(data);
+		m_col_offsets[c] = res;
+		res += (capacity * Cmp::size[c] + column_align - 1) / column_align * column_align;
 	}
+	return res;
+}
+
+void Brush::resize(size_t size)
+{
+	size_t chunk_count = (size + m_chunk_capacity - 1) / m_chunk_capacity;
+	while (m_chunks.size() < chunk_count) {
+		auto &ch = m_chunks.emplace();
+		ch.m_data = reinterpret_cast<char*>(::operator new(m_chunk_bytes, std::align_val_t(column_align)));
+		ch.m_base = (m_chunks.size() - 1) * m_chunk_capacity;
+		std::memset(ch.m_comps, 0, sizeof(ch.m_comps));
+		std::memset(ch.m_versions, 0, sizeof(ch.m_versions));
+		for (auto &c : m_cmp_ids)
+			ch.m_comps[c] = ch.m_data + m_col_offsets[c];
+	}
+	while (m_chunks.size() > chunk_count) {
+		::operator delete(m_chunks[m_chunks.size() - 1].m_data, std::align_val_t(column_align));
+		m_chunks.resize(m_chunks.size() - 1);
+	}
+	m_size = size;
+	for (auto &ch : m_chunks)
+		ch.m_size = min(m_size - ch.m_base, m_chunk_capacity);
+}
+
+void Brush::touchRows(size_t offset, size_t count)
+{
+	if (count == 0)
+		return;
+	auto v = version();
+	for (size_t i = offset / m_chunk_capacity; i <= (offset + count - 1) / m_chunk_capacity; i++)
+		for (auto &c : m_cmp_ids)
+			m_chunks[i].m_versions[c] = v;
+}
+
+void Brush::touch(cmp_id cmp, size_t row)
+{
+	m_chunks[row / m_chunk_capacity].m_versions[cmp] = version();
 }
 
 size_t Brush::add(size_t count)
 {
 	size_t res = m_size;
-	m_size += count;
+	resize(m_size + count);
 
-	if (m_size > m_allocated) {
-		if (m_allocated == 0)
-			m_allocated = 1;
-		while (m_size > m_allocated)
-			m_allocated <<= 1;
+	for (size_t row = res; row < m_size;) {
+		size_t run = min(m_chunk_capacity - row % m_chunk_capacity, m_size - row);
 		for (auto &c : m_cmp_ids)
-			m_comps[c] = std::realloc(m_comps[c], m_allocated * Cmp::size[c]);
-	}
-	for (auto &c : m_cmp_ids)
-		Cmp::init[c](reinterpret_cast<char*>(m_comps[c]) + res * Cmp::size[c], count);
-	if (cmpIsPres<Id>()) {
-		auto ids = get<Id>() + res;
-		size_t base_id = m_map.m_id;
-		size_t acc_id = base_id;
-		m_map.m_id += count;
-		for (size_t i = 0; i < count; i++)
-			ids[i] = acc_id++;
-		m_map.add_range(base_id, base_id + count, *this, res);
+			Cmp::init[c](at(c, row), run);
+		row += run;
 	}
+	if (cmpIsPres<Id>())
+		for (size_t i = res; i < m_size; i++)
+			at<Id>(i) = m_map.id_alloc(*this, i);
+	touchRows(res, count);
 	return res;
 }
 
-void Brush::remove_imp(size_t offset, size_t count)
+void Brush::release(size_t offset, size_t count)
 {
 	size_t end = offset + count;
-	size_t rest = m_size - end;
-	for (auto &c : m_cmp_ids) {
-		auto cptr = reinterpret_cast<char*>(m_comps[c]);
-		size_t csize = Cmp::size[c];
-		Cmp::destr[c](cptr + offset * csize, count);
-		std::memmove(cptr + offset * csize, cptr + end * csize, rest * csize);
+	for (size_t row = offset; row < end;) {
+		size_t run = min(m_chunk_capacity - row % m_chunk_capacity, end - row);
+		for (auto &c : m_cmp_ids)
+			Cmp::destr[c](at(c, row), run);
+		row += run;
 	}
-	m_size -= count;
-	if (cmpIsPres<Id>()) {
-		auto ids = get<Id>();
-		auto &m = Static::get(m_map.m_ids);
-		size_t cur = offset;
-		while (cur < m_size) {
-			auto got = m.find(Map::Range{ids[cur], ids[cur] + 1});
-			if (got == m.end())
-				throw std::runtime_error("Can't find range to offset");
-			got->second.second -= count;
-			cur += got->first.end - got->first.begin;
-		}
+	if (cmpIsPres<Id>())
+		for (size_t i = offset; i < end; i++)
+			m_map.id_release(at<Id>(i));
+}
+
+// Rows are moved in runs that don't cross a chunk boundary, front to back: dst must not be past src
+void Brush::move(size_t dst, size_t src, size_t count)
+{
+	touchRows(dst, count);
+	while (count > 0) {
+		size_t run = min(min(m_chunk_capacity - dst % m_chunk_capacity, m_chunk_capacity - src % m_chunk_capacity), count);
+		for (auto &c : m_cmp_ids)
+			std::memmove(at(c, dst), at(c, src), run * Cmp::size[c]);
+		if (cmpIsPres<Id>())
+			for (size_t i = 0; i < run; i++)
+				m_map.id_move(at<Id>(dst + i), dst + i);
+		dst += run;
+		src += run;
+		count -= run;
 	}
 }
 
 void Brush::remove(size_t offset, size_t count)
 {
-	if (cmpIsPres<Id>()) {
-		auto ids = get<Id>();
-		auto &m = Static::get(m_map.m_ids);
-		while (count > 0) {
-			auto got = m.find(Map::Range{ids[offset], ids[offset] + 1});
-			if (got == m.end())
-				throw std::runtime_error("Can't find id range to remove");
-			size_t len = got->first.end - got->first.begin;
-			m_map.remove(got->first.begin, len);
-			count -= len;
+	release(offset, count);
+	move(offset, offset + count, m_size - offset - count);
+	resize(m_size - count);
+}
+
+void Brush::fillSwap(size_t offset, size_t count)
+{
+	size_t size = m_size - count;
+	// rows past the removed range and not already in the truncated tail fill the hole
+	size_t src = max(offset + count, size);
+	move(offset, src, m_size - src);
+	resize(size);
+}
+
+void Brush::removeSwap(size_t offset, size_t count)
+{
+	release(offset, count);
+	fillSwap(offset, count);
+}
+
+size_t Brush::migrate(Brush &dst, size_t offset, size_t count)
+{
+	bool src_id = cmpIsPres<Id>();
+	bool dst_id = dst.cmpIsPres<Id>();
+	size_t end = offset + count;
+	if (src_id && !dst_id)
+		for (size_t i = offset; i < end; i++)
+			m_map.id_release(at<Id>(i));
+
+	size_t res = dst.m_size;
+	dst.resize(dst.m_size + count);
+	for (size_t row = offset; row < end;) {
+		size_t d = res + row - offset;
+		size_t run = min(min(m_chunk_capacity - row % m_chunk_capacity, dst.m_chunk_capacity - d % dst.m_chunk_capacity), end - row);
+		for (auto &c : m_cmp_ids)
+			if (dst.cmpIsPres(c))
+				std::memcpy(dst.at(c, d), at(c, row), run * Cmp::size[c]);
+			else
+				Cmp::destr[c](at(c, row), run);
+		for (auto &c : dst.m_cmp_ids)
+			if (!cmpIsPres(c))
+				Cmp::init[c](dst.at(c, d), run);
+		row += run;
+	}
+	if (dst_id)
+		for (size_t i = res; i < dst.m_size; i++) {
+			if (src_id)
+				m_map.id_rebind(dst.at<Id>(i), dst, i);
+			else
+				dst.at<Id>(i) = m_map.id_alloc(dst, i);
 		}
-	} else
-		remove_imp(offset, count);
+
+	dst.touchRows(res, count);
+	fillSwap(offset, count);
+	return res;
+}
+
+void Brush::permute(const size_t *order)
+{
+	vector<uint8_t> tmp;
+	for (auto &c : m_cmp_ids) {
+		size_t size = Cmp::size[c];
+		tmp.resize(m_size * size);
+		for (size_t i = 0; i < m_size; i++)
+			std::memcpy(tmp.data() + i * size, at(c, order[i]), size);
+		for (size_t row = 0; row < m_size;) {
+			size_t run = min(m_chunk_capacity - row % m_chunk_capacity, m_size - row);
+			std::memcpy(at(c, row), tmp.data() + row * size, run * size);
+			row += run;
+		}
+	}
+	if (cmpIsPres<Id>())
+		for (size_t i = 0; i < m_size; i++)
+			m_map.id_move(at<Id>(i), i);
+	touchRows(0, m_size);
 }
 
 }
\ No newline at end of file
@@ -10,51 +10,128 @@ class Map;
 
 class Brush
 {
+public:
+	// Rows are stored in fixed-size chunks, each holding one SoA column per component
+	// Columns are aligned on column_align, chunks never move once allocated
+	static inline constexpr size_t chunk_size = 16384;
+	static inline constexpr size_t column_align = 64;
+
+	class Chunk
+	{
+		friend class Brush;
+
+		char *m_data;
+		size_t m_base;
+		size_t m_size;
+		void *m_comps[Cmp::max];
+		uint64_t m_versions[Cmp::max];	// Map::version() of the last write to each column
+
+	public:
+		// Brush row of the first element of the chunk
+		size_t base(void) const
+		{
+			return m_base;
+		}
+
+		size_t size(void) const
+		{
+			return m_size;
+		}
+
+		template <typename Component>
+		Component* get(void)
+		{
+			return reinterpret_cast<Component*>(m_comps[Component::id]);
+		}
+
+		template <typename Component>
+		Component* get(cmp_id cmp)
+		{
+			return reinterpret_cast<Component*>(m_comps[cmp]);
+		}
+
+		void* get(cmp_id cmp)
+		{
+			return m_comps[cmp];
+		}
+
+		uint64_t version(cmp_id cmp) const
+		{
+			return m_versions[cmp];
+		}
+
+		template <typename Component>
+		uint64_t version(void) const
+		{
+			return m_versions[Component::id];
+		}
+	};
+
+private:
 	Map &m_map;
 	friend class Map;
 
+	Cmp::Signature m_sig;
 	vector<cmp_id> m_cmp_ids;
-	bool m_cmp_pres[Cmp::max];
-	void *m_comps[Cmp::max];
+	size_t m_col_offsets[Cmp::max];
+	size_t m_chunk_capacity;
+	size_t m_chunk_bytes;
+	vector<Chunk> m_chunks;
 	size_t m_size = 0;
-	size_t m_allocated = 0;
+	// Brushes reached by adding / removing a single component, resolved on first migration
+	Brush *m_add_edges[Cmp::max];
+	Brush *m_remove_edges[Cmp::max];
+	size_t m_flush_batch = ~0ULL;	// spawn batch of Map::flush while it runs
+
+	size_t layout(size_t capacity);
 
 public:
-	Brush(Map &map, array<cmp_id> cmps);
+	Brush(Map &map, const Cmp::Signature &sig);
 	~Brush(void);
 
+	uint64_t version(void) const;
+
 	size_t size(void) const
 	{
 		return m_size;
 	}
 
-	template <typename Component>
-	Component* get(void)
+	// Rows per chunk
+	size_t chunkCapacity(void) const
 	{
-		return reinterpret_cast<Component*>(m_comps[Component::id]);
+		return m_chunk_capacity;
 	}
 
-	template <typename Component>
-	Component* get(cmp_id cmp)
+	vector<Chunk>& chunks(void)
 	{
-		return reinterpret_cast<Component*>(m_comps[cmp]);
+		return m_chunks;
 	}
 
-	void* get(cmp_id cmp)
+	template <typename Component>
+	Component& at(size_t row)
 	{
-		return m_comps[cmp];
+		return m_chunks[row / m_chunk_capacity].template get<Component>()[row % m_chunk_capacity];
 	}
 
+	void* at(cmp_id cmp, size_t row)
+	{
+		return reinterpret_cast<char*>(m_chunks[row / m_chunk_capacity].get(cmp)) + (row % m_chunk_capacity) * Cmp::size[cmp];
+	}
 
 	bool cmpIsPres(cmp_id cmp) const
 	{
-		return m_cmp_pres[cmp];
+		return m_sig.has(cmp);
 	}
 
 	template <typename Component>
 	bool cmpIsPres(void) const
 	{
-		return m_cmp_pres[Component::id];
+		return m_sig.has(Component::id);
+	}
+
+	const Cmp::Signature& sigGet(void) const
+	{
+		return m_sig;
 	}
 
 	const vector<cmp_id>& cmpsGet(void) const
@@ -62,13 +139,34 @@ public:
 		return m_cmp_ids;
 	}
 
+	// Marks a column as written at the current Map::version(), structural changes mark every column they move
+	void touch(cmp_id cmp, size_t row);
+
+	template <typename Component>
+	void touch(Chunk &c)
+	{
+		c.m_versions[Component::id] = version();
+	}
+
 	size_t add(size_t count);
 
 private:
-	void remove_imp(size_t offset, size_t count);
+	void resize(size_t size);
+	void release(size_t offset, size_t count);
+	void move(size_t dst, size_t src, size_t count);
+	void fillSwap(size_t offset, size_t count);
+	void touchRows(size_t offset, size_t count);
 
 public:
+	// Keeps row order, moves every trailing row
 	void remove(size_t offset, size_t count);
+	// Fills the hole with the last rows, O(count)
+	void removeSwap(size_t offset, size_t count);
+	// Moves rows to the end of dst, returns the first one there: shared columns are copied, others initialized or destroyed
+	// Ids are kept, the hole is filled with the last rows as in removeSwap
+	size_t migrate(Brush &dst, size_t offset, size_t count);
+	// Row i receives the row previously at order[i], order being a permutation of [0, size())
+	void permute(const size_t *order);
 };
 
 }
\ No newline at end of file
@@ -67,6 +67,27 @@ void RT_instance::destr(void*, size_t)
 {
 }
 
+void Parent::init(void *data, size_t count)
+{
+	auto d = reinterpret_cast<Parent*>(data);
+	for (size_t i = 0; i < count; i++) {
+		d[i].entity = ~0ULL;
+		d[i].depth = 0;
+	}
+}
+
+void Parent::destr(void*, size_t)
+{
+}
+
+void LocalTransform::init(void*, size_t)
+{
+}
+
+void LocalTransform::destr(void*, size_t)
+{
+}
+
 namespace Cmp {
 
 static constexpr sarray<size_t, max> get_sizes(void)
@@ -23,10 +23,12 @@ struct MVP;
 struct MV_normal;
 struct MW_local;
 struct RT_instance;
+struct Parent;
+struct LocalTransform;
 
 namespace Cmp {
 
-using list = List<Id, Transform, Point2D, OpaqueRender, MVP, MV_normal, MW_local, RT_instance>;
+using list = List<Id, Transform, Point2D, OpaqueRender, MVP, MV_normal, MW_local, RT_instance, Parent, LocalTransform>;
 
 #include "Cmp/Id_t.hpp"
 
@@ -37,7 +39,7 @@ struct Id : public Cmp::Id_t<Id>
 	static Cmp::init_fun_t init;
 	static Cmp::destr_fun_t destr;
 
-	using type = uint32_t;
+	using type = uint64_t;
 
 	type value;
 
@@ -135,6 +137,24 @@ struct RT_instance : public Cmp::Id_t<RT_instance>
 	uint32_t material;
 };
 
+// Transform becomes the parent Transform * LocalTransform, see TransformSystem
+struct Parent : public Cmp::Id_t<Parent>
+{
+	static Cmp::init_fun_t init;
+	static Cmp::destr_fun_t destr;
+
+	Id::type entity;	// ~0ULL: none
+	uint32_t depth;	// 1 for a child of a root, maintained by TransformSystem
+};
+
+struct LocalTransform : public Cmp::Id_t<LocalTransform>, public glm::dmat4
+{
+	static Cmp::init_fun_t init;
+	static Cmp::destr_fun_t destr;
+
+	using glm::dmat4::operator=;
+};
+
 }
 
 #include "Cmp/Utils.hpp"
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <bit>
 #include "Id.hpp"
 
 namespace Rosee {
@@ -30,5 +31,107 @@ static constexpr auto make_id_array(void)
 	return res;
 }
 
+// Archetype signature, one bit per component id
+struct Signature
+{
+	static inline constexpr size_t word_bits = 64;
+	static inline constexpr size_t word_count = (max + word_bits - 1) / word_bits;
+
+	uint64_t words[word_count] {};
+
+	constexpr void set(cmp_id cmp)
+	{
+		words[cmp / word_bits] |= static_cast<uint64_t>(1) << (cmp % word_bits);
+	}
+
+	constexpr void reset(cmp_id cmp)
+	{
+		words[cmp / word_bits] &= ~(static_cast<uint64_t>(1) << (cmp % word_bits));
+	}
+
+	constexpr bool has(cmp_id cmp) const
+	{
+		return (words[cmp / word_bits] >> (cmp % word_bits)) & 1;
+	}
+
+	// (*this & mask) == mask
+	constexpr bool contains(const Signature &mask) const
+	{
+		for (size_t i = 0; i < word_count; i++)
+			if ((words[i] & mask.words[i]) != mask.words[i])
+				return false;
+		return true;
+	}
+
+	// (*this & ~remove) | add
+	constexpr Signature migrated(const Signature &add, const Signature &remove) const
+	{
+		Signature res;
+		for (size_t i = 0; i < word_count; i++)
+			res.words[i] = (words[i] & ~remove.words[i]) | add.words[i];
+		return res;
+	}
+
+	constexpr bool operator==(const Signature &other) const
+	{
+		for (size_t i = 0; i < word_count; i++)
+			if (words[i] != other.words[i])
+				return false;
+		return true;
+	}
+
+	constexpr size_t count(void) const
+	{
+		size_t res = 0;
+		for (size_t i = 0; i < word_count; i++)
+			res += std::popcount(words[i]);
+		return res;
+	}
+
+	// Calls cb(cmp_id) for each component, in increasing id order
+	template <typename Callback>
+	constexpr void each(Callback &&cb) const
+	{
+		for (size_t i = 0; i < word_count; i++) {
+			auto w = words[i];
+			while (w != 0) {
+				cb(i * word_bits + std::countr_zero(w));
+				w &= w - 1;
+			}
+		}
+	}
+
+	constexpr size_t hash(void) const
+	{
+		uint64_t res = 0xCBF29CE484222325ULL;
+		for (size_t i = 0; i < word_count; i++) {
+			res ^= words[i];
+			res *= 0x100000001B3ULL;
+			res ^= res >> 29;
+		}
+		return res;
+	}
+};
+
+template <typename ...Components>
+static constexpr Signature make_signature(void)
+{
+	Signature res;
+
+	constexpr auto ids = make_id_array<Components...>();
+	for (size_t i = 0; i < ids.size(); i++)
+		res.set(ids.cdata()[i]);
+	return res;
+}
+
+static inline Signature make_signature(const array<cmp_id> &comps)
+{
+	Signature res;
+
+	for (size_t i = 0; i < comps.size; i++)
+		res.set(comps.data[i]);
+	return res;
+}
+
 }
 }
\ No newline at end of file
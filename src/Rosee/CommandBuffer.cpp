@@ -0,0 +1,22 @@
+#include "CommandBuffer.hpp"
+
+namespace Rosee {
+
+void CommandBuffer::set_imp(size_t target, size_t index, cmp_id cmp, const void *data)
+{
+	size_t off = m_data.size();
+	m_data.resize(off + Cmp::size[cmp]);
+	std::memcpy(m_data.data() + off, data, Cmp::size[cmp]);
+	m_sets.emplace(Set{target, index, cmp, off});
+}
+
+// Records are trivial, shrinking keeps the allocations for the next frame
+void CommandBuffer::clear(void)
+{
+	m_spawns.resize(0);
+	m_despawns.resize(0);
+	m_sets.resize(0);
+	m_data.resize(0);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Cmp.hpp"
+#include "vector.hpp"
+
+namespace Rosee {
+
+class Map;
+class Brush;
+
+// Structural changes recorded while brushes are being iterated, applied by Map::flush()
+class CommandBuffer
+{
+public:
+	// Entities of a recorded spawn, before they exist
+	struct Pending
+	{
+		size_t spawn;
+	};
+
+private:
+	friend class Map;
+
+	struct Spawn
+	{
+		Cmp::Signature sig;
+		size_t count;
+		Brush *brush;	// resolved on flush
+		size_t row;
+	};
+
+	struct Set
+	{
+		size_t target;	// entity id, or spawn index when pending
+		size_t index;	// row within the spawn when pending, ~0ULL otherwise
+		cmp_id cmp;
+		size_t data;	// offset in m_data
+	};
+
+	vector<Spawn> m_spawns;
+	vector<size_t> m_despawns;
+	vector<Set> m_sets;
+	vector<uint8_t> m_data;
+
+	void set_imp(size_t target, size_t index, cmp_id cmp, const void *data);
+
+public:
+	template <typename ...Components>
+	Pending spawn(size_t count = 1)
+	{
+		static constexpr auto sig = Cmp::make_signature<Components...>();
+		m_spawns.emplace(Spawn{sig, count, nullptr, 0});
+		return Pending{m_spawns.size() - 1};
+	}
+
+	void despawn(size_t id)
+	{
+		m_despawns.emplace(id);
+	}
+
+	template <typename Component>
+	void set(size_t id, const Component &value)
+	{
+		set_imp(id, ~0ULL, Component::id, &value);
+	}
+
+	template <typename Component>
+	void set(Pending pending, size_t index, const Component &value)
+	{
+		set_imp(pending.spawn, index, Component::id, &value);
+	}
+
+	bool empty(void) const
+	{
+		return m_spawns.size() == 0 && m_despawns.size() == 0 && m_sets.size() == 0;
+	}
+
+	void clear(void);
+};
+
+}
\ No newline at end of file
@@ -1,90 +1,271 @@
 #include <stdexcept>
+#include <algorithm>
 #include "Map.hpp"
-#include "StaticMap.hpp"
 #include "math.hpp"
 
 namespace Rosee {
 
-Map::Map(void)
+Map::Map(void) :
+	m_commands(new CommandBuffer[m_pool.size()])
 {
 }
 Map::~Map(void)
 {
+	delete[] m_commands;
+	for (size_t i = 0; i < m_brushes.size(); i++)
+		delete m_brushes[i];
 }
 
-void Map::add_range(size_t begin, size_t end, Brush &b, size_t b_ndx)
+Id::type Map::id_alloc(Brush &b, size_t row)
 {
-	auto &ranges = Static::get(m_ids);
+	size_t ndx;
+	if (m_free_slot != ~0ULL) {
+		ndx = m_free_slot;
+		m_free_slot = m_slots[ndx].row;
+	} else {
+		ndx = m_slots.size();
+		m_slots.emplace(Slot{nullptr, 0, 0});
+	}
+	auto &s = m_slots[ndx];
+	s.brush = &b;
+	s.row = row;
+	return static_cast<Id::type>(s.generation) << 32 | ndx;
+}
 
-	auto [it, suc] = ranges.emplace(std::piecewise_construct, std::forward_as_tuple(Map::Range{begin, end}), std::forward_as_tuple(b, b_ndx));
-	if (!suc)
-		throw std::runtime_error("Can't emplace in brush");
+void Map::id_release(Id::type id)
+{
+	auto ndx = id_index(id);
+	auto &s = m_slots[ndx];
+	s.brush = nullptr;
+	s.row = m_free_slot;
+	s.generation++;
+	m_free_slot = ndx;
 }
 
-Brush& Map::brush_resolve(const vector<cmp_id> &key)
+Brush& Map::brush_resolve(const Cmp::Signature &sig)
 {
-	auto &m = Static::get(m_brushes);
-	auto got = m.find(key);
-	if (got == m.end()) {
-		auto [it, suc] = m.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(*this, key));
-		if (!suc)
-			throw std::runtime_error("Can't emplace brush");
-		got = it;
-	}
-	return got->second;
+	auto got = m_brushes.find(sig);
+	if (got != SigMap<Brush*>::npos)
+		return *m_brushes[got];
+	// the renderer indexes its instance data by the slot of the Id
+	if (sig.has(OpaqueRender::id) && !sig.has(Id::id))
+		throw std::runtime_error("Rendered entities must have an Id");
+
+	auto &res = *m_brushes[m_brushes.emplace(sig, new Brush(*this, sig))];
+	for (size_t i = 0; i < m_queries.size(); i++)
+		if (sig.contains(m_queries.key(i)))
+			m_queries[i].emplace(&res);
+	return res;
 }
 
 std::pair<Brush*, size_t> Map::find(size_t id)
 {
-	auto &m = Static::get(m_ids);
-	auto got = m.find(Range{id, id + 1});
-	if (got == m.end())
+	auto ndx = id_index(id);
+	if (ndx >= m_slots.size())
 		return std::pair<Brush*, size_t>(nullptr, ~0ULL);
-	else
-		return std::pair<Brush*, size_t>(&got->second.first, got->second.second + (id - got->first.begin));
+	auto &s = m_slots[ndx];
+	if (s.brush == nullptr || s.generation != id_generation(id))
+		return std::pair<Brush*, size_t>(nullptr, ~0ULL);
+	return std::pair<Brush*, size_t>(s.brush, s.row);
+}
+
+void Map::remove(size_t id)
+{
+	auto [b, row] = find(id);
+	if (b == nullptr)
+		throw std::runtime_error("Can't find entity for destruction");
+	b->removeSwap(row, 1);
+}
+
+void Map::removeOrdered(size_t id)
+{
+	auto [b, row] = find(id);
+	if (b == nullptr)
+		throw std::runtime_error("Can't find entity for destruction");
+	b->remove(row, 1);
 }
 
-void Map::remove(size_t id, size_t count)
+Brush& Map::edge_resolve(Brush &b, cmp_id cmp, bool add)
 {
-	auto &m = Static::get(m_ids);
-	while (count > 0) {
-		auto cur_range = Range{id, id + count};
-		auto got = m.find(Range{id, id + 1});
-		if (got == m.end())
-			throw std::runtime_error("Can't find entity for destruction");
-		auto g_range = got->first;
-		auto g_pos = got->second;
-		m.erase(got);
-		bool room_l = g_range.begin < cur_range.begin;
-		bool room_r = cur_range.end < g_range.end;
-		size_t off = cur_range.begin - g_range.begin;
-		size_t end = min(cur_range.end, g_range.end);
-		size_t size = end - cur_range.begin;
-		count -= size;
-		id += size;
-		if (room_l)
-			add_range(g_range.begin, cur_range.begin, g_pos.first, g_pos.second);
-		if (room_r)
-			add_range(cur_range.end, g_range.end, g_pos.first, g_pos.second + off + size);
-		g_pos.first.remove_imp(g_pos.second + off, size);
+	auto &edge = add ? b.m_add_edges[cmp] : b.m_remove_edges[cmp];
+	if (edge == nullptr) {
+		auto sig = b.sigGet();
+		if (add)
+			sig.set(cmp);
+		else
+			sig.reset(cmp);
+		edge = &brush_resolve(sig);
 	}
+	return *edge;
 }
 
-void Map::query_imp(const array<cmp_id> &comps, BrushCb *cb, void *data)
+std::pair<Brush*, size_t> Map::migrate_imp(size_t id, Brush& (*target)(Map &map, Brush &b))
 {
-	auto &m = Static::get(m_brushes);
-	for (auto &bp : m) {
-		auto &b = bp.second;
-		bool match = true;
-		for (size_t i = 0; i < comps.size; i++)
-			if (!b.cmpIsPres(comps.data[i])) {
-				match = false;
-				break;
-			}
-		if (!match)
+	auto [b, row] = find(id);
+	if (b == nullptr)
+		throw std::runtime_error("Can't find entity for migration");
+	auto &dst = target(*this, *b);
+	if (&dst == b)
+		return std::pair<Brush*, size_t>(b, row);
+	return std::pair<Brush*, size_t>(&dst, b->migrate(dst, row, 1));
+}
+
+std::pair<Brush&, size_t> Map::migrate(Brush &src, Brush &dst, size_t offset, size_t count)
+{
+	if (&src == &dst)
+		return std::pair<Brush&, size_t>(dst, offset);
+	return std::pair<Brush&, size_t>(dst, src.migrate(dst, offset, count));
+}
+
+void Map::flush(void)
+{
+	size_t buffer_count = m_pool.size();
+
+	struct Write {
+		Brush *b;
+		size_t row;
+		cmp_id cmp;
+		const uint8_t *data;
+	};
+	vector<Write> writes;
+	for (size_t i = 0; i < buffer_count; i++) {
+		auto &cb = m_commands[i];
+		for (auto &s : cb.m_sets) {
+			if (s.index != ~0ULL)
+				continue;
+			auto [b, row] = find(s.target);
+			if (b == nullptr || !b->cmpIsPres(s.cmp))
+				continue;
+			writes.emplace(Write{b, row, s.cmp, cb.m_data.data() + s.data});
+		}
+	}
+	// stable: last write recorded wins
+	std::stable_sort(writes.data(), writes.data() + writes.size(), [](const Write &l, const Write &r){
+		return l.b != r.b ? l.b < r.b : l.row < r.row;
+	});
+	for (auto &w : writes) {
+		std::memcpy(w.b->at(w.cmp, w.row), w.data, Cmp::size[w.cmp]);
+		w.b->touch(w.cmp, w.row);
+	}
+
+	// Highest rows first: swap-and-pop then only ever moves rows that are kept
+	struct Despawn {
+		Brush *b;
+		size_t row;
+	};
+	vector<Despawn> despawns;
+	for (size_t i = 0; i < buffer_count; i++)
+		for (auto &id : m_commands[i].m_despawns) {
+			auto [b, row] = find(id);
+			if (b != nullptr)
+				despawns.emplace(Despawn{b, row});
+		}
+	std::sort(despawns.data(), despawns.data() + despawns.size(), [](const Despawn &l, const Despawn &r){
+		return l.b != r.b ? l.b < r.b : l.row > r.row;
+	});
+	for (size_t i = 0; i < despawns.size(); i++) {
+		auto &d = despawns[i];
+		if (i > 0 && despawns[i - 1].b == d.b && despawns[i - 1].row == d.row)
 			continue;
-		cb(b, data);
+		d.b->removeSwap(d.row, 1);
+	}
+
+	// One add() per brush for all spawns targeting it
+	struct Batch {
+		Brush *b;
+		size_t count;
+		size_t base;
+	};
+	vector<Batch> batches;
+	for (size_t i = 0; i < buffer_count; i++)
+		for (auto &sp : m_commands[i].m_spawns) {
+			sp.brush = &brush_resolve(sp.sig);
+			if (sp.brush->m_flush_batch == ~0ULL) {
+				sp.brush->m_flush_batch = batches.size();
+				batches.emplace(Batch{sp.brush, 0, 0});
+			}
+			auto &ba = batches[sp.brush->m_flush_batch];
+			sp.row = ba.count;
+			ba.count += sp.count;
+		}
+	for (auto &ba : batches)
+		ba.base = ba.b->add(ba.count);
+	for (size_t i = 0; i < buffer_count; i++) {
+		auto &cb = m_commands[i];
+		for (auto &sp : cb.m_spawns)
+			sp.row += batches[sp.brush->m_flush_batch].base;
+		for (auto &s : cb.m_sets) {
+			if (s.index == ~0ULL)
+				continue;
+			auto &sp = cb.m_spawns[s.target];
+			if (s.index >= sp.count || !sp.brush->cmpIsPres(s.cmp))
+				continue;
+			std::memcpy(sp.brush->at(s.cmp, sp.row + s.index), cb.m_data.data() + s.data, Cmp::size[s.cmp]);
+			sp.brush->touch(s.cmp, sp.row + s.index);
+		}
+		cb.clear();
+	}
+	for (auto &ba : batches)
+		ba.b->m_flush_batch = ~0ULL;
+}
+
+size_t Map::query_resolve(const Cmp::Signature &mask)
+{
+	auto got = m_queries.find(mask);
+	if (got != SigMap<vector<Brush*>>::npos)
+		return got;
+
+	vector<Brush*> res;
+	for (size_t i = 0; i < m_brushes.size(); i++)
+		if (m_brushes.key(i).contains(mask))
+			res.emplace(m_brushes[i]);
+	return m_queries.emplace(mask, std::move(res));
+}
+
+void Map::query_imp(const Cmp::Signature &mask, BrushCb *cb, void *data)
+{
+	auto q = query_resolve(mask);
+	// re-fetched every iteration: the callback may create brushes or queries
+	for (size_t i = 0; i < m_queries[q].size(); i++)
+		cb(*m_queries[q][i], data);
+}
+
+void Map::query_par_imp(const Cmp::Signature &mask, size_t grain, cmp_id changed, uint64_t since, ChunkCb *cb, void *data)
+{
+	struct Ctx {
+		ChunkCb *cb;
+		void *data;
+	} ctx{cb, data};
+
+	auto is_changed = [&](Brush::Chunk &c){
+		return changed == Cmp::max || c.version(changed) > since;
+	};
+
+	vector<ThreadPool::Task> tasks;
+	auto &bs = m_queries[query_resolve(mask)];
+	for (size_t i = 0; i < bs.size(); i++) {
+		auto &b = *bs[i];
+		size_t chunk_count = b.chunks().size();
+		size_t step = max(grain / b.chunkCapacity(), static_cast<size_t>(1));
+		// runs of consecutive changed chunks, at most step long
+		for (size_t j = 0; j < chunk_count;) {
+			if (!is_changed(b.chunks()[j])) {
+				j++;
+				continue;
+			}
+			size_t end = j + 1;
+			while (end < chunk_count && end - j < step && is_changed(b.chunks()[end]))
+				end++;
+			tasks.emplace(ThreadPool::Task{[](void *data, void *ctx, size_t begin, size_t end){
+				auto &c = *reinterpret_cast<Ctx*>(data);
+				auto &b = *reinterpret_cast<Brush*>(ctx);
+				for (size_t i = begin; i < end; i++)
+					c.cb(b, b.chunks()[i], c.data);
+			}, &ctx, &b, j, end});
+			j = end;
+		}
 	}
+	m_pool.run(tasks.data(), tasks.size());
 }
 
 }
\ No newline at end of file
@@ -1,45 +1,86 @@
 #pragma once
 
 #include "Brush.hpp"
-#include "Static.hpp"
+#include "SigMap.hpp"
+#include "CommandBuffer.hpp"
+#include "ThreadPool.hpp"
 
 namespace Rosee {
 
 class Map
 {
-	struct Range
+	struct Slot
 	{
-		size_t begin;
-		size_t end;
-
-		bool operator<(const Range &other) const
-		{
-			return end <= other.begin;
-		}
+		Brush *brush;	// nullptr when free
+		size_t row;	// next free slot when free
+		uint32_t generation;
 	};
 
-	Static::map<vector<cmp_id>, Brush> m_brushes;
-	Static::map<Range, std::pair<Brush&, size_t>> m_ids;
-	size_t m_id = 0;
+	SigMap<Brush*> m_brushes;	// owning
+	SigMap<vector<Brush*>> m_queries;	// brushes matching each queried mask, extended on brush creation
+	vector<Slot> m_slots;
+	size_t m_free_slot = ~0ULL;
+	ThreadPool m_pool;
+	CommandBuffer *m_commands;	// one per pool thread
+	uint64_t m_version = 1;
 
 	friend class Brush;
 
-	void add_range(size_t begin, size_t end, Brush &b, size_t b_ndx);
+	Id::type id_alloc(Brush &b, size_t row);
+	void id_release(Id::type id);
+	void id_move(Id::type id, size_t row)
+	{
+		m_slots[id_index(id)].row = row;
+	}
+	void id_rebind(Id::type id, Brush &b, size_t row)
+	{
+		auto &s = m_slots[id_index(id)];
+		s.brush = &b;
+		s.row = row;
+	}
 
 public:
 	Map(void);
 	~Map(void);
 
+	ThreadPool& pool(void)
+	{
+		return m_pool;
+	}
+
+	// Stamp of the writes made now, see Brush::touch()
+	uint64_t version(void) const
+	{
+		return m_version;
+	}
+
+	// Starts a new version and returns the previous one: as since, it selects writes made after this call
+	uint64_t tick(void)
+	{
+		return m_version++;
+	}
+
+	// Buffer of the calling pool thread, threads outside of the pool share the first one
+	CommandBuffer& commands(void)
+	{
+		return m_commands[ThreadPool::workerIndex()];
+	}
+
+	// Applies then clears every command buffer: component writes, despawns, then spawns batched per brush
+	// Must not run concurrently with any query
+	void flush(void);
+
 private:
-	Brush& brush_resolve(const vector<cmp_id> &key);
+	Brush& brush_resolve(const Cmp::Signature &sig);
 
 public:
 	template <typename ...Components>
 	Brush& brush(void)
 	{
-		constexpr auto sign = Cmp::make_id_array<Components...>();
-		size_t fake_vec[3] = {sign.size(), 0, reinterpret_cast<size_t>(sign.data())};
-		return brush_resolve(*reinterpret_cast<vector<cmp_id>*>(fake_vec));
+		static_assert(!(std::is_same_v<Components, OpaqueRender> || ...) || (std::is_same_v<Components, Id> || ...),
+			"Rendered entities must have an Id");
+		static constexpr auto sig = Cmp::make_signature<Components...>();
+		return brush_resolve(sig);
 	}
 
 	template <typename ...Components>
@@ -60,32 +101,135 @@ public:
 		}
 		auto &b = brush<Components...>();
 		auto b_ndx = b.add(count);
-		auto res = b.template get<Id>()[b_ndx];
+		auto res = b.template at<Id>(b_ndx);
 		return res;
 	}
 
+	// Ids are generational handles: slot index in the low half, generation in the high half
+	static constexpr uint32_t id_index(Id::type id)
+	{
+		return static_cast<uint32_t>(id);
+	}
+
+	static constexpr uint32_t id_generation(Id::type id)
+	{
+		return static_cast<uint32_t>(id >> 32);
+	}
+
+	// {nullptr, ~0ULL} when id is not alive
 	std::pair<Brush*, size_t> find(size_t id);
 
-	void remove(size_t id, size_t count);
+	// Swap-and-pop, O(1), last row of the brush takes the place of the removed one
+	void remove(size_t id);
+	// Keeps row order in the brush, O(brush size)
+	void removeOrdered(size_t id);
+
+private:
+	Brush& edge_resolve(Brush &b, cmp_id cmp, bool add);
+	std::pair<Brush*, size_t> migrate_imp(size_t id, Brush& (*target)(Map &map, Brush &b));
+
+public:
+	// Moves the entity to the brush with Component added / removed, keeping its id and every other component
+	// Returns its new location, or where it already is when nothing changes
+	template <typename Component>
+	std::pair<Brush*, size_t> addComponent(size_t id)
+	{
+		return migrate_imp(id, [](Map &map, Brush &b) -> Brush& {
+			return map.edge_resolve(b, Component::id, true);
+		});
+	}
+
+	template <typename Component>
+	std::pair<Brush*, size_t> removeComponent(size_t id)
+	{
+		static_assert(Component::id != Id::id, "Can't remove Id from a live entity");
+		return migrate_imp(id, [](Map &map, Brush &b) -> Brush& {
+			return map.edge_resolve(b, Component::id, false);
+		});
+	}
+
+	// Batched variants: rows [offset, offset + count) of b move at once, last rows of b fill the hole
+	// Returns the target brush and the first moved row in it
+	template <typename Component>
+	std::pair<Brush&, size_t> addComponent(Brush &b, size_t offset, size_t count)
+	{
+		return migrate(b, edge_resolve(b, Component::id, true), offset, count);
+	}
+
+	template <typename Component>
+	std::pair<Brush&, size_t> removeComponent(Brush &b, size_t offset, size_t count)
+	{
+		return migrate(b, edge_resolve(b, Component::id, false), offset, count);
+	}
+
+	// Any number of components at once
+	template <typename ...Add, typename ...Remove>
+	std::pair<Brush&, size_t> migrate(Brush &b, size_t offset, size_t count, Cmp::List<Add...>, Cmp::List<Remove...>)
+	{
+		static constexpr auto add = Cmp::make_signature<Add...>();
+		static constexpr auto remove = Cmp::make_signature<Remove...>();
+		return migrate(b, brush_resolve(b.sigGet().migrated(add, remove)), offset, count);
+	}
+
+	std::pair<Brush&, size_t> migrate(Brush &src, Brush &dst, size_t offset, size_t count);
 
 private:
 	using BrushCb = void (Brush &b, void *data);
-	void query_imp(const array<cmp_id> &comps, BrushCb *cb, void *data);
+	size_t query_resolve(const Cmp::Signature &mask);
+	void query_imp(const Cmp::Signature &mask, BrushCb *cb, void *data);
 
 public:
 	template <typename ...Components, typename Callback>
 	void query(Callback &&callback)
 	{
-		query_imp(Cmp::make_id_array<Components...>(), [](Brush &b, void *data){
-			(*reinterpret_cast<Callback*>(data))(b);
+		static constexpr auto mask = Cmp::make_signature<Components...>();
+		query_imp(mask, [](Brush &b, void *data){
+			(*reinterpret_cast<std::remove_reference_t<Callback>*>(data))(b);
 		}, &callback);
 	}
 
 	template <typename Callback>
 	void query(const array<cmp_id> &comps, Callback &&callback)
 	{
-		query_imp(comps, [](Brush &b, void *data){
-			(*reinterpret_cast<Callback*>(data))(b);
+		query_imp(Cmp::make_signature(comps), [](Brush &b, void *data){
+			(*reinterpret_cast<std::remove_reference_t<Callback>*>(data))(b);
+		}, &callback);
+	}
+
+	// Chunks of each matching brush are grouped in runs of about grain rows (at least one chunk), run on the pool
+	// Returns once every chunk is done, callback must be safe to call concurrently
+	static inline constexpr size_t par_grain = 1024;
+
+private:
+	using ChunkCb = void (Brush &b, Brush::Chunk &c, void *data);
+	// changed == Cmp::max: every chunk
+	void query_par_imp(const Cmp::Signature &mask, size_t grain, cmp_id changed, uint64_t since, ChunkCb *cb, void *data);
+
+public:
+	template <typename ...Components, typename Callback>
+	void query_par(Callback &&callback, size_t grain = par_grain)
+	{
+		static constexpr auto mask = Cmp::make_signature<Components...>();
+		query_par_imp(mask, grain, Cmp::max, 0, [](Brush &b, Brush::Chunk &c, void *data){
+			(*reinterpret_cast<std::remove_reference_t<Callback>*>(data))(b, c);
+		}, &callback);
+	}
+
+	template <typename Callback>
+	void query_par(const array<cmp_id> &comps, Callback &&callback, size_t grain = par_grain)
+	{
+		query_par_imp(Cmp::make_signature(comps), grain, Cmp::max, 0, [](Brush &b, Brush::Chunk &c, void *data){
+			(*reinterpret_cast<std::remove_reference_t<Callback>*>(data))(b, c);
+		}, &callback);
+	}
+
+	// query_par restricted to the chunks whose Changed column was written after since (a previous tick())
+	template <typename Changed, typename ...Components, typename Callback>
+	void query_changed(uint64_t since, Callback &&callback, size_t grain = par_grain)
+	{
+		static constexpr auto mask = Cmp::make_signature<Changed, Components...>();
+		query_par_imp(mask, grain, Changed::id, since, [](Brush &b, Brush::Chunk &c, void *data){
+			(*reinterpret_cast<std::remove_reference_t<Callback>*>(data))(b, c);
 		}, &callback);
 	}
 };
@@ -0,0 +1,243 @@
+#include "MeshCache.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Rosee {
+
+MeshCache::MeshCache(const char *source, const char *kind) :
+	m_path(std::string(source) + kind + ".rmesh")
+{
+	std::error_code ec;
+	m_source_size = std::filesystem::file_size(source, ec);
+	if (ec)
+		throw std::runtime_error(source);
+	m_source_time = std::filesystem::last_write_time(source, ec).time_since_epoch().count();
+	if (ec)
+		throw std::runtime_error(source);
+	m_built_names.emplace('\0');
+}
+
+MeshCache::~MeshCache(void)
+{
+	unmap();
+}
+
+bool MeshCache::map(void)
+{
+#ifdef _WIN32
+	m_file = CreateFileA(m_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		m_file = nullptr;
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(Header))) {
+		unmap();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping == nullptr) {
+		unmap();
+		return false;
+	}
+	m_data = reinterpret_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (m_data == nullptr) {
+		unmap();
+		return false;
+	}
+	m_size = static_cast<size_t>(size.QuadPart);
+#else
+	m_fd = open(m_path.c_str(), O_RDONLY);
+	if (m_fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(m_fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+		unmap();
+		return false;
+	}
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+	if (data == MAP_FAILED) {
+		unmap();
+		return false;
+	}
+	// read once front to back by the upload ring
+	posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+	m_data = reinterpret_cast<const uint8_t*>(data);
+	m_size = static_cast<size_t>(st.st_size);
+#endif
+	if (!bindMapped()) {
+		unmap();
+		return false;
+	}
+	return true;
+}
+
+// Checks the mapped file against the source and its own bounds, binds its tables when it is usable
+bool MeshCache::bindMapped(void)
+{
+	Header h;
+	std::memcpy(&h, m_data, sizeof(Header));
+	if (h.magic != magic || h.version != version || h.source_size != m_source_size || h.source_time != m_source_time)
+		return false;
+	uint64_t tables = sizeof(Header) + static_cast<uint64_t>(h.material_count) * sizeof(Material) +
+		static_cast<uint64_t>(h.range_count) * sizeof(Range) + h.names_size;
+	if (h.names_size == 0 || tables > h.vertices_offset || h.vertices_offset > m_size || h.vertices_size > m_size - h.vertices_offset)
+		return false;
+	// ranges first, they need the 8 bytes alignment of the header
+	auto ranges = reinterpret_cast<const Range*>(m_data + sizeof(Header));
+	auto materials = reinterpret_cast<const Material*>(ranges + h.range_count);
+	auto names = reinterpret_cast<const char*>(materials + h.material_count);
+	if (names[h.names_size - 1] != '\0')
+		return false;
+	for (uint32_t i = 0; i < h.material_count; i++)
+		if (materials[i].name >= h.names_size || materials[i].diffuse >= h.names_size || materials[i].height >= h.names_size)
+			return false;
+	for (uint32_t i = 0; i < h.range_count; i++) {
+		auto &r = ranges[i];
+		if (r.offset > h.vertices_size || static_cast<uint64_t>(r.vertex_count) * r.stride > h.vertices_size - r.offset)
+			return false;
+		if (r.material < -1 || r.material >= static_cast<int32_t>(h.material_count))
+			return false;
+	}
+
+	m_header = h;
+	m_materials = materials;
+	m_ranges = ranges;
+	m_names = names;
+	m_vertices = m_data + h.vertices_offset;
+	return true;
+}
+
+void MeshCache::unmap(void)
+{
+#ifdef _WIN32
+	if (m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if (m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if (m_file != nullptr)
+		CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if (m_data != nullptr)
+		munmap(const_cast<uint8_t*>(m_data), m_size);
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_header = Header{};
+	m_materials = nullptr;
+	m_ranges = nullptr;
+	m_names = nullptr;
+	m_vertices = nullptr;
+}
+
+// Accessors read what was built until the cache is mapped again
+void MeshCache::bindBuilt(void)
+{
+	m_header.material_count = static_cast<uint32_t>(m_built_materials.size());
+	m_header.range_count = static_cast<uint32_t>(m_built_ranges.size());
+	m_header.names_size = m_built_names.size();
+	m_header.vertices_size = m_built_vertices.size();
+	m_materials = m_built_materials.data();
+	m_ranges = m_built_ranges.data();
+	m_names = m_built_names.data();
+	m_vertices = m_built_vertices.data();
+}
+
+uint32_t MeshCache::addName(const std::string &name)
+{
+	if (name.size() == 0)
+		return 0;
+	auto res = static_cast<uint32_t>(m_built_names.size());
+	m_built_names.resize(res + name.size() + 1);
+	std::memcpy(&m_built_names[res], name.c_str(), name.size() + 1);
+	return res;
+}
+
+uint32_t MeshCache::addMaterial(const std::string &name, const std::string &diffuse, const std::string &height)
+{
+	auto res = static_cast<uint32_t>(m_built_materials.size());
+	auto &m = m_built_materials.emplace();
+	m.name = addName(name);
+	m.diffuse = addName(diffuse);
+	m.height = addName(height);
+	bindBuilt();
+	return res;
+}
+
+void MeshCache::add(GeometryFormat format, int32_t material, const void *vertices, uint32_t count, size_t stride)
+{
+	auto src = reinterpret_cast<const uint8_t*>(vertices);
+	size_t offset = (m_built_vertices.size() + vertices_align - 1) / vertices_align * vertices_align;
+	m_built_vertices.resize(offset + count * stride);
+	std::memcpy(m_built_vertices.data() + offset, src, count * stride);
+
+	auto &r = m_built_ranges.emplace();
+	r.format = format;
+	r.material = material;
+	r.vertex_count = count;
+	r.stride = static_cast<uint32_t>(stride);
+	r.offset = offset;
+	r.aabb = Aabb();
+	for (uint32_t i = 0; i < count; i++) {
+		float p[3];
+		std::memcpy(p, src + i * stride, sizeof(p));
+		r.aabb.extend(glm::dvec3(p[0], p[1], p[2]));
+	}
+	bindBuilt();
+}
+
+// Written aside then renamed, a cache is never seen half written
+void MeshCache::write(void)
+{
+	Header h{};
+	h.magic = magic;
+	h.version = version;
+	h.source_size = m_source_size;
+	h.source_time = m_source_time;
+	h.material_count = static_cast<uint32_t>(m_built_materials.size());
+	h.range_count = static_cast<uint32_t>(m_built_ranges.size());
+	h.names_size = m_built_names.size();
+	size_t tables = sizeof(Header) + m_built_materials.size() * sizeof(Material) + m_built_ranges.size() * sizeof(Range) + m_built_names.size();
+	h.vertices_offset = (tables + vertices_align - 1) / vertices_align * vertices_align;
+	h.vertices_size = m_built_vertices.size();
+
+	auto tmp = m_path + ".tmp";
+	{
+		std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+		static const char zeros[vertices_align] {};
+		file.write(reinterpret_cast<const char*>(&h), sizeof(Header));
+		file.write(reinterpret_cast<const char*>(m_built_ranges.data()), m_built_ranges.size() * sizeof(Range));
+		file.write(reinterpret_cast<const char*>(m_built_materials.data()), m_built_materials.size() * sizeof(Material));
+		file.write(m_built_names.data(), m_built_names.size());
+		file.write(zeros, h.vertices_offset - tables);
+		file.write(reinterpret_cast<const char*>(m_built_vertices.data()), m_built_vertices.size());
+		if (!file.good()) {
+			std::cerr << "WARN: could not write mesh cache " << tmp << std::endl;
+			return;
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp, m_path, ec);
+	if (ec)
+		std::cerr << "WARN: could not write mesh cache " << m_path << ": " << ec.message() << std::endl;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "Model.hpp"
+#include "vector.hpp"
+#include <string>
+
+namespace Rosee {
+
+// Binary cache of a parsed OBJ, written next to it as <source><kind>.rmesh
+// Vertices are in their GPU layout, one range per material run, so a mapped cache is copied as is into the upload ring
+// The cache is stale when the source size or modification time differs, or when it has another version
+class MeshCache
+{
+public:
+	static inline constexpr uint32_t magic = 0x48534D52;	// "RMSH"
+	static inline constexpr uint32_t version = 1;	// bump when a layout here or in Vertex changes
+	static inline constexpr size_t vertices_align = 16;
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t source_size;
+		int64_t source_time;
+		uint32_t material_count;
+		uint32_t range_count;
+		uint64_t names_size;
+		uint64_t vertices_offset;	// bytes from the start of the file
+		uint64_t vertices_size;
+	};
+
+	// Offsets in the name table, 0 is the empty name
+	struct Material
+	{
+		uint32_t name;
+		uint32_t diffuse;
+		uint32_t height;	// displacement, or bump when there is none
+	};
+
+	struct Range
+	{
+		GeometryFormat format;
+		int32_t material;	// -1 when the source has none
+		uint32_t vertex_count;
+		uint32_t stride;
+		uint64_t offset;	// bytes from the first vertex
+		Aabb aabb;
+	};
+
+private:
+	std::string m_path;
+	uint64_t m_source_size = 0;
+	int64_t m_source_time = 0;
+
+	// mapped file, or what add() built when there is none
+	const uint8_t *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	void *m_file = nullptr;
+	void *m_mapping = nullptr;
+#else
+	int m_fd = -1;
+#endif
+	Header m_header{};
+	const Material *m_materials = nullptr;
+	const Range *m_ranges = nullptr;
+	const char *m_names = nullptr;
+	const uint8_t *m_vertices = nullptr;
+
+	vector<Material> m_built_materials;
+	vector<Range> m_built_ranges;
+	vector<char> m_built_names;
+	vector<uint8_t> m_built_vertices;
+
+	bool bindMapped(void);
+	uint32_t addName(const std::string &name);
+	void unmap(void);
+	void bindBuilt(void);
+
+public:
+	// Only stats the source, throws when it does not exist, kind tells apart caches of one source in different layouts
+	MeshCache(const char *source, const char *kind = "");
+	MeshCache(const MeshCache&) = delete;
+	MeshCache& operator=(const MeshCache&) = delete;
+	// Unmaps and closes the cache file
+	~MeshCache(void);
+
+	// Maps the cache, false when it is missing or stale: fill it with addMaterial() and add(), then write()
+	bool map(void);
+
+	uint32_t addMaterial(const std::string &name, const std::string &diffuse, const std::string &height);
+	// Positions lead every vertex layout, the bounds are taken from them
+	void add(GeometryFormat format, int32_t material, const void *vertices, uint32_t count, size_t stride);
+	// Failing to write only costs the next load a parse
+	void write(void);
+
+	uint32_t materialCount(void) const
+	{
+		return m_header.material_count;
+	}
+
+	const Material& material(uint32_t ndx) const
+	{
+		return m_materials[ndx];
+	}
+
+	const char* name(uint32_t offset) const
+	{
+		return m_names + offset;
+	}
+
+	uint32_t rangeCount(void) const
+	{
+		return m_header.range_count;
+	}
+
+	const Range& range(uint32_t ndx) const
+	{
+		return m_ranges[ndx];
+	}
+
+	const void* vertices(const Range &range) const
+	{
+		return m_vertices + range.offset;
+	}
+};
+
+}
\ No newline at end of file
@@ -1,18 +1,38 @@
 #pragma once
 
 #include "Vk.hpp"
+#include "Bounds.hpp"
 
 namespace Rosee {
 
+enum class GeometryFormat : uint32_t {
+	Pn,	// Vertex::pn
+	Pnu,
+	Pntbu,
+	Index
+};
+
+// Part of a shared geometry buffer, see Renderer::allocateGeometry
+struct GeometryRange
+{
+	VkBuffer buffer;
+	GeometryFormat format;
+	uint32_t block;
+	VkDeviceSize offset;	// bytes
+	VkDeviceSize size;
+};
+
 struct Model
 {
 	size_t primitiveCount;
-	Vk::BufferAllocation vertexBuffer;
-	Vk::BufferAllocation indexBuffer;
+	GeometryRange vertices;
+	uint32_t firstVertex;	// vertices.offset / vertex stride
+	GeometryRange indices;	// only when indexType is not VK_INDEX_TYPE_NONE_KHR
+	uint32_t firstIndex;	// indices.offset / index size
 	VkIndexType indexType;
-
-	void destroy(Vk::Allocator allocator);
-
+	Aabb aabb;	// model space
+	Sphere sphere;	// model space, encloses aabb
+	uint64_t ticket = 0;	// upload of its geometry, and of the textures loaded before it, drawn once landed
 };
 
 }
\ No newline at end of file
@@ -10,7 +10,6 @@ struct Pipeline : public Vk::Handle<VkPipeline>
 {
 	vector<VkShaderModule> shaderModules;
 	VkPipelineLayout pipelineLayout;
-	uint32_t pushConstantRange;
 	uint32_t dynamicCount = 0;
 	cmp_id dynamics[8];
 
@@ -1,5 +1,6 @@
 #include "Renderer.hpp"
 #include "c.hpp"
+#include "sort.hpp"
 #include <map>
 #include <iostream>
 #include <chrono>
@@ -7,6 +8,7 @@
 #include <fstream>
 #include <sstream>
 #include <ctime>
+#include <numeric>
 #include "../../dep/tinyobjloader/tiny_obj_loader.h"
 #include "../../dep/stb/stb_image.h"
 
@@ -198,6 +200,7 @@ Vk::Device Renderer::createDevice(void)
 	VkPhysicalDeviceFeatures physical_devices_features[physical_device_count];
 	uint32_t physical_devices_gqueue_families[physical_device_count];
 	uint32_t physical_devices_cqueue_families[physical_device_count];
+	uint32_t physical_devices_tqueue_families[physical_device_count];
 	vkAssert(vkEnumeratePhysicalDevices(m_instance, &physical_device_count, physical_devices));
 	Ext ext_supports[physical_device_count];
 
@@ -207,10 +210,12 @@ Vk::Device Renderer::createDevice(void)
 	}
 
 	static auto required_features = VkPhysicalDeviceFeatures {
+		.drawIndirectFirstInstance = true,	// culled instances are fetched at firstInstance + i
 		.samplerAnisotropy = true
 	};
 	static const char *required_exts[] {
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
+		VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+		VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME	// upload tickets
 	};
 
 	static const char *ray_tracing_exts[] {
@@ -268,6 +273,9 @@ Vk::Device Renderer::createDevice(void)
 		}
 		if (!req_ext_supported)
 			continue;
+		for (size_t k = 0; k < ext_count; k++)
+			if (std::strcmp(exts[k].extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+				ext_supports[i].draw_indirect_count = true;
 		ext_supports[i].ray_tracing = true;
 		if (m_instance_version < VK_API_VERSION_1_1)
 			ext_supports[i].ray_tracing = false;
@@ -306,6 +314,7 @@ Vk::Device Renderer::createDevice(void)
 
 		physical_devices_gqueue_families[i] = ~0U;
 		physical_devices_cqueue_families[i] = ~0U;
+		physical_devices_tqueue_families[i] = ~0U;
 		size_t gbits = ~0ULL;
 		size_t cbits = ~0ULL;
 		for (uint32_t j = 0; j < queue_family_count; j++) {
@@ -324,6 +333,10 @@ Vk::Device Renderer::createDevice(void)
 				physical_devices_cqueue_families[i] = j;
 				cbits = fbits;
 			}
+			// copy engine, streams assets without taking time from the graphics queue
+			if ((cur.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(cur.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				physical_devices_tqueue_families[i] == ~0U)
+				physical_devices_tqueue_families[i] = j;
 		}
 		if (physical_devices_gqueue_families[i] == ~0U)
 			continue;
@@ -356,6 +369,19 @@ Vk::Device Renderer::createDevice(void)
 	m_physical_device = physical_devices[chosen];
 	ext = ext_supports[chosen];
 
+	{
+		// more than the 256MB BAR window: resizable BAR or unified memory
+		static constexpr VkDeviceSize direct_heap_min = static_cast<VkDeviceSize>(256) << 20;
+		VkPhysicalDeviceMemoryProperties props;
+		vkGetPhysicalDeviceMemoryProperties(m_physical_device, &props);
+		VkMemoryPropertyFlags direct = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+			auto &t = props.memoryTypes[i];
+			if ((t.propertyFlags & direct) == direct && props.memoryHeaps[t.heapIndex].size > direct_heap_min)
+				m_dyn_direct = true;
+		}
+	}
+
 	{
 		uint32_t present_mode_count;
 		vkAssert(Vk::ext.vkGetPhysicalDeviceSurfacePresentModesKHR(physical_devices[chosen], m_surface, &present_mode_count, nullptr));
@@ -391,6 +417,9 @@ Vk::Device Renderer::createDevice(void)
 
 	m_queue_family_graphics = physical_devices_gqueue_families[chosen];
 	m_queue_family_compute = physical_devices_cqueue_families[chosen];
+	m_queue_family_transfer = physical_devices_tqueue_families[chosen];
+	if (m_queue_family_transfer == ~0U)
+		m_queue_family_transfer = m_queue_family_graphics;
 
 	std::cout << "Device name: " << m_properties.deviceName << std::endl;
 	std::cout << std::endl;
@@ -401,7 +430,12 @@ Vk::Device Renderer::createDevice(void)
 	VkPhysicalDeviceAccelerationStructureFeaturesKHR acc_features{};
 	VkPhysicalDeviceBufferDeviceAddressFeaturesKHR buffer_device_address_features{};
 	VkPhysicalDeviceScalarBlockLayoutFeaturesEXT scalar_block_layout_features{};
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features{};
 	auto pnext = &ci.pNext;
+	timeline_semaphore_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timeline_semaphore_features.timelineSemaphore = VK_TRUE;
+	*pnext = &timeline_semaphore_features;
+	pnext = const_cast<const void**>(&timeline_semaphore_features.pNext);
 	if (ext.ray_tracing) {
 		rt_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_FEATURES_KHR;
 		rt_features.rayTracingPipeline = VK_TRUE;
@@ -432,36 +466,35 @@ Vk::Device Renderer::createDevice(void)
 	cqci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
 	cqci.queueFamilyIndex = m_queue_family_compute;
 	cqci.queueCount = 1;
+	VkDeviceQueueCreateInfo tqci{};
+	tqci.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	tqci.queueFamilyIndex = m_queue_family_transfer;
+	tqci.queueCount = 1;
 
 	const float prio[] {
 		1.0f
 	};
 	gqci.pQueuePriorities = prio;
 	cqci.pQueuePriorities = prio;
+	tqci.pQueuePriorities = prio;
 
-	m_gc_uniques[0] = m_queue_family_graphics;
-	m_gc_uniques[1] = m_queue_family_compute;
-	if (m_gc_uniques[0] == m_gc_uniques[1]) {
-		m_gc_sharing_mode = VK_SHARING_MODE_EXCLUSIVE;
-		m_gc_unique_count = 1;
-	} else {
-		m_gc_sharing_mode = VK_SHARING_MODE_CONCURRENT;
-		m_gc_unique_count = 2;
-	}
-
-	VkDeviceQueueCreateInfo qcis[2];
+	VkDeviceQueueCreateInfo qcis[3];
 	uint32_t qci_count = 0;
 	qcis[qci_count++] = gqci;
 	if (m_queue_family_graphics != m_queue_family_compute)
 		qcis[qci_count++] = cqci;
+	if (m_queue_family_transfer != m_queue_family_graphics)
+		qcis[qci_count++] = tqci;
 	ci.queueCreateInfoCount = qci_count;
 	ci.pQueueCreateInfos = qcis;
 	ci.pEnabledFeatures = &required_features;
 
-	const char* extensions[array_size(required_exts) + array_size(ray_tracing_exts)];
+	const char* extensions[array_size(required_exts) + 1 + array_size(ray_tracing_exts)];
 	uint32_t extension_count = 0;
 	for (size_t i = 0; i < array_size(required_exts); i++)
 		extensions[extension_count++] = required_exts[i];
+	if (ext.draw_indirect_count)
+		extensions[extension_count++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
 	if (ext.ray_tracing)
 		for (size_t i = 0; i < array_size(ray_tracing_exts); i++)
 			extensions[extension_count++] = ray_tracing_exts[i];
@@ -481,6 +514,13 @@ Vk::Device Renderer::createDevice(void)
 	EXT(vkGetSwapchainImagesKHR);
 	EXT(vkQueuePresentKHR);
 	EXT(vkAcquireNextImageKHR);
+	EXT(vkGetSemaphoreCounterValueKHR);
+	EXT(vkWaitSemaphoresKHR);
+
+	if (ext.draw_indirect_count) {
+		EXT(vkCmdDrawIndirectCountKHR);
+		EXT(vkCmdDrawIndexedIndirectCountKHR);
+	}
 
 	if (ext.ray_tracing) {
 		// VK_KHR_acceleration_structure
@@ -731,7 +771,13 @@ Vk::DescriptorSetLayout Renderer::createDescriptorSetLayoutDynamic(void)
 	VkDescriptorSetLayoutCreateInfo ci{};
 	ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	VkDescriptorSetLayoutBinding bindings[] {
-		{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr}
+		{0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr},	// instance dynamics
+		{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT, nullptr},	// visible instances
+		{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},	// draws
+		{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},	// cull visibility
+		{4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},	// depth pyramid
+		{5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr},	// cull instances
+		{6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr}	// materials
 	};
 	ci.bindingCount = array_size(bindings);
 	ci.pBindings = bindings;
@@ -748,14 +794,54 @@ Vk::PipelineLayout Renderer::createPipelineLayoutDescriptorSet(void)
 	};
 	ci.setLayoutCount = array_size(set_layouts);
 	ci.pSetLayouts = set_layouts;
-	VkPushConstantRange ranges[] {
-		{VK_SHADER_STAGE_FRAGMENT_BIT, 0, 16}
-	};
-	ci.pushConstantRangeCount = array_size(ranges);
-	ci.pPushConstantRanges = ranges;
 	return device.createPipelineLayout(ci);
 }
 
+Pipeline Renderer::createCullPipeline(void)
+{
+	Pipeline res;
+	VkComputePipelineCreateInfo ci{};
+	ci.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	auto shader = loadShaderModule(VK_SHADER_STAGE_COMPUTE_BIT, "sha/cull");
+	res.pushShaderModule(shader);
+	ci.stage = initPipelineStage(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+	{
+		VkPipelineLayoutCreateInfo ci{};
+		ci.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		VkDescriptorSetLayout set_layouts[] {
+			m_descriptor_set_layout_0,
+			m_descriptor_set_layout_dynamic
+		};
+		ci.setLayoutCount = array_size(set_layouts);
+		ci.pSetLayouts = set_layouts;
+		VkPushConstantRange ranges[] {
+			{VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Frame::CullPhase)}
+		};
+		ci.pushConstantRangeCount = array_size(ranges);
+		ci.pPushConstantRanges = ranges;
+		res.pipelineLayout = device.createPipelineLayout(ci);
+	}
+	ci.layout = res.pipelineLayout;
+	VkPipeline pip;
+	vkAssert(vkCreateComputePipelines(device, m_pipeline_cache, 1, &ci, nullptr, &pip));
+	res = pip;
+	return res;
+}
+
+// Starts with nothing visible, the first frame draws everything in its second phase
+Vk::BufferAllocation Renderer::createCullVisibility(void)
+{
+	VkBufferCreateInfo bci{};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = cull_visibility_max / 8;
+	bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	VmaAllocationCreateInfo aci{};
+	aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	auto res = allocator.createBuffer(bci, aci);
+	m_upload.dstCmd().fillBuffer(res, 0, VK_WHOLE_SIZE, 0);
+	return res;
+}
+
 Vk::BufferAllocation Renderer::createScreenVertexBuffer(void)
 {
 	Vertex::p2 vertices[] {
@@ -764,60 +850,35 @@ Vk::BufferAllocation Renderer::createScreenVertexBuffer(void)
 		{{-1.0f, 3.0f}}
 	};
 	auto res = createVertexBuffer(sizeof(vertices));
-	{
-		VkBufferCreateInfo bci{};
-		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bci.size = sizeof(vertices);
-		bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VmaAllocationCreateInfo aci{};
-		aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-		void *data;
-		auto s = allocator.createBuffer(bci, aci, &data);
-		std::memcpy(data, vertices, sizeof(vertices));
-		allocator.flushAllocation(s, 0, sizeof(vertices));
-
-		m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-		VkBufferCopy region;
-		region.srcOffset = 0;
-		region.dstOffset = 0;
-		region.size = sizeof(vertices);
-		m_transfer_cmd.copyBuffer(s, res, 1, &region);
-		m_transfer_cmd.end();
-
-		VkSubmitInfo submit{};
-		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit.commandBufferCount = 1;
-		submit.pCommandBuffers = m_transfer_cmd.ptr();
-		m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-		m_gqueue.waitIdle();
-
-		allocator.destroy(s);
-	}
+	loadBuffer(res, sizeof(vertices), vertices);
 	return res;
 }
 
-Vk::RenderPass Renderer::createOpaquePass(void)
+// load: draws over the content left by a previous opaque pass, framebuffers are compatible with both
+Vk::RenderPass Renderer::createOpaquePass(bool load)
 {
 	VkRenderPassCreateInfo ci{};
 	ci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 
+	auto load_op = load ? Vk::AttachmentLoadOp::Load : Vk::AttachmentLoadOp::Clear;
+	auto depth_layout = load ? Vk::ImageLayout::DepthStencilReadOnlyOptimal : Vk::ImageLayout::Undefined;
+	auto color_layout = load ? Vk::ImageLayout::ShaderReadOnlyOptimal : Vk::ImageLayout::Undefined;
 	VkAttachmentDescription atts[] {
-		{0, format_depth, m_sample_count, Vk::AttachmentLoadOp::Clear, Vk::AttachmentStoreOp::Store,	// depth 0
+		{0, format_depth, m_sample_count, load_op, Vk::AttachmentStoreOp::Store,	// depth 0
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
-			Vk::ImageLayout::Undefined, Vk::ImageLayout::DepthStencilReadOnlyOptimal},
-		{0, VK_FORMAT_R32_SFLOAT, m_sample_count, Vk::AttachmentLoadOp::Clear, Vk::AttachmentStoreOp::Store,	// cdepth 1
+			depth_layout, Vk::ImageLayout::DepthStencilReadOnlyOptimal},
+		{0, VK_FORMAT_R32_SFLOAT, m_sample_count, load_op, Vk::AttachmentStoreOp::Store,	// cdepth 1
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
-			Vk::ImageLayout::Undefined, Vk::ImageLayout::ShaderReadOnlyOptimal},
-		{0, VK_FORMAT_R8G8B8A8_SRGB, m_sample_count, Vk::AttachmentLoadOp::Clear, Vk::AttachmentStoreOp::Store,	// albedo 2
+			color_layout, Vk::ImageLayout::ShaderReadOnlyOptimal},
+		{0, VK_FORMAT_R8G8B8A8_SRGB, m_sample_count, load_op, Vk::AttachmentStoreOp::Store,	// albedo 2
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
-			Vk::ImageLayout::Undefined, Vk::ImageLayout::ShaderReadOnlyOptimal},
-		{0, VK_FORMAT_R16G16B16A16_SFLOAT, m_sample_count, Vk::AttachmentLoadOp::Clear, Vk::AttachmentStoreOp::Store,	// normal 3
+			color_layout, Vk::ImageLayout::ShaderReadOnlyOptimal},
+		{0, VK_FORMAT_R16G16B16A16_SFLOAT, m_sample_count, load_op, Vk::AttachmentStoreOp::Store,	// normal 3
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
-			Vk::ImageLayout::Undefined, Vk::ImageLayout::ShaderReadOnlyOptimal},
-		{0, VK_FORMAT_R16G16B16A16_SFLOAT, m_sample_count, Vk::AttachmentLoadOp::Clear, Vk::AttachmentStoreOp::Store,	// normal_geom 4
+			color_layout, Vk::ImageLayout::ShaderReadOnlyOptimal},
+		{0, VK_FORMAT_R16G16B16A16_SFLOAT, m_sample_count, load_op, Vk::AttachmentStoreOp::Store,	// normal_geom 4
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
-			Vk::ImageLayout::Undefined, Vk::ImageLayout::ShaderReadOnlyOptimal}
+			color_layout, Vk::ImageLayout::ShaderReadOnlyOptimal}
 	};
 	VkAttachmentReference depth {0, Vk::ImageLayout::DepthStencilAttachmentOptimal};
 	VkAttachmentReference cdepth {1, Vk::ImageLayout::ColorAttachmentOptimal};
@@ -840,10 +901,26 @@ Vk::RenderPass Renderer::createOpaquePass(void)
 			0, nullptr}		// preserve
 	};
 
+	// previous opaque pass wrote the attachments, the depth pyramid and the cull pass read them since
+	VkSubpassDependency dependencies[] {
+		{VK_SUBPASS_EXTERNAL, 0,
+			Vk::PipelineStage::ColorAttachmentOutputBit | Vk::PipelineStage::LateFragmentTestsBit |
+				Vk::PipelineStage::FragmentShaderBit | Vk::PipelineStage::ComputeShaderBit,
+			Vk::PipelineStage::ColorAttachmentOutputBit | Vk::PipelineStage::EarlyFragmentTestsBit | Vk::PipelineStage::LateFragmentTestsBit,
+			Vk::Access::ColorAttachmentWriteBit | Vk::Access::DepthStencilAttachmentWriteBit,
+			Vk::Access::ColorAttachmentReadBit | Vk::Access::ColorAttachmentWriteBit |
+				Vk::Access::DepthStencilAttachmentReadBit | Vk::Access::DepthStencilAttachmentWriteBit,
+			0}
+	};
+
 	ci.attachmentCount = array_size(atts);
 	ci.pAttachments = atts;
 	ci.subpassCount = array_size(subpasses);
 	ci.pSubpasses = subpasses;
+	if (load) {
+		ci.dependencyCount = array_size(dependencies);
+		ci.pDependencies = dependencies;
+	}
 
 	return device.createRenderPass(ci);
 }
@@ -1103,7 +1180,7 @@ Vk::RenderPass Renderer::createDepthResolvePass(void)
 	ci.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 
 	VkAttachmentDescription atts[] {
-		{0, VK_FORMAT_R32_SFLOAT, VK_SAMPLE_COUNT_1_BIT, Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::Store,	// depth 0
+		{0, format_depth_pyramid, VK_SAMPLE_COUNT_1_BIT, Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::Store,	// depth 0
 			Vk::AttachmentLoadOp::DontCare, Vk::AttachmentStoreOp::DontCare,
 			Vk::ImageLayout::Undefined, Vk::ImageLayout::ShaderReadOnlyOptimal}
 	};
@@ -1860,21 +1937,20 @@ Vk::DescriptorPool Renderer::createDescriptorPool(void)
 	VkDescriptorPoolCreateInfo ci{};
 	ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	uint32_t sets_per_frame = const_sets_per_frame +
-		(m_illum_technique == IllumTechnique::Sspt ?
-		1 +	// depth_resolve
-			(m_sample_count > VK_SAMPLE_COUNT_1_BIT ?
-				1	// color_resolved
-				: 0)
+		(m_illum_technique == IllumTechnique::Sspt && m_sample_count > VK_SAMPLE_COUNT_1_BIT ?
+		1	// color_resolved
 		: 0) +
 		(needsAccStructure() ?
 		1	// rt res set
 		: 0);
 	ci.maxSets = m_frame_count * sets_per_frame;
 	VkDescriptorPoolSize pool_sizes[] {
-		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, m_frame_count},
+		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, m_frame_count * 2},	// instances, cull
 		{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, m_frame_count * 2},	// illum
 		{VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_frame_count * (
 			s0_sampler_count +	// s0
+			1 +	// depth_resolve
+			1 +	// cull depth pyramid
 			m_illum_technique_props.descriptorCombinedImageSamplerCount +			// illumination
 			(needsAccStructure() ? s0_sampler_count : 0) +	// rt res
 			1			// wsi
@@ -1896,6 +1972,7 @@ Vk::DescriptorPool Renderer::createDescriptorPool(void)
 				0)
 		)},
 		{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_frame_count * (
+			4 +	// visible instances, draws, cull visibility, materials
 			(needsAccStructure() ?
 				1 +	// instances
 				modelPoolSize * 4 +	// models
@@ -1944,11 +2021,8 @@ vector<Renderer::Frame> Renderer::createFrames(void)
 	device.allocateCommandBuffers(m_ccommand_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, m_frame_count * ccmds_per_frame, ccmds);
 
 	uint32_t sets_per_frame = const_sets_per_frame +
-		(m_illum_technique == IllumTechnique::Sspt ?
-		1 +	// depth_resolve
-			(m_sample_count > VK_SAMPLE_COUNT_1_BIT ?
-				1	// color_resolved
-				: 0)
+		(m_illum_technique == IllumTechnique::Sspt && m_sample_count > VK_SAMPLE_COUNT_1_BIT ?
+		1	// color_resolved
 		: 0) + (needsAccStructure() ?
 		1	// res
 		: 0);
@@ -1960,45 +2034,62 @@ vector<Renderer::Frame> Renderer::createFrames(void)
 		set_layouts[i * sets_per_frame + set_offset++] = m_descriptor_set_layout_dynamic;
 		set_layouts[i * sets_per_frame + set_offset++] = m_illumination_set_layout;
 		set_layouts[i * sets_per_frame + set_offset++] = m_wsi_set_layout;
-		if (m_illum_technique == IllumTechnique::Sspt) {
-			set_layouts[i * sets_per_frame + set_offset++] = m_depth_resolve_set_layout;
-			if (m_sample_count > VK_SAMPLE_COUNT_1_BIT)
-				set_layouts[i * sets_per_frame + set_offset++] = m_color_resolve_set_layout;
-		}
+		set_layouts[i * sets_per_frame + set_offset++] = m_depth_resolve_set_layout;
+		if (m_illum_technique == IllumTechnique::Sspt && m_sample_count > VK_SAMPLE_COUNT_1_BIT)
+			set_layouts[i * sets_per_frame + set_offset++] = m_color_resolve_set_layout;
 		if (needsAccStructure())
 			set_layouts[i * sets_per_frame + set_offset++] = m_illum_rt.m_res_set_layout;
 	}
 	device.allocateDescriptorSets(m_descriptor_pool, m_frame_count * sets_per_frame, set_layouts, sets);
 
 	Vk::BufferAllocation dyn_buffers[m_frame_count];
+	for (uint32_t i = 0; i < m_frame_count; i++) {
+		void *mapped;
+		dyn_buffers[i] = createDynBuffer(Frame::dyn_buffer_size, &mapped);
+	}
+	Vk::BufferAllocation cull_buffers[m_frame_count];
+	for (uint32_t i = 0; i < m_frame_count; i++)
+		cull_buffers[i] = createCullBuffer(Frame::cullBufferSize(Frame::cull_draw_capacity_min, Frame::cull_instance_capacity_min));
+	Vk::BufferAllocation material_buffers[m_frame_count];
 	for (uint32_t i = 0; i < m_frame_count; i++) {
 		VkBufferCreateInfo bci{};
 		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bci.size = Frame::dyn_buffer_size;
+		bci.size = materialPoolSize * sizeof(Material);
 		bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
 		VmaAllocationCreateInfo aci{};
 		aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
-		dyn_buffers[i] = allocator.createBuffer(bci, aci);
+		material_buffers[i] = allocator.createBuffer(bci, aci);
 	}
 
-	VkWriteDescriptorSet desc_writes[m_frame_count];
-	VkDescriptorBufferInfo bi[m_frame_count];
+	static constexpr uint32_t writes_per_frame = 5;
+	VkWriteDescriptorSet desc_writes[m_frame_count * writes_per_frame];
+	VkDescriptorBufferInfo bi[m_frame_count * writes_per_frame];
 	for (uint32_t i = 0; i < m_frame_count; i++) {
-		VkWriteDescriptorSet cur{};
-		cur.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		cur.dstSet = sets[i * sets_per_frame + 1];
-		cur.dstBinding = 0;
-		cur.dstArrayElement = 0;
-		cur.descriptorCount = 1;
-		cur.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
-		auto &cbi = bi[i];
-		cbi.buffer = dyn_buffers[i];
-		cbi.offset = 0;
-		cbi.range = VK_WHOLE_SIZE;
-		cur.pBufferInfo = &cbi;
-		desc_writes[i] = cur;
+		// instance dynamics are bound on the first upload of the frame
+		struct { uint32_t binding; VkDescriptorType type; VkBuffer buffer; VkDeviceSize offset; VkDeviceSize range; } bindings[writes_per_frame] {
+			{5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, dyn_buffers[i], 0, VK_WHOLE_SIZE},
+			{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cull_buffers[i], Frame::cullDrawsSize(Frame::cull_draw_capacity_min), VK_WHOLE_SIZE},
+			{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, cull_buffers[i], 0, Frame::cullDrawsSize(Frame::cull_draw_capacity_min)},
+			{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_cull_visibility, 0, VK_WHOLE_SIZE},
+			{6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, material_buffers[i], 0, VK_WHOLE_SIZE}
+		};
+		for (uint32_t j = 0; j < writes_per_frame; j++) {
+			VkWriteDescriptorSet cur{};
+			cur.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			cur.dstSet = sets[i * sets_per_frame + 1];
+			cur.dstBinding = bindings[j].binding;
+			cur.dstArrayElement = 0;
+			cur.descriptorCount = 1;
+			cur.descriptorType = bindings[j].type;
+			auto &cbi = bi[i * writes_per_frame + j];
+			cbi.buffer = bindings[j].buffer;
+			cbi.offset = bindings[j].offset;
+			cbi.range = bindings[j].range;
+			cur.pBufferInfo = &cbi;
+			desc_writes[i * writes_per_frame + j] = cur;
+		}
 	}
-	device.updateDescriptorSets(m_frame_count, desc_writes, 0, nullptr);
+	device.updateDescriptorSets(m_frame_count * writes_per_frame, desc_writes, 0, nullptr);
 
 	size_t sets_mip_stride = (m_swapchain_mip_levels - 1) * sets_per_frame_mip;
 	size_t sets_mip_size = m_frame_count * sets_mip_stride;
@@ -2015,11 +2106,13 @@ vector<Renderer::Frame> Renderer::createFrames(void)
 			ccmds[i * ccmds_per_frame], ccmds[i * ccmds_per_frame + 1],
 			sets[i * sets_per_frame], sets[i * sets_per_frame + 1],
 			m_illum_technique == IllumTechnique::Sspt && m_sample_count > VK_SAMPLE_COUNT_1_BIT ? sets[i * sets_per_frame + 5] : VK_NULL_HANDLE,
-			m_illum_technique == IllumTechnique::Sspt ? sets[i * sets_per_frame + 4] : VK_NULL_HANDLE,
-			sets[i * sets_per_frame + 2], needsAccStructure() ? sets[i * sets_per_frame + 4] : VK_NULL_HANDLE,
+			sets[i * sets_per_frame + 4],
+			sets[i * sets_per_frame + 2], needsAccStructure() ? sets[i * sets_per_frame + 5] : VK_NULL_HANDLE,
 			sets[i * sets_per_frame + 3],
 			&sets_mip[i * sets_mip_stride],
-			dyn_buffers[i]);
+			dyn_buffers[i], Frame::dyn_buffer_size,
+			cull_buffers[i], Frame::cull_draw_capacity_min, Frame::cull_instance_capacity_min,
+			material_buffers[i]);
 	return res;
 }
 
@@ -2116,13 +2209,6 @@ void Pipeline::destroy(Vk::Device device)
 		device.destroy(shaderModules[i]);
 }
 
-void Model::destroy(Vk::Allocator allocator)
-{
-	allocator.destroy(vertexBuffer);
-	if (indexType != VK_INDEX_TYPE_NONE_KHR)
-		allocator.destroy(indexBuffer);
-}
-
 /*Pipeline Renderer::createPipeline(const char *stagesPath, uint32_t pushConstantRange)
 {
 	Pipeline res;
@@ -2222,7 +2308,7 @@ void Model::destroy(Vk::Allocator allocator)
 	return res;
 }*/
 
-Pipeline Renderer::createPipeline3D_pn(const char *stagesPath, uint32_t pushConstantRange)
+Pipeline Renderer::createPipeline3D_pn(const char *stagesPath)
 {
 	Pipeline res;
 
@@ -2322,7 +2408,6 @@ Pipeline Renderer::createPipeline3D_pn(const char *stagesPath, uint32_t pushCons
 	ci.pDynamicState = &dynamic;
 
 	res.pipelineLayout = VK_NULL_HANDLE;
-	res.pushConstantRange = pushConstantRange;
 	ci.layout = m_pipeline_layout_descriptor_set;
 	ci.renderPass = m_opaque_pass;
 
@@ -2330,7 +2415,7 @@ Pipeline Renderer::createPipeline3D_pn(const char *stagesPath, uint32_t pushCons
 	return res;
 }
 
-Pipeline Renderer::createPipeline3D_pnu(const char *stagesPath, uint32_t pushConstantRange)
+Pipeline Renderer::createPipeline3D_pnu(const char *stagesPath)
 {
 	Pipeline res;
 
@@ -2430,7 +2515,6 @@ Pipeline Renderer::createPipeline3D_pnu(const char *stagesPath, uint32_t pushCon
 	ci.pDynamicState = &dynamic;
 
 	res.pipelineLayout = VK_NULL_HANDLE;
-	res.pushConstantRange = pushConstantRange;
 	ci.layout = m_pipeline_layout_descriptor_set;
 	ci.renderPass = m_opaque_pass;
 
@@ -2438,7 +2522,7 @@ Pipeline Renderer::createPipeline3D_pnu(const char *stagesPath, uint32_t pushCon
 	return res;
 }
 
-Pipeline Renderer::createPipeline3D_pntbu(const char *stagesPath, uint32_t pushConstantRange)
+Pipeline Renderer::createPipeline3D_pntbu(const char *stagesPath)
 {
 	Pipeline res;
 
@@ -2540,7 +2624,6 @@ Pipeline Renderer::createPipeline3D_pntbu(const char *stagesPath, uint32_t pushC
 	ci.pDynamicState = &dynamic;
 
 	res.pipelineLayout = VK_NULL_HANDLE;
-	res.pushConstantRange = pushConstantRange;
 	ci.layout = m_pipeline_layout_descriptor_set;
 	ci.renderPass = m_opaque_pass;
 
@@ -2576,6 +2659,27 @@ uint32_t Renderer::allocateMaterial(void)
 	return res;
 }
 
+// Loaded buffers are concurrent between the transfer family writing them and the families reading them, they need no ownership transfer
+void Renderer::loadSharing(VkBufferCreateInfo &bci)
+{
+	m_load_unique_count = 0;
+	auto add = [&](uint32_t family){
+		for (uint32_t i = 0; i < m_load_unique_count; i++)
+			if (m_load_uniques[i] == family)
+				return;
+		m_load_uniques[m_load_unique_count++] = family;
+	};
+	add(m_queue_family_graphics);
+	if (needsAccStructure())
+		add(m_queue_family_compute);
+	add(m_queue_family_transfer);
+	if (m_load_unique_count > 1) {
+		bci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bci.queueFamilyIndexCount = m_load_unique_count;
+		bci.pQueueFamilyIndices = m_load_uniques;
+	}
+}
+
 Vk::BufferAllocation Renderer::createVertexBuffer(size_t size)
 {
 	VkBufferCreateInfo bci{};
@@ -2584,11 +2688,7 @@ Vk::BufferAllocation Renderer::createVertexBuffer(size_t size)
 	bci.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
 		(needsAccStructure() ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0);
-	if (needsAccStructure()) {
-		bci.sharingMode = m_gc_sharing_mode;
-		bci.queueFamilyIndexCount = m_gc_unique_count;
-		bci.pQueueFamilyIndices = m_gc_uniques;
-	}
+	loadSharing(bci);
 	VmaAllocationCreateInfo aci{};
 	aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 	return allocator.createBuffer(bci, aci);
@@ -2602,181 +2702,139 @@ Vk::BufferAllocation Renderer::createIndexBuffer(size_t size)
 	bci.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT |
 		(needsAccStructure() ? VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR |
 		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0);
-	if (needsAccStructure()) {
-		bci.sharingMode = m_gc_sharing_mode;
-		bci.queueFamilyIndexCount = m_gc_unique_count;
-		bci.pQueueFamilyIndices = m_gc_uniques;
-	}
+	loadSharing(bci);
 	VmaAllocationCreateInfo aci{};
 	aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
 	return allocator.createBuffer(bci, aci);
 }
 
-void Renderer::loadBuffer(VkBuffer buffer, size_t size, const void *data)
+// Ray tracing binds vertex ranges as storage buffers at their offset, in elements of the model array
+size_t Renderer::geometryAlign(GeometryFormat format)
 {
-	VkBufferCreateInfo bci{};
-	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bci.size = size;
-	bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	VmaAllocationCreateInfo aci{};
-	aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-	aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-	void *mdata;
-	auto s = allocator.createBuffer(bci, aci, &mdata);
-	std::memcpy(mdata, data, size);
-	allocator.flushAllocation(s, 0, size);
-
-	m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	VkBufferCopy region;
-	region.srcOffset = 0;
-	region.dstOffset = 0;
-	region.size = size;
-	m_transfer_cmd.copyBuffer(s, buffer, 1, &region);
-	m_transfer_cmd.end();
-
-	VkSubmitInfo submit{};
-	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = m_transfer_cmd.ptr();
-	m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-	m_gqueue.waitIdle();
-
-	allocator.destroy(s);
+	static constexpr size_t strides[] {
+		sizeof(Vertex::pn),
+		sizeof(Vertex::pnu),
+		sizeof(Vertex::pntbu),
+		sizeof(uint32_t)
+	};
+	auto stride = strides[static_cast<size_t>(format)];
+	if (needsAccStructure())
+		return std::lcm(stride, static_cast<size_t>(m_limits.minStorageBufferOffsetAlignment));
+	return stride;
+}
+
+GeometryRange Renderer::allocateGeometry(GeometryFormat format, size_t size)
+{
+	auto &blocks = m_geometry_blocks[static_cast<size_t>(format)];
+	auto align = geometryAlign(format);
+	GeometryRange res;
+	res.format = format;
+	res.size = size;
+	for (size_t i = 0; i < blocks.size(); i++) {
+		auto off = blocks[i].arena.alloc(size, align);
+		if (off != Arena::npos) {
+			res.buffer = blocks[i].buffer;
+			res.block = static_cast<uint32_t>(i);
+			res.offset = off;
+			return res;
+		}
+	}
+	size_t capacity = max(size, geometry_block_size);
+	auto &b = blocks.emplace();
+	b.buffer = format == GeometryFormat::Index ? createIndexBuffer(capacity) : createVertexBuffer(capacity);
+	b.arena = Arena(capacity);
+	res.buffer = b.buffer;
+	res.block = static_cast<uint32_t>(blocks.size() - 1);
+	res.offset = b.arena.alloc(size, align);
+	return res;
 }
 
-void Renderer::loadBufferCompute(VkBuffer buffer, size_t size, const void *data, size_t offset)
+void Renderer::freeGeometry(const GeometryRange &range)
 {
-	VkBufferCreateInfo bci{};
-	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bci.size = size;
-	bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	VmaAllocationCreateInfo aci{};
-	aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-	aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-	void *mdata;
-	auto s = allocator.createBuffer(bci, aci, &mdata);
-	std::memcpy(mdata, data, size);
-	allocator.flushAllocation(s, 0, size);
-
-	m_ctransfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-	VkBufferCopy region;
-	region.srcOffset = 0;
-	region.dstOffset = offset;
-	region.size = size;
-	m_ctransfer_cmd.copyBuffer(s, buffer, 1, &region);
-	m_ctransfer_cmd.end();
-
-	VkSubmitInfo submit{};
-	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = m_ctransfer_cmd.ptr();
-	m_cqueue.submit(1, &submit, VK_NULL_HANDLE);
-	m_cqueue.waitIdle();
+	m_geometry_blocks[static_cast<size_t>(range.format)][range.block].arena.free(range.offset, range.size);
+}
 
-	allocator.destroy(s);
+void Renderer::destroy(Model &model)
+{
+	freeGeometry(model.vertices);
+	if (model.indexType != VK_INDEX_TYPE_NONE_KHR)
+		freeGeometry(model.indices);
 }
 
+UploadQueue::Ticket Renderer::loadBuffer(VkBuffer buffer, size_t size, const void *data, size_t offset)
+{
+	return m_upload.buffer(buffer, size, data, offset);
+}
 
-Model Renderer::loadModel(const char *path, AccelerationStructure *acc)
+void Renderer::loadBufferCompute(VkBuffer buffer, size_t size, const void *data, size_t offset)
 {
-	std::ifstream file(path);
-	if (!file.good())
-		throw std::runtime_error(path);
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn;
-	std::string err;
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &file)) {
-		if (err.size() > 0)
-			std::cerr << "ERROR: " << path << ": " << err << std::endl;
-		throw std::runtime_error(path);
+	m_cupload.buffer(buffer, size, data, offset);
+}
+
+// Validates one face, throws when it is not a triangle or indexes past the attributes, returns the index of the next face
+static size_t checkFace(const std::string &path, const tinyobj::attrib_t &attrib, const tinyobj::mesh_t &mesh, size_t face, size_t index)
+{
+	size_t vert_count = mesh.num_face_vertices[face];
+	if (vert_count > 3)
+		throw std::runtime_error(path + ": faces must be triangles");
+	if (index + vert_count > mesh.indices.size())
+		throw std::runtime_error(path + ": face past the indices");
+	for (size_t i = 0; i < vert_count; i++) {
+		auto &indices = mesh.indices[index + i];
+		if (indices.vertex_index >= 0 && static_cast<size_t>(indices.vertex_index) * 3 + 3 > attrib.vertices.size())
+			throw std::runtime_error(path + ": vertex index out of range");
+		if (indices.normal_index >= 0 && static_cast<size_t>(indices.normal_index) * 3 + 3 > attrib.normals.size())
+			throw std::runtime_error(path + ": normal index out of range");
+		if (indices.texcoord_index >= 0 && static_cast<size_t>(indices.texcoord_index) * 2 + 2 > attrib.texcoords.size())
+			throw std::runtime_error(path + ": texcoord index out of range");
 	}
-	//if (warn.size() > 0)
-	//	std::cout << "WARNING: " << path << ": " << warn << std::endl;
-	if (err.size() > 0)
-		std::cerr << "ERROR: " << path << ": " << err << std::endl;
-	std::vector<Vertex::pnu> vertices;
-	for (auto &shape : shapes) {
-		size_t ndx = 0;
-		for (auto &vert_count : shape.mesh.num_face_vertices) {
-			std::vector<glm::vec3> pos;
-			std::vector<glm::vec3> normal;
-			std::vector<glm::vec2> uv;
-			for (size_t i = 0; i < vert_count; i++) {
-				auto indices = shape.mesh.indices.at(ndx++);
-				if (indices.vertex_index >= 0)
-					pos.emplace_back(attrib.vertices.at(indices.vertex_index * 3), attrib.vertices.at(indices.vertex_index * 3 + 1), attrib.vertices.at(indices.vertex_index * 3 + 2));
-				if (indices.normal_index >= 0)
-					normal.emplace_back(attrib.normals.at(indices.normal_index * 3), attrib.normals.at(indices.normal_index * 3 + 1), attrib.normals.at(indices.normal_index * 3 + 2));
-				if (indices.texcoord_index >= 0)
-					uv.emplace_back(attrib.texcoords.at(indices.texcoord_index * 2), attrib.texcoords.at(indices.texcoord_index * 2 + 1));
-			}
+	return index + vert_count;
+}
+
+// Vertices of the faces [begin, end) of a shape, index is the first index of face begin, out receives 3 vertices per face
+// Faces must have passed checkFace, workers build them without bounds checks
+static void buildFaces(const tinyobj::attrib_t &attrib, const tinyobj::shape_t &shape, size_t begin, size_t end, size_t index, Vertex::pnu *out)
+{
+	for (size_t f = begin; f < end; f++) {
+		size_t vert_count = shape.mesh.num_face_vertices[f];
+		glm::vec3 pos[3];
+		glm::vec3 normal[3];
+		glm::vec2 uv[3];
+		size_t pos_count = 0;
+		size_t normal_count = 0;
+		size_t uv_count = 0;
+		for (size_t i = 0; i < vert_count; i++) {
+			auto &indices = shape.mesh.indices[index++];
+			if (indices.vertex_index >= 0)
+				pos[pos_count++] = glm::vec3(attrib.vertices[indices.vertex_index * 3], attrib.vertices[indices.vertex_index * 3 + 1], attrib.vertices[indices.vertex_index * 3 + 2]);
+			if (indices.normal_index >= 0)
+				normal[normal_count++] = glm::vec3(attrib.normals[indices.normal_index * 3], attrib.normals[indices.normal_index * 3 + 1], attrib.normals[indices.normal_index * 3 + 2]);
+			if (indices.texcoord_index >= 0)
+				uv[uv_count++] = glm::vec2(attrib.texcoords[indices.texcoord_index * 2], attrib.texcoords[indices.texcoord_index * 2 + 1]);
+		}
 
-			while (pos.size() < 3)
-				pos.emplace_back(0.0);
+		while (pos_count < 3)
+			pos[pos_count++] = glm::vec3(0.0);
 
-			if (normal.size() != 3) {
-				normal.clear();
-				glm::vec3 comp_normal = glm::normalize(glm::cross(pos.at(1) - pos.at(0), pos.at(2) - pos.at(0)));
-				for (size_t i = 0; i < 3; i++)
-					normal.emplace_back(comp_normal);
-			}
+		if (normal_count != 3) {
+			glm::vec3 comp_normal = glm::normalize(glm::cross(pos[1] - pos[0], pos[2] - pos[0]));
+			for (size_t i = 0; i < 3; i++)
+				normal[i] = comp_normal;
+		}
 
-			while (uv.size() < 3)
-				uv.emplace_back(0.0);
+		while (uv_count < 3)
+			uv[uv_count++] = glm::vec2(0.0);
 
-			for (size_t i = 0; i < pos.size(); i++) {
-				decltype(vertices)::value_type vertex;
-				vertex.p = pos.at(i);
-				vertex.n = normal.at(i);
-				vertex.u = uv.at(i);
-				vertices.emplace_back(vertex);
-			}
+		for (size_t i = 0; i < 3; i++) {
+			out->p = pos[i];
+			out->n = normal[i];
+			out->u = uv[i];
+			out++;
 		}
 	}
-	Model res;
-	res.primitiveCount = vertices.size();
-	size_t buf_size = vertices.size() * sizeof(decltype(vertices)::value_type);
-	res.vertexBuffer = createVertexBuffer(buf_size);
-	res.indexType = VK_INDEX_TYPE_NONE_KHR;
-	{
-		VkBufferCreateInfo bci{};
-		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bci.size = buf_size;
-		bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VmaAllocationCreateInfo aci{};
-		aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-		void *data;
-		auto s = allocator.createBuffer(bci, aci, &data);
-		std::memcpy(data, vertices.data(), buf_size);
-		allocator.flushAllocation(s, 0, buf_size);
-
-		m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-		VkBufferCopy region;
-		region.srcOffset = 0;
-		region.dstOffset = 0;
-		region.size = buf_size;
-		m_transfer_cmd.copyBuffer(s, res.vertexBuffer, 1, &region);
-		m_transfer_cmd.end();
-
-		VkSubmitInfo submit{};
-		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit.commandBufferCount = 1;
-		submit.pCommandBuffers = m_transfer_cmd.ptr();
-		m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-		m_gqueue.waitIdle();
-
-		if (acc)
-			*acc = createBottomAccelerationStructure(vertices.size(), sizeof(decltype(vertices)::value_type), res.vertexBuffer, VK_INDEX_TYPE_NONE_KHR, 0, nullptr, 0);
-
-		allocator.destroy(s);
-	}
-	return res;
 }
 
-Model Renderer::loadModelTb(const char *path, AccelerationStructure *acc)
+static std::vector<Vertex::pnu> loadObjVertices(const char *path)
 {
 	std::ifstream file(path);
 	if (!file.good())
@@ -2795,112 +2853,101 @@ Model Renderer::loadModelTb(const char *path, AccelerationStructure *acc)
 	//	std::cout << "WARNING: " << path << ": " << warn << std::endl;
 	if (err.size() > 0)
 		std::cerr << "ERROR: " << path << ": " << err << std::endl;
-	std::vector<Vertex::pntbu> vertices;
+	std::vector<Vertex::pnu> res;
 	for (auto &shape : shapes) {
-		size_t ndx = 0;
-		for (auto &vert_count : shape.mesh.num_face_vertices) {
-			std::vector<glm::vec3> pos;
-			std::vector<glm::vec3> normal;
-			std::vector<glm::vec2> uv;
-			for (size_t i = 0; i < vert_count; i++) {
-				auto indices = shape.mesh.indices.at(ndx++);
-				if (indices.vertex_index >= 0)
-					pos.emplace_back(attrib.vertices.at(indices.vertex_index * 3), attrib.vertices.at(indices.vertex_index * 3 + 1), attrib.vertices.at(indices.vertex_index * 3 + 2));
-				if (indices.normal_index >= 0)
-					normal.emplace_back(attrib.normals.at(indices.normal_index * 3), attrib.normals.at(indices.normal_index * 3 + 1), attrib.normals.at(indices.normal_index * 3 + 2));
-				if (indices.texcoord_index >= 0)
-					uv.emplace_back(attrib.texcoords.at(indices.texcoord_index * 2), attrib.texcoords.at(indices.texcoord_index * 2 + 1));
-			}
+		size_t first = res.size();
+		size_t face_count = shape.mesh.num_face_vertices.size();
+		for (size_t f = 0, index = 0; f < face_count; f++)
+			index = checkFace(path, attrib, shape.mesh, f, index);
+		res.resize(first + face_count * 3);
+		buildFaces(attrib, shape, 0, face_count, 0, res.data() + first);
+	}
+	return res;
+}
 
-			while (pos.size() < 3)
-				pos.emplace_back(0.0);
+// One tangent frame per triangle, from its positions and uvs
+static void genTangents(const Vertex::pnu *vertices, Vertex::pntbu *res, size_t count)
+{
+	size_t t_c = count / 3;
+	for (size_t i = 0; i < t_c; i++) {
+		auto &v0 = vertices[i * 3];
+		auto &v1 = vertices[i * 3 + 1];
+		auto &v2 = vertices[i * 3 + 2];
 
-			if (normal.size() != 3) {
-				normal.clear();
-				glm::vec3 comp_normal = glm::normalize(glm::cross(pos.at(1) - pos.at(0), pos.at(2) - pos.at(0)));
-				for (size_t i = 0; i < 3; i++)
-					normal.emplace_back(comp_normal);
-			}
+		auto dpos1 = v1.p - v0.p;
+		auto dpos2 = v2.p - v0.p;
 
-			while (uv.size() < 3)
-				uv.emplace_back(0.0);
+		auto duv1 = v1.u - v0.u;
+		auto duv2 = v2.u - v0.u;
 
-			for (size_t i = 0; i < pos.size(); i++) {
-				decltype(vertices)::value_type vertex;
-				vertex.p = pos.at(i);
-				vertex.n = normal.at(i);
-				vertex.u = uv.at(i);
-				vertices.emplace_back(vertex);
-			}
+		float r = duv1.x * duv2.y - duv1.y * duv2.x;
+		auto t = (dpos1 * duv2.y - dpos2 * duv1.y) / r;
+		auto b = (dpos2 * duv1.x - dpos1 * duv2.x) / r;
+
+		for (size_t j = 0; j < 3; j++) {
+			auto &v = vertices[i * 3 + j];
+			auto &vt = res[i * 3 + j];
+			vt.p = v.p;
+			vt.n = v.n;
+			vt.t = t;
+			vt.b = b;
+			vt.u = v.u;
 		}
 	}
-	{
-		size_t t_c = vertices.size() / 3;
-		for (size_t i = 0; i < t_c; i++) {
-			auto &v0 = vertices[i * 3];
-			auto &v1 = vertices[i * 3 + 1];
-			auto &v2 = vertices[i * 3 + 2];
-
-			auto dpos1 = v1.p - v0.p;
-			auto dpos2 = v2.p - v0.p;
-
-			auto duv1 = v1.u - v0.u;
-			auto duv2 = v2.u - v0.u;
+}
 
-			float r = duv1.x * duv2.y - duv1.y * duv2.x;
-			auto t = (dpos1 * duv2.y - dpos2 * duv1.y) / r;
-			auto b = (dpos2 * duv1.x - dpos1 * duv2.x) / r;
+static std::vector<Vertex::pntbu> genTangents(const std::vector<Vertex::pnu> &vertices)
+{
+	std::vector<Vertex::pntbu> res(vertices.size());
+	genTangents(vertices.data(), res.data(), vertices.size());
+	return res;
+}
 
-			for (size_t j = 0; j < 3; j++) {
-				vertices[i * 3 + j].t = t;
-				vertices[i * 3 + j].b = b;
-			}
-		}
-	}
+// Geometry of a cached range, its vertices go from the cache straight into the upload ring
+Model Renderer::loadMeshRange(const MeshCache &cache, const MeshCache::Range &range, AccelerationStructure *acc)
+{
 	Model res;
-	res.primitiveCount = vertices.size();
-	size_t buf_size = vertices.size() * sizeof(decltype(vertices)::value_type);
-	res.vertexBuffer = createVertexBuffer(buf_size);
+	res.primitiveCount = range.vertex_count;
+	res.aabb = range.aabb;
+	res.sphere = res.aabb.sphere();
+	size_t buf_size = static_cast<size_t>(range.vertex_count) * range.stride;
+	res.vertices = allocateGeometry(range.format, buf_size);
+	res.firstVertex = static_cast<uint32_t>(res.vertices.offset / range.stride);
 	res.indexType = VK_INDEX_TYPE_NONE_KHR;
-	{
-		VkBufferCreateInfo bci{};
-		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bci.size = buf_size;
-		bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VmaAllocationCreateInfo aci{};
-		aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-		void *data;
-		auto s = allocator.createBuffer(bci, aci, &data);
-		std::memcpy(data, vertices.data(), buf_size);
-		allocator.flushAllocation(s, 0, buf_size);
-
-		m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-		VkBufferCopy region;
-		region.srcOffset = 0;
-		region.dstOffset = 0;
-		region.size = buf_size;
-		m_transfer_cmd.copyBuffer(s, res.vertexBuffer, 1, &region);
-		m_transfer_cmd.end();
-
-		VkSubmitInfo submit{};
-		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit.commandBufferCount = 1;
-		submit.pCommandBuffers = m_transfer_cmd.ptr();
-		m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-		m_gqueue.waitIdle();
-
-		if (acc)
-			*acc = createBottomAccelerationStructure(vertices.size(), sizeof(decltype(vertices)::value_type), res.vertexBuffer, VK_INDEX_TYPE_NONE_KHR, 0, nullptr, 0);
-
-		allocator.destroy(s);
-	}
+	res.ticket = loadBuffer(res.vertices.buffer, buf_size, cache.vertices(range), res.vertices.offset);
+	if (acc)
+		*acc = createBottomAccelerationStructure(range.vertex_count, range.stride, res.vertices.buffer, res.vertices.offset, VK_INDEX_TYPE_NONE_KHR, 0, nullptr, 0);
 	return res;
 }
 
-void Renderer::instanciateModel(Map &map, const char *path, const char *filename)
+Model Renderer::loadModel(const char *path, AccelerationStructure *acc)
 {
-	std::string inputfile = std::string(path) + filename;
+	MeshCache cache(path);
+	if (!cache.map()) {
+		auto vertices = loadObjVertices(path);
+		cache.add(GeometryFormat::Pnu, -1, vertices.data(), vertices.size(), sizeof(Vertex::pnu));
+		cache.write();
+	}
+	return loadMeshRange(cache, cache.range(0), acc);
+}
+
+Model Renderer::loadModelTb(const char *path, AccelerationStructure *acc)
+{
+	MeshCache cache(path, ".tb");
+	if (!cache.map()) {
+		auto vertices = genTangents(loadObjVertices(path));
+		cache.add(GeometryFormat::Pntbu, -1, vertices.data(), vertices.size(), sizeof(Vertex::pntbu));
+		cache.write();
+	}
+	return loadMeshRange(cache, cache.range(0), acc);
+}
+
+// Vertices are split in runs of one material, runs of a material with a height map get tangents
+// Runs are cut in pieces of whole faces that workers build in place, then each run is added to the cache
+static void parseObjRanges(MeshCache &cache, ThreadPool &pool, const char *path, const std::string &inputfile)
+{
+	static constexpr size_t piece_faces = 4096;
+
 	tinyobj::ObjReaderConfig reader_config;
 	reader_config.mtl_search_path = path; // Path to material files
 
@@ -2922,244 +2969,102 @@ void Renderer::instanciateModel(Map &map, const char *path, const char *filename
 	auto& materials = reader.GetMaterials();
 
 	bool materials_height[materials.size()];
-
-	size_t mat_off = m_material_pool.currentIndex();
-	{
-		Material_albedo mats[materials.size()];
-		for (size_t i = 0; i < materials.size(); i++) {
-			auto &m = materials[i];
-			auto mat = m_material_pool.allocate();
-			auto p = std::string(path) + m.diffuse_texname;
-			size_t andx = 0;
-			materials_height[i] = false;
-			if (m.diffuse_texname.size() > 0) {
-				andx = allocateImage(loadImage(p.c_str()));
-				//std::cout << "#: " << i << ", DIFFUSE FOR MAT: " << p << std::endl;
-			} else {
-				std::cout << "# " << i << ", WARN: MISSING DIFFUSE FOR MAT: " << m.name << std::endl;
-			}
-
-			if (m.displacement_texname.size() > 0) {
-				auto p = std::string(path) + m.displacement_texname;
-				allocateImage(loadHeightGenNormal(p.c_str()), true, VK_FORMAT_R8G8B8A8_UNORM);
-				materials_height[i] = true;
-				//std::cout << "height (disp) found" << std::endl;
-			} else if (m.bump_texname.size() > 0) {
-				auto p = std::string(path) + m.bump_texname;
-				allocateImage(loadHeightGenNormal(p.c_str()), true, VK_FORMAT_R8G8B8A8_UNORM);
-				materials_height[i] = true;
-				//std::cout << "height (bump) found" << std::endl;
-			}
-			//if (i == 16)
-			//	andx = 0;
-			reinterpret_cast<Material_albedo&>(*mat).albedo = andx;
-			mats[i].albedo = andx;
-		}
-		/*for (size_t i = 0; i < materials.size(); i++) {
-			std::cout << "#: " << i << ", " << reinterpret_cast<Material_albedo&>(m_material_pool.data[mat_off + i]).albedo << std::endl;
-		}*/
-		bindMaterials_albedo(mat_off, materials.size(), mats);
+	for (size_t i = 0; i < materials.size(); i++) {
+		auto &m = materials[i];
+		auto &height = m.displacement_texname.size() > 0 ? m.displacement_texname : m.bump_texname;
+		cache.addMaterial(m.name, m.diffuse_texname, height);
+		materials_height[i] = height.size() > 0;
 	}
-	//std::cout << "Materials: " << materials.size() << std::endl;
-	//std::cout << "Shapes: " << shapes.size() << std::endl;
-
-	std::vector<Vertex::pnu> vertices;
-	int vert_mat = -69;
-
-	auto flush_verts = [&](){
-		if (vertices.size() == 0)
-			return;
-
-		//std::cout << "vert mat: " << vert_mat << std::endl;
-
-		bool has_h = materials_height[vert_mat];
-		//has_h = false;
-
-		auto [b, n] = map.addBrush<Id, Transform, MVP, MV_normal, OpaqueRender, RT_instance>(1);
-		b.get<Transform>()[n] = glm::scale(glm::dvec3(0.01));
-		auto &r = b.get<OpaqueRender>()[n];
-		r.pipeline = has_h ? pipeline_opaque_tb : pipeline_opaque;
-		auto mat_ndx = mat_off + static_cast<size_t>(vert_mat);
-		r.material = &m_material_pool.data[mat_ndx];
-		uint32_t model_ndx = m_model_pool.currentIndex();
-		r.model = m_model_pool.allocate();
-		AccelerationStructure *acc = needsAccStructure() ? m_acc_pool.allocate() : nullptr;
-
-		std::vector<Vertex::pntbu> vertices_tb;
-
-		if (has_h) {
-			vertices_tb.resize(vertices.size());
-			size_t t_c = vertices.size() / 3;
-			for (size_t i = 0; i < t_c; i++) {
-				auto &v0 = vertices[i * 3];
-				auto &v1 = vertices[i * 3 + 1];
-				auto &v2 = vertices[i * 3 + 2];
-
-				auto dpos1 = v1.p - v0.p;
-				auto dpos2 = v2.p - v0.p;
-
-				auto duv1 = v1.u - v0.u;
-				auto duv2 = v2.u - v0.u;
-
-				float r = duv1.x * duv2.y - duv1.y * duv2.x;
-				auto t = (dpos1 * duv2.y - dpos2 * duv1.y) / r;
-				auto b = (dpos2 * duv1.x - dpos1 * duv2.x) / r;
-
-				for (size_t j = 0; j < 3; j++) {
-					auto &v = vertices[i * 3 + j];
-					auto &vt = vertices_tb[i * 3 + j];
-					vt.p = v.p;
-					vt.n = v.n;
-					vt.t = t;
-					vt.b = b;
-					vt.u = v.u;
-				}
-			}
-		}
-
-		Model &res = *r.model;
-		res.primitiveCount = vertices.size();
-		size_t vert_stride = has_h ? sizeof(decltype(vertices_tb)::value_type) : sizeof(decltype(vertices)::value_type);
-		const void *vert_data = has_h ? static_cast<const void*>(vertices_tb.data()) : static_cast<const void*>(vertices.data());
-		size_t buf_size = vertices.size() * vert_stride;
-		res.vertexBuffer = createVertexBuffer(buf_size);
-		res.indexType = VK_INDEX_TYPE_NONE_KHR;
-		{
-			VkBufferCreateInfo bci{};
-			bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-			bci.size = buf_size;
-			bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-			VmaAllocationCreateInfo aci{};
-			aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-			aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-			void *data;
-			auto s = allocator.createBuffer(bci, aci, &data);
-			std::memcpy(data, vert_data, buf_size);
-			allocator.flushAllocation(s, 0, buf_size);
-
-			m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-			VkBufferCopy region;
-			region.srcOffset = 0;
-			region.dstOffset = 0;
-			region.size = buf_size;
-			m_transfer_cmd.copyBuffer(s, res.vertexBuffer, 1, &region);
-			m_transfer_cmd.end();
-
-			VkSubmitInfo submit{};
-			submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-			submit.commandBufferCount = 1;
-			submit.pCommandBuffers = m_transfer_cmd.ptr();
-			m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-			m_gqueue.waitIdle();
-
-			if (acc)
-				*acc = createBottomAccelerationStructure(vertices.size(), vert_stride, res.vertexBuffer, VK_INDEX_TYPE_NONE_KHR, 0, nullptr, 0);
-
-			allocator.destroy(s);
-		}
-
-		if (needsAccStructure()) {
-			auto &rt = b.get<RT_instance>()[n];
-			rt.mask = 1;
-			rt.instanceShaderBindingTableRecordOffset = has_h ? 2 : 0;
-			rt.accelerationStructureReference = acc->reference;
-			rt.model = model_ndx;
-			if (has_h)
-				bindModel_pntbu(model_ndx, r.model->vertexBuffer);
-			else
-				bindModel_pnu(model_ndx, r.model->vertexBuffer);
-			rt.material = mat_ndx;
-		}
 
-		vert_mat = -69;
-		vertices.clear();
+	struct Run {
+		int material;
+		std::vector<Vertex::pnu> vertices;
+		std::vector<Vertex::pntbu> vertices_tb;	// only for a material with a height map
 	};
-
-	for (auto &shape : shapes) {
-		size_t ndx = 0;
-		/*std::cout << "s " << ndx << ": " << "vs: " << shape.mesh.num_face_vertices.size() << ", ms: " << shape.mesh.material_ids.size() << std::endl;
-		{
-			int mi = -10;
-			for (auto &m : shape.mesh.material_ids)
-				if (m != mi) {
-					auto &ma = materials[m];
-					std::cout << "Mat " << m << ": diffuse: " << ma.diffuse_texname << std::endl;
-					mi = m;
+	struct Piece {
+		size_t run;
+		size_t shape;
+		size_t begin;	// faces
+		size_t end;
+		size_t index;	// first index of face begin
+		size_t first;	// first vertex in the run
+	};
+	std::vector<Run> runs;
+	std::vector<Piece> pieces;
+	for (size_t s = 0; s < shapes.size(); s++) {
+		auto &mesh = shapes[s].mesh;
+		size_t face_count = mesh.num_face_vertices.size();
+		size_t index = 0;
+		for (size_t f = 0; f < face_count;) {
+			auto m = mesh.material_ids[f];
+			size_t run = runs.size();
+			runs.emplace_back().material = m;
+			size_t first = 0;
+			while (f < face_count && mesh.material_ids[f] == m) {
+				Piece p{run, s, f, f, index, first};
+				while (p.end < face_count && p.end - p.begin < piece_faces && mesh.material_ids[p.end] == m) {
+					// checked here so that workers never throw
+					index = checkFace(inputfile, attrib, mesh, p.end, index);
+					p.end++;
 				}
-		}*/
-
-		if (shape.mesh.material_ids.size() > 0)
-			vert_mat = shape.mesh.material_ids[0];
-		for (size_t i = 0; i < shape.mesh.num_face_vertices.size(); i++) {
-			auto m = shape.mesh.material_ids[i];
-			if (m != vert_mat) {
-				flush_verts();
-				vert_mat = m;
-			}
-
-			auto &vert_count = shape.mesh.num_face_vertices[i];
-			std::vector<glm::vec3> pos;
-			std::vector<glm::vec3> normal;
-			std::vector<glm::vec2> uv;
-			for (size_t i = 0; i < vert_count; i++) {
-				auto indices = shape.mesh.indices.at(ndx++);
-				if (indices.vertex_index >= 0)
-					pos.emplace_back(attrib.vertices.at(indices.vertex_index * 3), attrib.vertices.at(indices.vertex_index * 3 + 1), attrib.vertices.at(indices.vertex_index * 3 + 2));
-				if (indices.normal_index >= 0)
-					normal.emplace_back(attrib.normals.at(indices.normal_index * 3), attrib.normals.at(indices.normal_index * 3 + 1), attrib.normals.at(indices.normal_index * 3 + 2));
-				if (indices.texcoord_index >= 0)
-					uv.emplace_back(attrib.texcoords.at(indices.texcoord_index * 2), attrib.texcoords.at(indices.texcoord_index * 2 + 1));
+				pieces.emplace_back(p);
+				first += (p.end - p.begin) * 3;
+				f = p.end;
 			}
+			runs[run].vertices.resize(first);
+			if (m >= 0 && materials_height[m])
+				runs[run].vertices_tb.resize(first);
+		}
+	}
 
-			while (pos.size() < 3)
-				pos.emplace_back(0.0);
-
-			if (normal.size() != 3) {
-				normal.clear();
-				glm::vec3 comp_normal = glm::normalize(glm::cross(pos.at(1) - pos.at(0), pos.at(2) - pos.at(0)));
-				for (size_t i = 0; i < 3; i++)
-					normal.emplace_back(comp_normal);
+	struct Ctx {
+		const tinyobj::attrib_t &attrib;
+		const std::vector<tinyobj::shape_t> &shapes;
+		std::vector<Run> &runs;
+		const std::vector<Piece> &pieces;
+	} ctx{attrib, shapes, runs, pieces};
+	vector<ThreadPool::Task> tasks;
+	for (size_t i = 0; i < pieces.size(); i++)
+		tasks.emplace(ThreadPool::Task{[](void *data, void*, size_t begin, size_t end){
+			auto &ctx = *reinterpret_cast<Ctx*>(data);
+			for (size_t i = begin; i < end; i++) {
+				auto &p = ctx.pieces[i];
+				auto &run = ctx.runs[p.run];
+				auto out = run.vertices.data() + p.first;
+				buildFaces(ctx.attrib, ctx.shapes[p.shape], p.begin, p.end, p.index, out);
+				if (run.vertices_tb.size() > 0)
+					genTangents(out, run.vertices_tb.data() + p.first, (p.end - p.begin) * 3);
 			}
+		}, &ctx, nullptr, i, i + 1});
+	pool.run(tasks.data(), tasks.size());
 
-			while (uv.size() < 3)
-				uv.emplace_back(0.0);
-
-			for (size_t i = 0; i < pos.size(); i++) {
-				decltype(vertices)::value_type vertex;
-				vertex.p = pos.at(i);
-				vertex.n = normal.at(i);
-				vertex.u = uv.at(i);
-				vertices.emplace_back(vertex);
-			}
-		}
-		flush_verts();
+	for (auto &run : runs) {
+		if (run.vertices_tb.size() > 0)
+			cache.add(GeometryFormat::Pntbu, run.material, run.vertices_tb.data(), run.vertices_tb.size(), sizeof(Vertex::pntbu));
+		else
+			cache.add(GeometryFormat::Pnu, run.material, run.vertices.data(), run.vertices.size(), sizeof(Vertex::pnu));
 	}
 }
 
-Vk::ImageAllocation Renderer::loadImage(const char *path, bool gen_mips, VkFormat format)
+// RGBA8 texels, released with stbi_image_free, nullptr when the file does not decode
+static uint8_t* decodeImage(const char *path, int &x, int &y)
 {
-	int x, y, chan;
-	auto data = stbi_load(path, &x, &y, &chan, 4);
+	int chan;
+	return stbi_load(path, &x, &y, &chan, 4);
+}
+
+// Normal from the height slopes in rgb and height in alpha, released with std::free, nullptr when the file does not decode
+static uint8_t* decodeHeightGenNormal(const char *path, int &x, int &y)
+{
+	int chan;
+	auto data = stbi_load(path, &x, &y, &chan, 0);
 	if (data == nullptr)
-		throw std::runtime_error(path);
-	chan = 4;
-	auto res = loadImage(x, y, data, gen_mips, format);
-	stbi_image_free(data);
-	return res;
-}
-
-Vk::ImageAllocation Renderer::loadHeightGenNormal(const char *path, bool gen_mips)
-{
-	int x, y, chan;
-	auto data = stbi_load(path, &x, &y, &chan, 0);
-	if (data == nullptr)
-		throw std::runtime_error(path);
+		return nullptr;
 
 	int32_t s_x = x;
 	int32_t s_y = y;
 
-	auto buf = std::malloc(s_x * s_y * 4);
-	auto b = reinterpret_cast<uint8_t*>(buf);
+	auto b = reinterpret_cast<uint8_t*>(std::malloc(s_x * s_y * 4));
 
 	//std::cout << "chan: " << chan << std::endl;
 
@@ -3214,9 +3119,154 @@ Vk::ImageAllocation Renderer::loadHeightGenNormal(const char *path, bool gen_mip
 				b[g_o(j, i) + 3] = u8_sf(1.0f);*/
 			}
 	}
-	auto res = loadImage(x, y, buf, gen_mips, VK_FORMAT_R8G8B8A8_UNORM);
-	free(buf);
 	stbi_image_free(data);
+	return b;
+}
+
+void Renderer::instanciateModel(Map &map, const char *path, const char *filename)
+{
+	std::string inputfile = std::string(path) + filename;
+	MeshCache cache(inputfile.c_str());
+	if (!cache.map()) {
+		parseObjRanges(cache, map.pool(), path, inputfile);
+		cache.write();
+	}
+
+	// Diffuse then height of each material, in the order their images are allocated
+	struct Texture {
+		std::string path;
+		bool height;
+		int w;
+		int h;
+		uint8_t *data;
+		Vk::ImageAllocation image;
+	};
+	std::vector<Texture> textures;
+	for (uint32_t i = 0; i < cache.materialCount(); i++) {
+		auto &m = cache.material(i);
+		if (m.diffuse != 0)
+			textures.emplace_back(Texture{std::string(path) + cache.name(m.diffuse), false, 0, 0, nullptr, {}});
+		else
+			std::cout << "# " << i << ", WARN: MISSING DIFFUSE FOR MAT: " << cache.name(m.name) << std::endl;
+		if (m.height != 0)
+			textures.emplace_back(Texture{std::string(path) + cache.name(m.height), true, 0, 0, nullptr, {}});
+	}
+
+	// Workers decode and generate normals a wave at a time, which bounds the texels held at once
+	// Each wave goes to the upload ring before the next is decoded
+	static constexpr size_t decode_wave = 32;
+	auto release = [](Texture &t){
+		if (t.height)
+			std::free(t.data);
+		else
+			stbi_image_free(t.data);
+		t.data = nullptr;
+	};
+	vector<ThreadPool::Task> tasks;
+	for (size_t w = 0; w < textures.size(); w += decode_wave) {
+		size_t end = std::min(w + decode_wave, textures.size());
+		tasks.resize(0);
+		for (size_t i = w; i < end; i++)
+			tasks.emplace(ThreadPool::Task{[](void *data, void*, size_t begin, size_t end){
+				auto textures = reinterpret_cast<Texture*>(data);
+				for (size_t i = begin; i < end; i++) {
+					auto &t = textures[i];
+					t.data = t.height ? decodeHeightGenNormal(t.path.c_str(), t.w, t.h) : decodeImage(t.path.c_str(), t.w, t.h);
+				}
+			}, textures.data(), nullptr, i, i + 1});
+		map.pool().run(tasks.data(), tasks.size());
+
+		// workers never throw, a file that did not decode is reported here
+		// the images of the previous waves are destroyed once their uploads are done
+		for (size_t i = w; i < end; i++)
+			if (textures[i].data == nullptr) {
+				for (size_t j = w; j < end; j++)
+					release(textures[j]);
+				if (w > 0) {
+					m_upload.wait(m_upload.ticket());
+					for (size_t j = 0; j < w; j++)
+						allocator.destroy(textures[j].image);
+				}
+				throw std::runtime_error(textures[i].path);
+			}
+		for (size_t i = w; i < end; i++) {
+			auto &t = textures[i];
+			t.image = loadImage(t.w, t.h, t.data, true, t.height ? VK_FORMAT_R8G8B8A8_UNORM : VK_FORMAT_R8G8B8A8_SRGB);
+			release(t);
+		}
+	}
+
+	// ranges without a material use a default one, allocated after those of the cache
+	size_t mat_off = m_material_pool.currentIndex();
+	size_t mat_default = mat_off + cache.materialCount();
+	{
+		Material_albedo mats[cache.materialCount() + 1];
+		size_t t = 0;
+		for (uint32_t i = 0; i < cache.materialCount(); i++) {
+			auto &m = cache.material(i);
+			auto mat = m_material_pool.allocate();
+			size_t andx = 0;
+			if (m.diffuse != 0)
+				andx = allocateImage(textures[t++].image);
+			if (m.height != 0)
+				allocateImage(textures[t++].image, true, VK_FORMAT_R8G8B8A8_UNORM);
+			reinterpret_cast<Material_albedo&>(*mat).albedo = andx;
+			mats[i].albedo = andx;
+		}
+		reinterpret_cast<Material_albedo&>(*m_material_pool.allocate()).albedo = 0;
+		mats[cache.materialCount()].albedo = 0;
+		bindMaterials_albedo(mat_off, cache.materialCount() + 1, mats);
+	}
+
+	for (uint32_t i = 0; i < cache.rangeCount(); i++) {
+		auto &range = cache.range(i);
+		bool has_h = range.format == GeometryFormat::Pntbu;
+
+		auto [b, n] = map.addBrush<Id, Transform, MVP, MV_normal, OpaqueRender, RT_instance>(1);
+		b.at<Transform>(n) = glm::scale(glm::dvec3(0.01));
+		auto &r = b.at<OpaqueRender>(n);
+		r.pipeline = has_h ? pipeline_opaque_tb : pipeline_opaque;
+		auto mat_ndx = range.material < 0 ? mat_default : mat_off + static_cast<size_t>(range.material);
+		r.material = &m_material_pool.data[mat_ndx];
+		uint32_t model_ndx = m_model_pool.currentIndex();
+		r.model = m_model_pool.allocate();
+		AccelerationStructure *acc = needsAccStructure() ? m_acc_pool.allocate() : nullptr;
+		*r.model = loadMeshRange(cache, range, acc);
+
+		if (needsAccStructure()) {
+			auto &rt = b.at<RT_instance>(n);
+			rt.mask = 1;
+			rt.instanceShaderBindingTableRecordOffset = has_h ? 2 : 0;
+			rt.accelerationStructureReference = acc->reference;
+			rt.model = model_ndx;
+			if (has_h)
+				bindModel_pntbu(model_ndx, r.model->vertices);
+			else
+				bindModel_pnu(model_ndx, r.model->vertices);
+			rt.material = mat_ndx;
+		}
+	}
+}
+
+Vk::ImageAllocation Renderer::loadImage(const char *path, bool gen_mips, VkFormat format)
+{
+	int x, y;
+	auto data = decodeImage(path, x, y);
+	if (data == nullptr)
+		throw std::runtime_error(path);
+	auto res = loadImage(x, y, data, gen_mips, format);
+	stbi_image_free(data);
+	return res;
+}
+
+Vk::ImageAllocation Renderer::loadHeightGenNormal(const char *path, bool gen_mips)
+{
+	int x, y;
+	auto data = decodeHeightGenNormal(path, x, y);
+	if (data == nullptr)
+		throw std::runtime_error(path);
+	auto res = loadImage(x, y, data, gen_mips, VK_FORMAT_R8G8B8A8_UNORM);
+	std::free(data);
 	return res;
 }
 
@@ -3240,104 +3290,86 @@ Vk::ImageAllocation Renderer::loadImage(size_t w, size_t h, void *data, bool gen
 	auto res = allocator.createImage(ici, aci);
 
 	{
-		size_t buf_size = w * h * chan;
-		VkBufferCreateInfo bci{};
-		bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bci.size = buf_size;
-		bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		VmaAllocationCreateInfo aci{};
-		aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
-		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-		void *bdata;
-		auto s = allocator.createBuffer(bci, aci, &bdata);
-		std::memcpy(bdata, data, buf_size);
-		allocator.flushAllocation(s, 0, buf_size);
-
-		m_transfer_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-		{
-			VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, 0, Vk::Access::TransferReadBit,
-				Vk::ImageLayout::Undefined, Vk::ImageLayout::TransferDstOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS } };
-			m_transfer_cmd.pipelineBarrier(Vk::PipelineStage::BottomOfPipeBit, Vk::PipelineStage::TransferBit, 0,
-				0, nullptr, 0, nullptr, 1, &ibarrier);
-		}
-		{
-			VkBufferImageCopy region{};
-			region.imageSubresource = VkImageSubresourceLayers { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
-			region.imageOffset = VkOffset3D{0, 0, 0};
-			region.imageExtent = extent;
-			m_transfer_cmd.copyBufferToImage(s, res, Vk::ImageLayout::TransferDstOptimal, 1, &region);
-		}
+		VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, 0, Vk::Access::TransferReadBit,
+			Vk::ImageLayout::Undefined, Vk::ImageLayout::TransferDstOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+			{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS } };
+		m_upload.cmd().pipelineBarrier(Vk::PipelineStage::BottomOfPipeBit, Vk::PipelineStage::TransferBit, 0,
+			0, nullptr, 0, nullptr, 1, &ibarrier);
+	}
+	// staged in slices of rows that fit the ring, the copies of a large image may span several batches
+	size_t row_size = w * chan;
+	size_t slice_rows = max(m_upload.maxStage() / row_size, static_cast<size_t>(1));
+	for (size_t y = 0; y < h; y += slice_rows) {
+		size_t rows = min(slice_rows, h - y);
+		VkBufferImageCopy region{};
+		std::memcpy(m_upload.stage(rows * row_size, region.bufferOffset), reinterpret_cast<const uint8_t*>(data) + y * row_size, rows * row_size);
+		region.imageSubresource = VkImageSubresourceLayers { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		region.imageOffset = VkOffset3D{0, static_cast<int32_t>(y), 0};
+		region.imageExtent = VkExtent3D{extent.width, static_cast<uint32_t>(rows), 1};
+		m_upload.cmd().copyBufferToImage(m_upload.staging(), res, Vk::ImageLayout::TransferDstOptimal, 1, &region);
+	}
+	// blits need the graphics queue, the copy engine may not have them
+	m_upload.transferImage(res, Vk::ImageLayout::TransferDstOptimal, { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS });
+	auto &cmd = m_upload.dstCmd();
+	{
+		VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
+			Vk::ImageLayout::TransferDstOptimal, Vk::ImageLayout::TransferSrcOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+			{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS } };
+		cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
+			0, nullptr, 0, nullptr, 1, &ibarrier);
+	}
+	auto cur_size = VkExtent2D{extent.width, extent.height};
+	for (uint32_t i = 0; i < ici.mipLevels - 1; i++) {
 		{
 			VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
-				Vk::ImageLayout::TransferDstOptimal, Vk::ImageLayout::TransferSrcOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-				{ VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS } };
-			m_transfer_cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
+				Vk::ImageLayout::Undefined, Vk::ImageLayout::TransferDstOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+				{ VK_IMAGE_ASPECT_COLOR_BIT, i + 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } };
+			cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
 				0, nullptr, 0, nullptr, 1, &ibarrier);
 		}
-		auto cur_size = VkExtent2D{extent.width, extent.height};
-		for (uint32_t i = 0; i < ici.mipLevels - 1; i++) {
-			{
-				VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
-					Vk::ImageLayout::Undefined, Vk::ImageLayout::TransferDstOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-					{ VK_IMAGE_ASPECT_COLOR_BIT, i + 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } };
-				m_transfer_cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
-					0, nullptr, 0, nullptr, 1, &ibarrier);
-			}
 
-			VkImageBlit region;
-			region.srcSubresource.aspectMask = Vk::ImageAspect::ColorBit;
-			region.srcSubresource.mipLevel = i;
-			region.srcSubresource.baseArrayLayer = 0;
-			region.srcSubresource.layerCount = 1;
-			region.srcOffsets[0] = VkOffset3D{0, 0, 0};
-			region.srcOffsets[1] = VkOffset3D{static_cast<int32_t>(cur_size.width), static_cast<int32_t>(cur_size.height), 1};
-
-			cur_size = VkExtent2D{nextExtentMip(cur_size.width), nextExtentMip(cur_size.height)};
-			region.dstSubresource.aspectMask = Vk::ImageAspect::ColorBit;
-			region.dstSubresource.mipLevel = i + 1;
-			region.dstSubresource.baseArrayLayer = 0;
-			region.dstSubresource.layerCount = 1;
-			region.dstOffsets[0] = VkOffset3D{0, 0, 0};
-			region.dstOffsets[1] = VkOffset3D{static_cast<int32_t>(cur_size.width), static_cast<int32_t>(cur_size.height), 1};
-			m_transfer_cmd.blitImage(res, Vk::ImageLayout::TransferSrcOptimal, res, Vk::ImageLayout::TransferDstOptimal, 
-				1, &region, VK_FILTER_LINEAR);
+		VkImageBlit region;
+		region.srcSubresource.aspectMask = Vk::ImageAspect::ColorBit;
+		region.srcSubresource.mipLevel = i;
+		region.srcSubresource.baseArrayLayer = 0;
+		region.srcSubresource.layerCount = 1;
+		region.srcOffsets[0] = VkOffset3D{0, 0, 0};
+		region.srcOffsets[1] = VkOffset3D{static_cast<int32_t>(cur_size.width), static_cast<int32_t>(cur_size.height), 1};
+
+		cur_size = VkExtent2D{nextExtentMip(cur_size.width), nextExtentMip(cur_size.height)};
+		region.dstSubresource.aspectMask = Vk::ImageAspect::ColorBit;
+		region.dstSubresource.mipLevel = i + 1;
+		region.dstSubresource.baseArrayLayer = 0;
+		region.dstSubresource.layerCount = 1;
+		region.dstOffsets[0] = VkOffset3D{0, 0, 0};
+		region.dstOffsets[1] = VkOffset3D{static_cast<int32_t>(cur_size.width), static_cast<int32_t>(cur_size.height), 1};
+		cmd.blitImage(res, Vk::ImageLayout::TransferSrcOptimal, res, Vk::ImageLayout::TransferDstOptimal, 
+			1, &region, VK_FILTER_LINEAR);
 
-			{
-				VkImageMemoryBarrier ibarriers[] { 
-					{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
-						Vk::ImageLayout::TransferSrcOptimal, Vk::ImageLayout::ShaderReadOnlyOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-						{ VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, VK_REMAINING_ARRAY_LAYERS } },
-					{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
-						Vk::ImageLayout::TransferDstOptimal, Vk::ImageLayout::TransferSrcOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-						{ VK_IMAGE_ASPECT_COLOR_BIT, i + 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } }
-				};
-				m_transfer_cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
-					0, nullptr, 0, nullptr, array_size(ibarriers), ibarriers);
-			}
-		}
 		{
-			VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
-				Vk::ImageLayout::TransferSrcOptimal, Vk::ImageLayout::ShaderReadOnlyOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
-				{ VK_IMAGE_ASPECT_COLOR_BIT, ici.mipLevels - 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } };
-			m_transfer_cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
-				0, nullptr, 0, nullptr, 1, &ibarrier);
+			VkImageMemoryBarrier ibarriers[] { 
+				{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
+					Vk::ImageLayout::TransferSrcOptimal, Vk::ImageLayout::ShaderReadOnlyOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+					{ VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, VK_REMAINING_ARRAY_LAYERS } },
+				{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
+					Vk::ImageLayout::TransferDstOptimal, Vk::ImageLayout::TransferSrcOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+					{ VK_IMAGE_ASPECT_COLOR_BIT, i + 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } }
+			};
+			cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
+				0, nullptr, 0, nullptr, array_size(ibarriers), ibarriers);
 		}
-		m_transfer_cmd.end();
-
-		VkSubmitInfo submit{};
-		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-		submit.commandBufferCount = 1;
-		submit.pCommandBuffers = m_transfer_cmd.ptr();
-		m_gqueue.submit(1, &submit, VK_NULL_HANDLE);
-		m_gqueue.waitIdle();
-
-		allocator.destroy(s);
+	}
+	{
+		VkImageMemoryBarrier ibarrier { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::TransferReadBit,
+			Vk::ImageLayout::TransferSrcOptimal, Vk::ImageLayout::ShaderReadOnlyOptimal, m_queue_family_graphics, m_queue_family_graphics, res,
+			{ VK_IMAGE_ASPECT_COLOR_BIT, ici.mipLevels - 1, 1, 0, VK_REMAINING_ARRAY_LAYERS } };
+		cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::TransferBit, 0,
+			0, nullptr, 0, nullptr, 1, &ibarrier);
 	}
 	return res;
 }
 
-AccelerationStructure Renderer::createBottomAccelerationStructure(uint32_t vertexCount, size_t vertexStride, VkBuffer vertices,
+AccelerationStructure Renderer::createBottomAccelerationStructure(uint32_t vertexCount, size_t vertexStride, VkBuffer vertices, VkDeviceSize verticesOffset,
 	VkIndexType indexType, uint32_t indexCount, VkBuffer indices, VkGeometryFlagsKHR flags)
 {
 	VkAccelerationStructureBuildGeometryInfoKHR bi{};
@@ -3399,7 +3431,7 @@ AccelerationStructure Renderer::createBottomAccelerationStructure(uint32_t verte
 		t.indexData.deviceAddress = device.getBufferDeviceAddressKHR(indices);
 	}
 
-	t.vertexData.deviceAddress = device.getBufferDeviceAddressKHR(vertices);
+	t.vertexData.deviceAddress = device.getBufferDeviceAddressKHR(vertices) + verticesOffset;
 	bi.scratchData.deviceAddress = device.getBufferDeviceAddressKHR(scratch);
 
 	VkAccelerationStructureCreateInfoKHR ci{};
@@ -3424,8 +3456,22 @@ AccelerationStructure Renderer::createBottomAccelerationStructure(uint32_t verte
 	};
 	m_ctransfer_cmd.buildAccelerationStructuresKHR(1, &bi, ppbri);
 	m_ctransfer_cmd.end();
+
+	// the geometry may still be in flight on the upload queue, buffers are shared so its copies are enough
+	m_upload.submit();
+	uint64_t wait_value = m_upload.ticket();
+	VkTimelineSemaphoreSubmitInfoKHR ti{};
+	ti.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	ti.waitSemaphoreValueCount = 1;
+	ti.pWaitSemaphoreValues = &wait_value;
+	VkSemaphore wait_sem = m_upload.copied();
+	VkPipelineStageFlags wait_stage = Vk::PipelineStage::AccelerationStructureBuildBitKhr;
 	VkSubmitInfo submit{};
 	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = &ti;
+	submit.waitSemaphoreCount = 1;
+	submit.pWaitSemaphores = &wait_sem;
+	submit.pWaitDstStageMask = &wait_stage;
 	submit.commandBufferCount = 1;
 	submit.pCommandBuffers = m_ctransfer_cmd.ptr();
 	m_cqueue.submit(1, &submit, VK_NULL_HANDLE);
@@ -3476,7 +3522,7 @@ void Renderer::bindMaterials_albedo(uint32_t firstMaterial, uint32_t materialCou
 		loadBufferCompute(m_frames[i].m_illum_rt.m_materials_albedo_buffer, materialCount * sizeof(Material_albedo), pMaterials, firstMaterial * sizeof(Material_albedo));
 }
 
-void Renderer::bindModel_pnu(uint32_t binding, VkBuffer vertexBuffer)
+void Renderer::bindModel_pnu(uint32_t binding, const GeometryRange &vertices)
 {
 	VkDescriptorBufferInfo bis[m_frame_count];
 	VkWriteDescriptorSet writes[m_frame_count];
@@ -3489,16 +3535,16 @@ void Renderer::bindModel_pnu(uint32_t binding, VkBuffer vertexBuffer)
 		w.descriptorCount = 1;
 		w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		auto &bi = bis[i];
-		bi.buffer = vertexBuffer;
-		bi.offset = 0;
-		bi.range = VK_WHOLE_SIZE;
+		bi.buffer = vertices.buffer;
+		bi.offset = vertices.offset;
+		bi.range = vertices.size;
 		w.pBufferInfo = &bi;
 		writes[i] = w;
 	}
 	vkUpdateDescriptorSets(device, m_frame_count, writes, 0, nullptr);
 }
 
-void Renderer::bindModel_pn_i16(uint32_t binding, VkBuffer vertexBuffer, VkBuffer indexBuffer)
+void Renderer::bindModel_pn_i16(uint32_t binding, const GeometryRange &vertices, VkBuffer indexBuffer)
 {
 	VkDescriptorBufferInfo bis[m_frame_count * 2];
 	VkWriteDescriptorSet writes[m_frame_count * 2];
@@ -3512,9 +3558,9 @@ void Renderer::bindModel_pn_i16(uint32_t binding, VkBuffer vertexBuffer, VkBuffe
 			w.descriptorCount = 1;
 			w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 			auto &bi = bis[i * 2];
-			bi.buffer = vertexBuffer;
-			bi.offset = 0;
-			bi.range = VK_WHOLE_SIZE;
+			bi.buffer = vertices.buffer;
+			bi.offset = vertices.offset;
+			bi.range = vertices.size;
 			w.pBufferInfo = &bi;
 			writes[i * 2] = w;
 		}
@@ -3537,7 +3583,7 @@ void Renderer::bindModel_pn_i16(uint32_t binding, VkBuffer vertexBuffer, VkBuffe
 	vkUpdateDescriptorSets(device, m_frame_count * 2, writes, 0, nullptr);
 }
 
-void Renderer::bindModel_pntbu(uint32_t binding, VkBuffer vertexBuffer)
+void Renderer::bindModel_pntbu(uint32_t binding, const GeometryRange &vertices)
 {
 	VkDescriptorBufferInfo bis[m_frame_count];
 	VkWriteDescriptorSet writes[m_frame_count];
@@ -3550,9 +3596,9 @@ void Renderer::bindModel_pntbu(uint32_t binding, VkBuffer vertexBuffer)
 		w.descriptorCount = 1;
 		w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 		auto &bi = bis[i];
-		bi.buffer = vertexBuffer;
-		bi.offset = 0;
-		bi.range = VK_WHOLE_SIZE;
+		bi.buffer = vertices.buffer;
+		bi.offset = vertices.offset;
+		bi.range = vertices.size;
 		w.pBufferInfo = &bi;
 		writes[i] = w;
 	}
@@ -3574,6 +3620,9 @@ Renderer::Renderer(uint32_t frameCount, bool validate, bool useRenderDoc) :
 	allocator(createAllocator()),
 	m_gqueue(device.getQueue(m_queue_family_graphics, 0)),
 	m_cqueue(device.getQueue(m_queue_family_compute, 0)),
+	m_tqueue(device.getQueue(m_queue_family_transfer, 0)),
+	m_upload(device, allocator, m_tqueue, m_queue_family_transfer, m_gqueue, m_queue_family_graphics, upload_capacity),
+	m_cupload(device, allocator, m_cqueue, m_queue_family_compute, m_cqueue, m_queue_family_compute, cupload_capacity),
 	m_swapchain(createSwapchain()),
 	m_swapchain_images(device.getSwapchainImages(m_swapchain)),
 	m_swapchain_image_views(createSwapchainImageViews()),
@@ -3592,6 +3641,8 @@ Renderer::Renderer(uint32_t frameCount, bool validate, bool useRenderDoc) :
 		),
 	m_descriptor_set_layout_dynamic(createDescriptorSetLayoutDynamic()),
 	m_pipeline_layout_descriptor_set(createPipelineLayoutDescriptorSet()),
+	m_cull_pipeline(createCullPipeline()),
+	m_cull_visibility(createCullVisibility()),
 
 	m_fwd_p2_module(loadShaderModule(VK_SHADER_STAGE_VERTEX_BIT, "sha/fwd_p2")),
 	m_sample_count(fitSampleCount(VK_SAMPLE_COUNT_1_BIT)),
@@ -3599,7 +3650,8 @@ Renderer::Renderer(uint32_t frameCount, bool validate, bool useRenderDoc) :
 	m_illum_technique_props(getIllumTechniqueProps()),
 	m_screen_vertex_buffer(createScreenVertexBuffer()),
 
-	m_opaque_pass(createOpaquePass()),
+	m_opaque_pass(createOpaquePass(false)),
+	m_opaque_load_pass(createOpaquePass(true)),
 	m_color_resolve_pass(createColorResolvePass()),
 	m_color_resolve_set_layout(createColorResolveSetLayout()),
 	m_color_resolve_pipeline(createColorResolvePipeline()),
@@ -3658,18 +3710,18 @@ Renderer::Renderer(uint32_t frameCount, bool validate, bool useRenderDoc) :
 	m_rnd(std::time(nullptr))
 {
 	std::memset(pipeline_opaque_uvgen, 0, sizeof(Pipeline));
-	*pipeline_opaque_uvgen = createPipeline3D_pn("sha/opaque_uvgen", sizeof(int32_t));
+	*pipeline_opaque_uvgen = createPipeline3D_pn("sha/opaque_uvgen");
 	pipeline_opaque_uvgen->pushDynamic<MVP>();
 	pipeline_opaque_uvgen->pushDynamic<MV_normal>();
 	pipeline_opaque_uvgen->pushDynamic<MW_local>();
 
 	std::memset(pipeline_opaque, 0, sizeof(Pipeline));
-	*pipeline_opaque = createPipeline3D_pnu("sha/opaque", sizeof(int32_t));
+	*pipeline_opaque = createPipeline3D_pnu("sha/opaque");
 	pipeline_opaque->pushDynamic<MVP>();
 	pipeline_opaque->pushDynamic<MV_normal>();
 
 	std::memset(pipeline_opaque_tb, 0, sizeof(Pipeline));
-	*pipeline_opaque_tb = createPipeline3D_pntbu("sha/opaque_tb", sizeof(int32_t));
+	*pipeline_opaque_tb = createPipeline3D_pntbu("sha/opaque_tb");
 	pipeline_opaque_tb->pushDynamic<MVP>();
 	pipeline_opaque_tb->pushDynamic<MV_normal>();
 
@@ -3722,7 +3774,10 @@ Renderer::~Renderer(void)
 	m_image_view_pool.destroyUsing(device);
 	m_image_pool.destroyUsing(allocator);
 	m_acc_pool.destroyUsing(*this);
-	m_model_pool.destroy(allocator);
+	m_model_pool.destroyUsing(*this);
+	for (auto &blocks : m_geometry_blocks)
+		for (auto &b : blocks)
+			allocator.destroy(b.buffer);
 	m_pipeline_pool.destroy(device);
 
 	for (auto &f : m_frames)
@@ -3755,6 +3810,7 @@ Renderer::~Renderer(void)
 	device.destroy(m_color_resolve_set_layout);
 	device.destroy(m_color_resolve_pass);
 
+	device.destroy(m_opaque_load_pass);
 	device.destroy(m_opaque_pass);
 
 	allocator.destroy(m_screen_vertex_buffer);
@@ -3762,10 +3818,14 @@ Renderer::~Renderer(void)
 
 	device.destroy(m_descriptor_pool_mip);
 	device.destroy(m_descriptor_pool);
+	allocator.destroy(m_cull_visibility);
+	m_cull_pipeline.destroy(device);
 	device.destroy(m_pipeline_layout_descriptor_set);
 	device.destroy(m_descriptor_set_layout_dynamic);
 	device.destroy(m_descriptor_set_layout_0);
 
+	m_cupload.destroy();
+	m_upload.destroy();
 	device.destroy(m_ctransfer_command_pool);
 	device.destroy(m_transfer_command_pool);
 	device.destroy(m_ccommand_pool);
@@ -3786,7 +3846,9 @@ Renderer::~Renderer(void)
 void Renderer::bindFrameDescriptors(void)
 {
 	static constexpr uint32_t const_img_writes_per_frame =
-		1;	// wsi: output
+		1 +	// wsi: output
+		1 +	// depth_resolve: cdepth
+		1;	// dynamic: depth pyramid
 	uint32_t img_writes_per_frame =
 		const_img_writes_per_frame +
 		m_illum_technique_props.descriptorCombinedImageSamplerCount +
@@ -3814,8 +3876,7 @@ void Renderer::bindFrameDescriptors(void)
 			IllumTechnique::Data::Rtbp::bufWritesPerFrame :
 			0);
 	uint32_t buf_writes_offset = img_writes_per_frame;
-	uint32_t img_mip_writes_per_frame = m_illum_technique == IllumTechnique::Sspt ?
-		m_swapchain_mip_levels - 1 : 0;	// depth_acc
+	uint32_t img_mip_writes_per_frame = m_swapchain_mip_levels - 1;	// depth_acc
 	uint32_t img_mip_writes_offset = img_writes_per_frame + buf_writes_per_frame;
 	uint32_t writes_per_frame = img_writes_per_frame + buf_writes_per_frame + img_mip_writes_per_frame;
 
@@ -3840,7 +3901,9 @@ void Renderer::bindFrameDescriptors(void)
 
 		{
 			WriteImgDesc descs[const_img_writes_per_frame] {
-				{cur_frame.m_wsi_set, cis, 0, m_sampler_fb, cur_frame.m_output_view, Vk::ImageLayout::ShaderReadOnlyOptimal}
+				{cur_frame.m_wsi_set, cis, 0, m_sampler_fb, cur_frame.m_output_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+				{cur_frame.m_depth_resolve_set, cis, 0, m_sampler_fb, cur_frame.m_cdepth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+				{cur_frame.m_descriptor_set_dynamic, cis, 4, m_sampler_fb, cur_frame.m_depth_pyramid_view, Vk::ImageLayout::ShaderReadOnlyOptimal}
 			};
 			for (size_t i = 0; i < array_size(descs); i++)
 				write_img_descs[write_img_descs_offset++] = descs[i];
@@ -3858,11 +3921,10 @@ void Renderer::bindFrameDescriptors(void)
 		if (m_illum_technique == IllumTechnique::Sspt) {
 			if (m_sample_count == VK_SAMPLE_COUNT_1_BIT) {
 				WriteImgDesc descs[IllumTechnique::Data::Sspt::descriptorCombinedImageSamplerCount] {
-					{cur_frame.m_illum_ssgi_fbs.m_depth_resolve_set, cis, 0, m_sampler_fb, cur_frame.m_cdepth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
-					{cur_frame.m_illumination_set, cis, 1, m_sampler_fb_mip, cur_frame.m_illum_ssgi_fbs.m_depth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+					{cur_frame.m_illumination_set, cis, 1, m_sampler_fb_mip, cur_frame.m_depth_pyramid_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 2, m_sampler_fb_lin, cur_frame.m_albedo_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 3, m_sampler_fb, cur_frame.m_normal_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
-					{next_frame.m_illumination_set, cis, 4, m_sampler_fb_lin, cur_frame.m_illum_ssgi_fbs.m_depth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+					{next_frame.m_illumination_set, cis, 4, m_sampler_fb_lin, cur_frame.m_depth_pyramid_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 5, m_sampler_fb_lin, cur_frame.m_albedo_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 6, m_sampler_fb, cur_frame.m_normal_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 7, m_sampler_fb, cur_frame.m_illum_ssgi_fbs.m_step_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
@@ -3880,14 +3942,13 @@ void Renderer::bindFrameDescriptors(void)
 					{cur_frame.m_illum_ssgi_fbs.m_color_resolve_set, cis, 0, m_sampler_fb, cur_frame.m_cdepth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illum_ssgi_fbs.m_color_resolve_set, cis, 1, m_sampler_fb, cur_frame.m_albedo_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illum_ssgi_fbs.m_color_resolve_set, cis, 2, m_sampler_fb, cur_frame.m_normal_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
-					{cur_frame.m_illum_ssgi_fbs.m_depth_resolve_set, cis, 0, m_sampler_fb, cur_frame.m_cdepth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 1, m_sampler_fb, cur_frame.m_cdepth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
-					{cur_frame.m_illumination_set, cis, 2, m_sampler_fb_mip, cur_frame.m_illum_ssgi_fbs.m_depth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+					{cur_frame.m_illumination_set, cis, 2, m_sampler_fb_mip, cur_frame.m_depth_pyramid_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 3, m_sampler_fb_lin, cur_frame.m_albedo_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 4, m_sampler_fb, cur_frame.m_normal_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 5, m_sampler_fb_lin, cur_frame.m_illum_ssgi_fbs.m_albedo_resolved_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{cur_frame.m_illumination_set, cis, 6, m_sampler_fb, cur_frame.m_illum_ssgi_fbs.m_normal_resolved_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
-					{next_frame.m_illumination_set, cis, 7, m_sampler_fb_lin, cur_frame.m_illum_ssgi_fbs.m_depth_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
+					{next_frame.m_illumination_set, cis, 7, m_sampler_fb_lin, cur_frame.m_depth_pyramid_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 8, m_sampler_fb_lin, cur_frame.m_illum_ssgi_fbs.m_albedo_resolved_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 9, m_sampler_fb, cur_frame.m_illum_ssgi_fbs.m_normal_resolved_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
 					{next_frame.m_illumination_set, cis, 10, m_sampler_fb, cur_frame.m_illum_ssgi_fbs.m_step_view, Vk::ImageLayout::ShaderReadOnlyOptimal},
@@ -4067,27 +4128,25 @@ void Renderer::bindFrameDescriptors(void)
 			writes[i * writes_per_frame + buf_writes_offset + j] = w;
 		}
 
-		if (m_illum_technique == IllumTechnique::Sspt) {
-			WriteImgDesc write_img_mip_descs[img_mip_writes_per_frame];
-			for (uint32_t j = 0; j < img_mip_writes_per_frame; j++)
-				write_img_mip_descs[j] = WriteImgDesc{cur_frame.m_illum_ssgi_fbs.m_depth_acc_sets[j], cis, 0, m_sampler_fb,
-					j == 0 ? cur_frame.m_illum_ssgi_fbs.m_depth_first_mip_view : cur_frame.m_illum_ssgi_fbs.m_depth_acc_views[j - 1], Vk::ImageLayout::ShaderReadOnlyOptimal};
-			for (uint32_t j = 0; j < img_mip_writes_per_frame; j++) {
-				auto &ii = image_infos[i * (img_writes_per_frame + img_mip_writes_per_frame) + img_writes_per_frame + j];
-				ii.sampler = write_img_mip_descs[j].sampler;
-				ii.imageView = write_img_mip_descs[j].imageView;
-				ii.imageLayout = write_img_mip_descs[j].imageLayout;
+		WriteImgDesc write_img_mip_descs[img_mip_writes_per_frame];
+		for (uint32_t j = 0; j < img_mip_writes_per_frame; j++)
+			write_img_mip_descs[j] = WriteImgDesc{cur_frame.m_depth_acc_sets[j], cis, 0, m_sampler_fb,
+				j == 0 ? cur_frame.m_depth_pyramid_first_mip_view : cur_frame.m_depth_acc_views[j - 1], Vk::ImageLayout::ShaderReadOnlyOptimal};
+		for (uint32_t j = 0; j < img_mip_writes_per_frame; j++) {
+			auto &ii = image_infos[i * (img_writes_per_frame + img_mip_writes_per_frame) + img_writes_per_frame + j];
+			ii.sampler = write_img_mip_descs[j].sampler;
+			ii.imageView = write_img_mip_descs[j].imageView;
+			ii.imageLayout = write_img_mip_descs[j].imageLayout;
 
-				VkWriteDescriptorSet w{};
-				w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-				w.dstSet = write_img_mip_descs[j].descriptorSet;
-				w.dstBinding = write_img_mip_descs[j].binding;
-				w.dstArrayElement = 0;
-				w.descriptorCount = 1;
-				w.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-				w.pImageInfo = &ii;
-				writes[i * writes_per_frame + img_mip_writes_offset + j] = w;
-			}
+			VkWriteDescriptorSet w{};
+			w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			w.dstSet = write_img_mip_descs[j].descriptorSet;
+			w.dstBinding = write_img_mip_descs[j].binding;
+			w.dstArrayElement = 0;
+			w.descriptorCount = 1;
+			w.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			w.pImageInfo = &ii;
+			writes[i * writes_per_frame + img_mip_writes_offset + j] = w;
 		}
 	}
 	//for (size_t i = 0; i < m_frame_count * writes_per_frame; i++)
@@ -4124,7 +4183,7 @@ void Renderer::bindFrameDescriptors(void)
 				if (m_illum_technique == IllumTechnique::Sspt) {
 					if (m_sample_count == VK_SAMPLE_COUNT_1_BIT) {
 						VkImage imgs[IllumTechnique::Data::Sspt::barrsPerFrame] {
-							m_frames[i].m_illum_ssgi_fbs.m_depth,
+							m_frames[i].m_depth_pyramid,
 							m_frames[i].m_illum_ssgi_fbs.m_step,
 							m_frames[i].m_illum_ssgi_fbs.m_acc_path_pos,
 							m_frames[i].m_illum_ssgi_fbs.m_direct_light
@@ -4133,7 +4192,7 @@ void Renderer::bindFrameDescriptors(void)
 							images[images_offset++] = imgs[i];
 					} else {
 						VkImage imgs[IllumTechnique::Data::Sspt::msBarrsPerFrame] {
-							m_frames[i].m_illum_ssgi_fbs.m_depth,
+							m_frames[i].m_depth_pyramid,
 							m_frames[i].m_illum_ssgi_fbs.m_albedo_resolved,
 							m_frames[i].m_illum_ssgi_fbs.m_normal_resolved,
 							m_frames[i].m_illum_ssgi_fbs.m_step,
@@ -4202,7 +4261,7 @@ void Renderer::bindFrameDescriptors(void)
 				if (m_illum_technique == IllumTechnique::Sspt) {
 					if (m_sample_count == VK_SAMPLE_COUNT_1_BIT) {
 						ImgDesc imgs[IllumTechnique::Data::Sspt::barrsPerFrame] {
-							{m_frames[i].m_illum_ssgi_fbs.m_depth, &cv_f32_zero},
+							{m_frames[i].m_depth_pyramid, &cv_f32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_step, &cv_i32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_acc_path_pos, &cv_i32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_direct_light, &cv_f32_zero},
@@ -4211,7 +4270,7 @@ void Renderer::bindFrameDescriptors(void)
 							images[images_offset++] = imgs[i];
 					} else {
 						ImgDesc imgs[IllumTechnique::Data::Sspt::msBarrsPerFrame] {
-							{m_frames[i].m_illum_ssgi_fbs.m_depth, &cv_f32_zero},
+							{m_frames[i].m_depth_pyramid, &cv_f32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_albedo_resolved, &cv_f32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_normal_resolved, &cv_f32_zero},
 							{m_frames[i].m_illum_ssgi_fbs.m_step, &cv_i32_zero},
@@ -4275,7 +4334,7 @@ void Renderer::bindFrameDescriptors(void)
 				if (m_illum_technique == IllumTechnique::Sspt) {
 					if (m_sample_count == VK_SAMPLE_COUNT_1_BIT) {
 						ImgDesc imgs[IllumTechnique::Data::Sspt::addBarrsPerFrame] {
-							{m_frames[i].m_illum_ssgi_fbs.m_depth, Vk::ImageLayout::TransferDstOptimal},
+							{m_frames[i].m_depth_pyramid, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_step, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_acc_path_pos, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_direct_light, Vk::ImageLayout::TransferDstOptimal},
@@ -4287,7 +4346,7 @@ void Renderer::bindFrameDescriptors(void)
 							images[images_offset++] = imgs[i];
 					} else {
 						ImgDesc imgs[IllumTechnique::Data::Sspt::msAddBarrsPerFrame] {
-							{m_frames[i].m_illum_ssgi_fbs.m_depth, Vk::ImageLayout::TransferDstOptimal},
+							{m_frames[i].m_depth_pyramid, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_albedo_resolved, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_normal_resolved, Vk::ImageLayout::TransferDstOptimal},
 							{m_frames[i].m_illum_ssgi_fbs.m_step, Vk::ImageLayout::TransferDstOptimal},
@@ -4380,11 +4439,13 @@ void Renderer::recreateSwapchain(void)
 		m_frames.emplace(*this, i, f.m_cmd_gtransfer, f.m_cmd_grender_pass, f.m_cmd_gwsi,
 			f.m_cmd_ctransfer, f.m_cmd_ctrace_rays,
 			f.m_descriptor_set_0, f.m_descriptor_set_dynamic,
-			f.m_illum_ssgi_fbs.m_color_resolve_set, f.m_illum_ssgi_fbs.m_depth_resolve_set,
+			f.m_illum_ssgi_fbs.m_color_resolve_set, f.m_depth_resolve_set,
 			f.m_illumination_set, f.m_illum_rt.m_res_set,
 			f.m_wsi_set,
-			&sets_mip[sets_mip_stride],
-			f.m_dyn_buffer);
+			&sets_mip[i * sets_mip_stride],
+			f.m_dyn_buffer, f.m_dyn_buffer_capacity,
+			f.m_cull_buffer, f.m_cull_draw_capacity, f.m_cull_instance_capacity,
+			f.m_material_buffer);
 	}
 	bindFrameDescriptors();
 
@@ -4484,16 +4545,142 @@ double Renderer::zrand(void)
 	return static_cast<double>(m_rnd()) / static_cast<double>(std::numeric_limits<decltype(m_rnd())>::max());
 }
 
+// Direct: mapped device local memory, also a copy source for the data that leaves it
+Vk::BufferAllocation Renderer::createDynBuffer(size_t size, void **ppMappedData) const
+{
+	VkBufferCreateInfo bci{};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = size;
+	VmaAllocationCreateInfo aci{};
+	if (m_dyn_direct) {
+		bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+		aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		aci.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+		aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+		return allocator.createBuffer(bci, aci, ppMappedData);
+	}
+	bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	*ppMappedData = nullptr;
+	return allocator.createBuffer(bci, aci);
+}
+
+Vk::BufferAllocation Renderer::createCullBuffer(size_t size) const
+{
+	VkBufferCreateInfo bci{};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = size;
+	bci.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+	VmaAllocationCreateInfo aci{};
+	aci.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+	return allocator.createBuffer(bci, aci);
+}
+
 Vk::BufferAllocation Renderer::Frame::createDynBufferStaging(void)
 {
+	if (m_r.m_dyn_direct) {
+		m_dyn_buffer_ptr = m_r.allocator.getMappedData(m_dyn_buffer);
+		return Vk::BufferAllocation(VK_NULL_HANDLE, VK_NULL_HANDLE);
+	}
 	VkBufferCreateInfo bci{};
 	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bci.size = dyn_buffer_size;
+	bci.size = m_dyn_buffer_capacity;
 	bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 	VmaAllocationCreateInfo aci{};
 	aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
 	aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
-	return m_r.allocator.createBuffer(bci, aci, &m_dyn_buffer_staging_ptr);
+	return m_r.allocator.createBuffer(bci, aci, &m_dyn_buffer_ptr);
+}
+
+// Makes room for size more bytes, growing keeps what the frame wrote but is only possible until a copy out of the buffer is recorded
+// Unless locked, growth leaves some slack for the allocations that come after
+void Renderer::Frame::dynReserve(size_t size)
+{
+	auto align = m_r.m_limits.minStorageBufferOffsetAlignment;
+	size_t needed = (m_dyn_buffer_size + align - 1) / align * align + size;
+	if (m_dyn_buffer_locked) {
+		if (needed > m_dyn_buffer_capacity)
+			throw std::runtime_error("Dynamic buffer overflow");
+		return;
+	}
+	if (needed + dyn_buffer_slack <= m_dyn_buffer_capacity)
+		return;
+
+	// the frame fence was waited on, the previous buffers are no longer in use
+	size_t capacity = m_dyn_buffer_capacity;
+	while (capacity < needed + dyn_buffer_slack)
+		capacity *= 2;
+	auto old_buffer = m_dyn_buffer;
+	auto old_staging = m_dyn_buffer_staging;
+	auto old_ptr = m_dyn_buffer_ptr;
+	m_dyn_buffer_capacity = capacity;
+	void *mapped;
+	m_dyn_buffer = m_r.createDynBuffer(m_dyn_buffer_capacity, &mapped);
+	m_dyn_buffer_staging = createDynBufferStaging();
+	std::memcpy(m_dyn_buffer_ptr, old_ptr, m_dyn_buffer_size);
+	if (!m_r.m_dyn_direct)
+		m_r.allocator.destroy(old_staging);
+	m_r.allocator.destroy(old_buffer);
+	writeDynamicBinding(5, m_dyn_buffer);
+}
+
+void Renderer::Frame::writeDynamicBinding(uint32_t binding, VkBuffer buffer)
+{
+	VkDescriptorBufferInfo bi{buffer, 0, VK_WHOLE_SIZE};
+	VkWriteDescriptorSet w{};
+	w.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	w.dstSet = m_descriptor_set_dynamic;
+	w.dstBinding = binding;
+	w.dstArrayElement = 0;
+	w.descriptorCount = 1;
+	w.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	w.pBufferInfo = &bi;
+	m_r.device.updateDescriptorSets(1, &w, 0, nullptr);
+}
+
+// Makes room for the draws and instances of the frame, the frame fence was waited on so the previous buffer is no longer in use
+void Renderer::Frame::cullReserve(size_t draws, size_t instances)
+{
+	if (draws <= m_cull_draw_capacity && instances <= m_cull_instance_capacity)
+		return;
+	while (m_cull_draw_capacity < draws)
+		m_cull_draw_capacity *= 2;
+	while (m_cull_instance_capacity < instances)
+		m_cull_instance_capacity *= 2;
+	m_r.allocator.destroy(m_cull_buffer);
+	m_cull_buffer = m_r.createCullBuffer(cullBufferSize(m_cull_draw_capacity, m_cull_instance_capacity));
+	writeCullBindings();
+}
+
+// Visible instances after the draws of both phases
+void Renderer::Frame::writeCullBindings(void)
+{
+	auto draws_size = cullDrawsSize(m_cull_draw_capacity);
+	VkDescriptorBufferInfo bi[2] {
+		{m_cull_buffer, draws_size, VK_WHOLE_SIZE},
+		{m_cull_buffer, 0, draws_size}
+	};
+	VkWriteDescriptorSet w[2] {};
+	for (uint32_t i = 0; i < 2; i++) {
+		w[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		w[i].dstSet = m_descriptor_set_dynamic;
+		w[i].dstBinding = 1 + i;
+		w[i].dstArrayElement = 0;
+		w[i].descriptorCount = 1;
+		w[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		w[i].pBufferInfo = &bi[i];
+	}
+	m_r.device.updateDescriptorSets(2, w, 0, nullptr);
+}
+
+// Offset of size bytes aligned for dynamic offsets
+size_t Renderer::Frame::dynAlloc(size_t size)
+{
+	dynReserve(size);
+	auto align = m_r.m_limits.minStorageBufferOffsetAlignment;
+	size_t res = (m_dyn_buffer_size + align - 1) / align * align;
+	m_dyn_buffer_size = res + size;
+	return res;
 }
 
 Vk::ImageView Renderer::Frame::createFbImage(VkFormat format, VkImageAspectFlags aspect, VkImageUsageFlags usage, Vk::ImageAllocation *pAllocation)
@@ -4572,8 +4759,62 @@ Vk::ImageView Renderer::Frame::createFbImageMip(VkFormat format, VkImageAspectFl
 	return m_r.createImageView(*pAllocation, VK_IMAGE_VIEW_TYPE_2D, format, aspect);
 }
 
-Renderer::IllumTechnique::Data::Sspt::Fbs Renderer::Frame::createIllumSsgiFbs(VkDescriptorSet descriptorSetColorResolve, VkDescriptorSet descriptorSetDepthResolve,
-	const VkDescriptorSet *pDescriptorSetsMip)
+Vk::Framebuffer Renderer::Frame::createDepthResolveFb(void)
+{
+	VkFramebufferCreateInfo ci{};
+	ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	ci.renderPass = m_r.m_depth_resolve_pass;
+	VkImageView atts[] {
+		m_depth_pyramid_first_mip_view
+	};
+	ci.attachmentCount = array_size(atts);
+	ci.pAttachments = atts;
+	ci.width = m_r.m_swapchain_extent_mip.width;
+	ci.height = m_r.m_swapchain_extent_mip.height;
+	ci.layers = 1;
+	return m_r.device.createFramebuffer(ci);
+}
+
+vector<Vk::ImageView> Renderer::Frame::createDepthAccViews(void)
+{
+	size_t acc_sets = m_r.m_swapchain_mip_levels - 1;
+	auto res = vector<Vk::ImageView>(acc_sets);
+	for (size_t i = 0; i < acc_sets; i++)
+		res[i] = m_r.createImageViewMip(m_depth_pyramid, VK_IMAGE_VIEW_TYPE_2D, format_depth_pyramid, Vk::ImageAspect::ColorBit, i + 1, 1);
+	return res;
+}
+
+vector<Vk::Framebuffer> Renderer::Frame::createDepthAccFbs(void)
+{
+	size_t acc_sets = m_r.m_swapchain_mip_levels - 1;
+	auto res = vector<Vk::Framebuffer>(acc_sets);
+	for (size_t i = 0; i < acc_sets; i++) {
+		VkFramebufferCreateInfo ci{};
+		ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		ci.renderPass = m_r.m_depth_resolve_pass;
+		VkImageView atts[] {
+			m_depth_acc_views[i]
+		};
+		ci.attachmentCount = array_size(atts);
+		ci.pAttachments = atts;
+		auto &cext = m_r.m_swapchain_extent_mips[i + 1];
+		ci.width = cext.width;
+		ci.height = cext.height;
+		ci.layers = 1;
+		res[i] = m_r.device.createFramebuffer(ci);
+	}
+	return res;
+}
+
+vector<VkDescriptorSet> Renderer::Frame::createDepthAccSets(const VkDescriptorSet *pDescriptorSetsMip)
+{
+	size_t acc_sets = m_r.m_swapchain_mip_levels - 1;
+	auto res = vector<VkDescriptorSet>(acc_sets);
+	std::memcpy(res.data(), pDescriptorSetsMip, acc_sets * sizeof(VkDescriptorSet));
+	return res;
+}
+
+Renderer::IllumTechnique::Data::Sspt::Fbs Renderer::Frame::createIllumSsgiFbs(VkDescriptorSet descriptorSetColorResolve)
 {
 	IllumTechnique::Data::Sspt::Fbs res;
 	if (m_r.m_illum_technique != IllumTechnique::Sspt)
@@ -4589,17 +4830,6 @@ Renderer::IllumTechnique::Data::Sspt::Fbs Renderer::Frame::createIllumSsgiFbs(Vk
 		res.m_color_resolve_set = descriptorSetColorResolve;
 	}
 
-	res.m_depth_view = createFbImageMip(VK_FORMAT_R32_SFLOAT, Vk::ImageAspect::ColorBit,
-		Vk::ImageUsage::ColorAttachmentBit | Vk::ImageUsage::SampledBit | Vk::ImageUsage::TransferDst, &res.m_depth);
-	res.m_depth_first_mip_view = m_r.createImageViewMip(res.m_depth, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, Vk::ImageAspect::ColorBit,
-		0, 1);
-
-	res.m_depth_resolve_fb = res.createDepthResolveFb(m_r);
-	res.m_depth_resolve_set = descriptorSetDepthResolve;
-	res.m_depth_acc_views = res.createDepthAccViews(m_r);
-	res.m_depth_acc_fbs = res.createDepthAccFbs(m_r);
-	res.m_depth_acc_sets = res.createDepthAccSets(m_r, pDescriptorSetsMip);
-
 	res.m_step_view = createFbImage(VK_FORMAT_R8_SINT, Vk::ImageAspect::ColorBit,
 		Vk::ImageUsage::ColorAttachmentBit | Vk::ImageUsage::SampledBit | Vk::ImageUsage::TransferDst, &res.m_step);
 	res.m_acc_path_pos_view = createFbImage(VK_FORMAT_R16G16B16A16_UINT, Vk::ImageAspect::ColorBit,
@@ -4632,69 +4862,8 @@ Vk::Framebuffer Renderer::IllumTechnique::Data::Sspt::Fbs::createColorResolveFb(
 	return r.device.createFramebuffer(ci);
 }
 
-Vk::Framebuffer Renderer::IllumTechnique::Data::Sspt::Fbs::createDepthResolveFb(Renderer &r)
-{
-	VkFramebufferCreateInfo ci{};
-	ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	ci.renderPass = r.m_depth_resolve_pass;
-	VkImageView atts[] {
-		m_depth_first_mip_view
-	};
-	ci.attachmentCount = array_size(atts);
-	ci.pAttachments = atts;
-	ci.width = r.m_swapchain_extent_mip.width;
-	ci.height = r.m_swapchain_extent_mip.height;
-	ci.layers = 1;
-	return r.device.createFramebuffer(ci);
-}
-
-vector<Vk::ImageView> Renderer::IllumTechnique::Data::Sspt::Fbs::createDepthAccViews(Renderer &r)
-{
-	size_t acc_sets = r.m_swapchain_mip_levels - 1;
-	auto res = vector<Vk::ImageView>(acc_sets);
-	for (size_t i = 0; i < acc_sets; i++)
-		res[i] = r.createImageViewMip(m_depth, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, Vk::ImageAspect::ColorBit, i + 1, 1);
-	return res;
-}
-
-vector<Vk::Framebuffer> Renderer::IllumTechnique::Data::Sspt::Fbs::createDepthAccFbs(Renderer &r)
-{
-	size_t acc_sets = r.m_swapchain_mip_levels - 1;
-	auto res = vector<Vk::Framebuffer>(acc_sets);
-	for (size_t i = 0; i < acc_sets; i++) {
-		VkFramebufferCreateInfo ci{};
-		ci.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		ci.renderPass = r.m_depth_resolve_pass;
-		VkImageView atts[] {
-			m_depth_acc_views[i]
-		};
-		ci.attachmentCount = array_size(atts);
-		ci.pAttachments = atts;
-		auto &cext = r.m_swapchain_extent_mips[i + 1];
-		ci.width = cext.width;
-		ci.height = cext.height;
-		ci.layers = 1;
-		res[i] = r.device.createFramebuffer(ci);
-	}
-	return res;
-}
-
-vector<VkDescriptorSet> Renderer::IllumTechnique::Data::Sspt::Fbs::createDepthAccSets(Renderer &r, const VkDescriptorSet *pDescriptorSetsMip)
-{
-	size_t acc_sets = r.m_swapchain_mip_levels - 1;
-	auto res = vector<VkDescriptorSet>(acc_sets);
-	std::memcpy(res.data(), pDescriptorSetsMip, acc_sets * sizeof(VkDescriptorSet));
-	return res;
-}
-
 void Renderer::IllumTechnique::Data::Sspt::Fbs::destroy(Renderer &r)
 {
-	r.device.destroy(m_depth_resolve_fb);
-	for (auto v : m_depth_acc_views)
-		r.device.destroy(v);
-	for (auto f : m_depth_acc_fbs)
-		r.device.destroy(f);
-
 	r.device.destroy(m_path_incidence_view);
 	r.allocator.destroy(m_path_incidence);
 	r.device.destroy(m_path_direct_light_view);
@@ -4708,10 +4877,6 @@ void Renderer::IllumTechnique::Data::Sspt::Fbs::destroy(Renderer &r)
 	r.device.destroy(m_step_view);
 	r.allocator.destroy(m_step);
 
-	r.device.destroy(m_depth_first_mip_view);
-	r.device.destroy(m_depth_view);
-	r.allocator.destroy(m_depth);
-
 	if (r.m_sample_count > VK_SAMPLE_COUNT_1_BIT) {
 		r.device.destroy(m_color_resolve_fb);
 
@@ -4756,6 +4921,7 @@ Renderer::IllumTechnique::Data::RayTracing::Shared Renderer::createIllumRayTraci
 		.size = sizeof(rgen),
 		.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
 	};
+	loadSharing(raygen_bci);
 	res.m_sbt_raygen_buffer = allocator.createBuffer(raygen_bci, aci);
 	loadBuffer(res.m_sbt_raygen_buffer, sizeof(rgen), rgen);
 
@@ -4763,6 +4929,7 @@ Renderer::IllumTechnique::Data::RayTracing::Shared Renderer::createIllumRayTraci
 		.size = sizeof(rmiss),
 		.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
 	};
+	loadSharing(miss_bci);
 	res.m_sbt_miss_buffer = allocator.createBuffer(miss_bci, aci);
 	loadBuffer(res.m_sbt_miss_buffer, sizeof(rmiss), rmiss);
 
@@ -4770,6 +4937,7 @@ Renderer::IllumTechnique::Data::RayTracing::Shared Renderer::createIllumRayTraci
 		.size = sizeof(rhit),
 		.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR
 	};
+	loadSharing(hit_bci);
 	res.m_sbt_hit_buffer = allocator.createBuffer(hit_bci, aci);
 	loadBuffer(res.m_sbt_hit_buffer, sizeof(rhit), rhit);
 
@@ -5480,7 +5648,9 @@ Renderer::Frame::Frame(Renderer &r, size_t i, Vk::CommandBuffer cmdGtransfer, Vk
 	VkDescriptorSet descriptorSetIllum, VkDescriptorSet descriptorSetRayTracingRes,
 	VkDescriptorSet descriptorSetWsi,
 	const VkDescriptorSet *pDescriptorSetsMip,
-	Vk::BufferAllocation dynBuffer) :
+	Vk::BufferAllocation dynBuffer, size_t dynBufferCapacity,
+	Vk::BufferAllocation cullBuffer, uint32_t cullDrawCapacity, uint32_t cullInstanceCapacity,
+	Vk::BufferAllocation materialBuffer) :
 	m_r(r),
 	m_i(i),
 	m_cmd_gtransfer(cmdGtransfer),
@@ -5495,8 +5665,13 @@ Renderer::Frame::Frame(Renderer &r, size_t i, Vk::CommandBuffer cmdGtransfer, Vk
 	m_trace_rays_done(r.device.createSemaphore()),
 	m_descriptor_set_0(descriptorSet0),
 	m_descriptor_set_dynamic(descriptorSetDynamic),
-	m_dyn_buffer_staging(createDynBufferStaging()),
+	m_dyn_buffer_capacity(dynBufferCapacity),
 	m_dyn_buffer(dynBuffer),
+	m_dyn_buffer_staging(createDynBufferStaging()),
+	m_cull_draw_capacity(cullDrawCapacity),
+	m_cull_instance_capacity(cullInstanceCapacity),
+	m_cull_buffer(cullBuffer),
+	m_material_buffer(materialBuffer),
 	m_depth_buffer_view(createFbImageMs(m_r.format_depth, Vk::ImageAspect::DepthBit,
 		Vk::ImageUsage::DepthStencilAttachmentBit | Vk::ImageUsage::SampledBit, &m_depth_buffer)),
 	m_cdepth_view(createFbImageMs(VK_FORMAT_R32_SFLOAT, Vk::ImageAspect::ColorBit,
@@ -5509,7 +5684,16 @@ Renderer::Frame::Frame(Renderer &r, size_t i, Vk::CommandBuffer cmdGtransfer, Vk
 		Vk::ImageUsage::ColorAttachmentBit | Vk::ImageUsage::SampledBit | Vk::ImageUsage::TransferDst, &m_normal)),
 	m_normal_geom_view(createFbImageMs(VK_FORMAT_R16G16B16A16_SFLOAT, Vk::ImageAspect::ColorBit,
 		Vk::ImageUsage::ColorAttachmentBit | Vk::ImageUsage::SampledBit | Vk::ImageUsage::TransferDst, &m_normal_geom)),
-	m_illum_ssgi_fbs(createIllumSsgiFbs(descriptorSetColorResolve, descriptorSetDepthResolve, pDescriptorSetsMip)),
+	m_depth_pyramid_view(createFbImageMip(format_depth_pyramid, Vk::ImageAspect::ColorBit,
+		Vk::ImageUsage::ColorAttachmentBit | Vk::ImageUsage::SampledBit | Vk::ImageUsage::TransferDst, &m_depth_pyramid)),
+	m_depth_pyramid_first_mip_view(m_r.createImageViewMip(m_depth_pyramid, VK_IMAGE_VIEW_TYPE_2D, format_depth_pyramid, Vk::ImageAspect::ColorBit,
+		0, 1)),
+	m_depth_resolve_fb(createDepthResolveFb()),
+	m_depth_resolve_set(descriptorSetDepthResolve),
+	m_depth_acc_views(createDepthAccViews()),
+	m_depth_acc_fbs(createDepthAccFbs()),
+	m_depth_acc_sets(createDepthAccSets(pDescriptorSetsMip)),
+	m_illum_ssgi_fbs(createIllumSsgiFbs(descriptorSetColorResolve)),
 	m_illum_rt(createIllumRtFbs(descriptorSetRayTracingRes)),
 	m_illum_rtpt(createIllumRtptFbs()),
 	m_illum_rtdp(createIllumRtdpFbs()),
@@ -5547,6 +5731,20 @@ void Renderer::Frame::destroy(bool with_ext_res)
 	m_r.device.destroy(m_output_view);
 	m_r.allocator.destroy(m_output);
 
+	for (auto &r : m_recorders)
+		m_r.device.destroy(r.pool);
+	m_recorders.resize(0);
+	m_recorder_count = 0;
+
+	for (auto f : m_depth_acc_fbs)
+		m_r.device.destroy(f);
+	for (auto v : m_depth_acc_views)
+		m_r.device.destroy(v);
+	m_r.device.destroy(m_depth_resolve_fb);
+	m_r.device.destroy(m_depth_pyramid_first_mip_view);
+	m_r.device.destroy(m_depth_pyramid_view);
+	m_r.allocator.destroy(m_depth_pyramid);
+
 	m_r.device.destroy(m_normal_geom_view);
 	m_r.allocator.destroy(m_normal_geom);
 	m_r.device.destroy(m_normal_view);
@@ -5558,9 +5756,15 @@ void Renderer::Frame::destroy(bool with_ext_res)
 	m_r.device.destroy(m_depth_buffer_view);
 	m_r.allocator.destroy(m_depth_buffer);
 
-	if (with_ext_res)
+	if (with_ext_res) {
+		m_r.allocator.destroy(m_material_buffer);
+		m_r.allocator.destroy(m_cull_buffer);
 		m_r.allocator.destroy(m_dyn_buffer);
-	m_r.allocator.destroy(m_dyn_buffer_staging);
+	}
+	if (!m_r.m_dyn_direct)
+		m_r.allocator.destroy(m_dyn_buffer_staging);
+	if (m_instance_capacity > 0)
+		m_r.allocator.destroy(m_instance_buffer);
 
 	m_r.device.destroy(m_trace_rays_done);
 	m_r.device.destroy(m_render_pass_done);
@@ -5580,12 +5784,20 @@ void Renderer::Frame::reset(void)
 void Renderer::Frame::render(Map &map, const Camera &camera)
 {
 	auto &sex = m_r.m_swapchain_extent;
-	auto &sex_mip = m_r.m_swapchain_extent_mip;
 
 	uint32_t swapchain_index;
 	vkAssert(Vk::ext.vkAcquireNextImageKHR(m_r.device, m_r.m_swapchain, ~0ULL, m_image_ready, VK_NULL_HANDLE, &swapchain_index));
 
+	// loads recorded since the last frame go ahead of it, only the ones whose copies are done land so the frame never waits on them
+	// ray tracing may read any of them, it waits for their copies instead
+	if (m_r.needsAccStructure())
+		m_r.m_upload.flush();
+	else
+		m_r.m_upload.poll();
+	m_r.m_cupload.submit();
+
 	m_dyn_buffer_size = 0;
+	m_dyn_buffer_locked = false;
 	m_cmd_gtransfer.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 	{
 		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::HostWriteBit, Vk::Access::TransferReadBit };
@@ -5616,6 +5828,17 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 		m_cmd_grender_pass.setExtent(m_r.m_swapchain_extent);
 		m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_pipeline_layout_descriptor_set,
 			0, 1, &m_descriptor_set_0, 0, nullptr);
+		// Two-phase occlusion culling: draw what was visible last frame, build the depth pyramid from it,
+		// then draw what the pyramid does not hide and was not drawn yet
+		instance_upload(map, OpaqueRender::id);
+		material_upload();
+		cull_subset(map, OpaqueRender::id, camera);
+		if (m_instance_copies.size() > 0)
+			m_cmd_gtransfer.copyBuffer(dynHostBuffer(), m_instance_buffer, static_cast<uint32_t>(m_instance_copies.size()), m_instance_copies.data());
+		if (m_material_copy.size > 0)
+			m_cmd_gtransfer.copyBuffer(dynHostBuffer(), m_material_buffer, 1, &m_material_copy);
+		record_subset(map.pool());
+		cull_dispatch(0);
 		{
 			VkRenderPassBeginInfo bi{};
 			bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -5632,10 +5855,27 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 			};
 			bi.clearValueCount = array_size(cvs);
 			bi.pClearValues = cvs;
-			m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_INLINE);
+			m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		}
+		render_subset(0);
+		m_cmd_grender_pass.endRenderPass();
+
+		buildDepthPyramid();
+		cull_dispatch(1);
+		{
+			VkRenderPassBeginInfo bi{};
+			bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			bi.renderPass = m_r.m_opaque_load_pass;
+			bi.framebuffer = m_opaque_fb;
+			bi.renderArea = VkRect2D{{0, 0}, sex};
+			m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 		}
-		render_subset(map, OpaqueRender::id);
+		render_subset(1);
 		m_cmd_grender_pass.endRenderPass();
+		// state is undefined after executing secondaries
+		m_cmd_grender_pass.setExtent(m_r.m_swapchain_extent);
+		m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_pipeline_layout_descriptor_set,
+			0, 1, &m_descriptor_set_0, 0, nullptr);
 
 		Illumination illum;
 		illum.cam_proj = camera.proj;
@@ -5702,53 +5942,7 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 					m_cmd_grender_pass.endRenderPass();
 				}
 
-				m_cmd_grender_pass.setExtent(sex_mip);
-				{
-					VkRenderPassBeginInfo bi{};
-					bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-					bi.renderPass = m_r.m_depth_resolve_pass;
-					bi.framebuffer = m_illum_ssgi_fbs.m_depth_resolve_fb;
-					bi.renderArea = VkRect2D{{0, 0}, sex_mip};
-					m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_INLINE);
-				}
-				m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_resolve_pipeline);
-				m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_resolve_pipeline.pipelineLayout,
-					0, 1, &m_illum_ssgi_fbs.m_depth_resolve_set, 0, nullptr);
-				m_cmd_grender_pass.bindVertexBuffer(0, m_r.m_screen_vertex_buffer, 0);
-				m_cmd_grender_pass.draw(3, 1, 0, 0);
-				m_cmd_grender_pass.endRenderPass();
-
-				m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_acc_pipeline);
-				m_cmd_grender_pass.bindVertexBuffer(0, m_r.m_screen_vertex_buffer, 0);
-				for (uint32_t i = 0; i < m_illum_ssgi_fbs.m_depth_acc_fbs.size(); i++) {
-					{
-						VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ColorAttachmentWriteBit, Vk::Access::ShaderReadBit };
-						m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ColorAttachmentOutputBit, Vk::PipelineStage::FragmentShaderBit, 0,
-							1, &barrier, 0, nullptr, 0, nullptr);
-					}
-
-					auto &cur_ex = m_r.m_swapchain_extent_mips[i + 1];
-					m_cmd_grender_pass.setExtent(cur_ex);
-					{
-						VkRenderPassBeginInfo bi{};
-						bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-						bi.renderPass = m_r.m_depth_resolve_pass;
-						bi.framebuffer = m_illum_ssgi_fbs.m_depth_acc_fbs[i];
-						bi.renderArea = VkRect2D{{0, 0}, cur_ex};
-						m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_INLINE);
-					}
-					m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_acc_pipeline.pipelineLayout,
-						0, 1, &m_illum_ssgi_fbs.m_depth_acc_sets[i], 0, nullptr);
-					m_cmd_grender_pass.draw(3, 1, 0, 0);
-					m_cmd_grender_pass.endRenderPass();
-				}
-
-				{
-					VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ColorAttachmentWriteBit, Vk::Access::ShaderReadBit };
-					m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ColorAttachmentOutputBit, Vk::PipelineStage::FragmentShaderBit, 0,
-						1, &barrier, 0, nullptr, 0, nullptr);
-				}
-				m_cmd_grender_pass.setExtent(m_r.m_swapchain_extent);
+				buildDepthPyramid();
 			}
 
 			{
@@ -5761,12 +5955,12 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 			}
 			m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_illumination_pipeline);
 			{
-				*reinterpret_cast<Illumination*>(reinterpret_cast<uint8_t*>(m_dyn_buffer_staging_ptr) + m_dyn_buffer_size) = illum;
+				size_t off = dynAlloc(sizeof(Illumination));
+				*reinterpret_cast<Illumination*>(reinterpret_cast<uint8_t*>(m_dyn_buffer_ptr) + off) = illum;
 				{
-					VkBufferCopy region {m_dyn_buffer_size, 0, sizeof(Illumination)};
-					m_cmd_gtransfer.copyBuffer(m_dyn_buffer_staging, m_illumination_buffer, 1, &region);
+					VkBufferCopy region {off, 0, sizeof(Illumination)};
+					m_cmd_gtransfer.copyBuffer(dynHostBuffer(), m_illumination_buffer, 1, &region);
 				}
-				m_dyn_buffer_size += sizeof(Illumination);
 			}
 			m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_illumination_pipeline.pipelineLayout,
 				0, 1, &m_illumination_set, 0, nullptr);
@@ -5783,19 +5977,28 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 		m_cmd_gwsi.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
 		if (m_r.needsAccStructure()) {
 			uint32_t instance_count = 0;
+			vector<std::pair<Brush*, uint32_t>> instance_bases;
 			map.query<RT_instance>([&](Brush &b){
+				instance_bases.emplace(&b, instance_count);
 				instance_count += b.size();
 			});
 			size_t instance_size = static_cast<size_t>(instance_count) * sizeof(VkAccelerationStructureInstanceKHR);
 			size_t custom_instance_size = static_cast<size_t>(instance_count) * sizeof(CustomInstance);
 			vector<VkAccelerationStructureInstanceKHR> instances(instance_count);
 			vector<CustomInstance> custom_instances(instance_count);
-			uint32_t instance_offset = 0;
-			map.query<RT_instance>([&](Brush &b){
-				auto t = b.get<Transform>();
-				auto mv_normal = b.get<MV_normal>();
-				auto rt_i = b.get<RT_instance>();
-				for (size_t i = 0; i < b.size(); i++) {
+			map.query_par<RT_instance>([&](Brush &b, Brush::Chunk &c){
+				uint32_t instance_offset = 0;
+				for (auto &base : instance_bases)
+					if (base.first == &b) {
+						instance_offset = base.second;
+						break;
+					}
+				instance_offset += c.base();
+				auto size = c.size();
+				auto t = c.get<Transform>();
+				auto mv_normal = c.get<MV_normal>();
+				auto rt_i = c.get<RT_instance>();
+				for (size_t i = 0; i < size; i++) {
 					auto &ins = instances[instance_offset + i];
 					auto &ct = t[i];
 					auto &cmv_normal = mv_normal[i];
@@ -5812,7 +6015,6 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 					custom_instances[instance_offset + i].model = crt_i.model;
 					custom_instances[instance_offset + i].material = crt_i.material;
 				}
-				instance_offset += b.size();
 			});
 
 			VkAccelerationStructureBuildGeometryInfoKHR bi{};
@@ -6261,16 +6463,18 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 	}
 
 	{
-		m_r.allocator.flushAllocation(m_dyn_buffer_staging, 0, m_dyn_buffer_size);
-		{
+		if (m_r.m_dyn_direct)
+			m_r.allocator.flushAllocation(m_dyn_buffer, 0, m_dyn_buffer_size);
+		else {
+			m_r.allocator.flushAllocation(m_dyn_buffer_staging, 0, m_dyn_buffer_size);
 			VkBufferCopy region {0, 0, m_dyn_buffer_size};
 			if (region.size > 0)
 				m_cmd_gtransfer.copyBuffer(m_dyn_buffer_staging, m_dyn_buffer, 1, &region);
 		}
 	}
 	{
-		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::MemoryReadBit };
-		m_cmd_gtransfer.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::AllGraphicsBit, 0,
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::MemoryReadBit | Vk::Access::ShaderWriteBit };
+		m_cmd_gtransfer.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::AllGraphicsBit | Vk::PipelineStage::ComputeShaderBit, 0,
 			1, &barrier, 0, nullptr, 0, nullptr);
 	}
 	m_cmd_gtransfer.end();
@@ -6301,9 +6505,17 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 			m_cmd_ctransfer
 		};
 		VkPipelineStageFlags cwait_stage = Vk::PipelineStage::RayTracingShaderBitKhr;
+		// ray tracing reads geometry, textures and binding tables landed on the graphics queue
+		uint64_t upload_value = m_r.m_upload.ticket();
+		VkTimelineSemaphoreSubmitInfoKHR upload_ti{};
+		upload_ti.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		upload_ti.waitSemaphoreValueCount = 1;
+		upload_ti.pWaitSemaphoreValues = &upload_value;
+		VkSemaphore upload_sem = m_r.m_upload.timeline();
+		VkPipelineStageFlags upload_stage = Vk::PipelineStage::AllCommandsBit;
 		VkSubmitInfo csi0[] {
-			{VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr,
-				0, nullptr, nullptr,
+			{VK_STRUCTURE_TYPE_SUBMIT_INFO, &upload_ti,
+				1, &upload_sem, &upload_stage,
 				array_size(ccmds0), ccmds0,
 				0, nullptr}
 		};
@@ -6374,64 +6586,532 @@ void Renderer::Frame::render(Map &map, const Camera &camera)
 	m_ever_submitted = true;
 }
 
-void Renderer::Frame::render_subset(Map &map, cmp_id render_id)
+// Resolves cdepth into the first level of the pyramid then reduces each level into the next one, leaves the extent to the swapchain's
+void Renderer::Frame::buildDepthPyramid(void)
 {
-	Render cur{nullptr, nullptr, nullptr};
-	size_t streak = 0;
-	auto comps = sarray<cmp_id, 1>();
-	comps.data()[0] = render_id;
+	auto &sex_mip = m_r.m_swapchain_extent_mip;
 
+	// cdepth was just written, and the pyramid may still be read by the cull pass
+	{
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ColorAttachmentWriteBit, Vk::Access::ShaderReadBit };
+		m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ColorAttachmentOutputBit | Vk::PipelineStage::ComputeShaderBit,
+			Vk::PipelineStage::FragmentShaderBit, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	m_cmd_grender_pass.setExtent(sex_mip);
+	{
+		VkRenderPassBeginInfo bi{};
+		bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		bi.renderPass = m_r.m_depth_resolve_pass;
+		bi.framebuffer = m_depth_resolve_fb;
+		bi.renderArea = VkRect2D{{0, 0}, sex_mip};
+		m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_INLINE);
+	}
+	m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_resolve_pipeline);
+	m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_resolve_pipeline.pipelineLayout,
+		0, 1, &m_depth_resolve_set, 0, nullptr);
+	m_cmd_grender_pass.bindVertexBuffer(0, m_r.m_screen_vertex_buffer, 0);
+	m_cmd_grender_pass.draw(3, 1, 0, 0);
+	m_cmd_grender_pass.endRenderPass();
+
+	m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_acc_pipeline);
+	m_cmd_grender_pass.bindVertexBuffer(0, m_r.m_screen_vertex_buffer, 0);
+	for (uint32_t i = 0; i < m_depth_acc_fbs.size(); i++) {
+		{
+			VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ColorAttachmentWriteBit, Vk::Access::ShaderReadBit };
+			m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ColorAttachmentOutputBit, Vk::PipelineStage::FragmentShaderBit, 0,
+				1, &barrier, 0, nullptr, 0, nullptr);
+		}
+
+		auto &cur_ex = m_r.m_swapchain_extent_mips[i + 1];
+		m_cmd_grender_pass.setExtent(cur_ex);
+		{
+			VkRenderPassBeginInfo bi{};
+			bi.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			bi.renderPass = m_r.m_depth_resolve_pass;
+			bi.framebuffer = m_depth_acc_fbs[i];
+			bi.renderArea = VkRect2D{{0, 0}, cur_ex};
+			m_cmd_grender_pass.beginRenderPass(bi, VK_SUBPASS_CONTENTS_INLINE);
+		}
+		m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_depth_acc_pipeline.pipelineLayout,
+			0, 1, &m_depth_acc_sets[i], 0, nullptr);
+		m_cmd_grender_pass.draw(3, 1, 0, 0);
+		m_cmd_grender_pass.endRenderPass();
+	}
+
+	{
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ColorAttachmentWriteBit, Vk::Access::ShaderReadBit };
+		m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ColorAttachmentOutputBit,
+			Vk::PipelineStage::FragmentShaderBit | Vk::PipelineStage::ComputeShaderBit, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	m_cmd_grender_pass.setExtent(m_r.m_swapchain_extent);
+}
+
+// Packs what a draw binds, the costliest state change in the highest bits so the draws sharing it follow each other
+// Depth is left out: the two culling phases already reject most overdraw, and it would split draws and re-sort on every camera move
+uint64_t Renderer::Frame::renderKey(const Render &render) const
+{
+	uint64_t pipeline = static_cast<uint64_t>(render.pipeline - m_r.m_pipeline_pool.data);
+	uint64_t material = static_cast<uint64_t>(render.material - m_r.m_material_pool.data);
+	uint64_t model = static_cast<uint64_t>(render.model - m_r.m_model_pool.data);
+	return pipeline << 48 | material << 32 | model;
+}
+
+// One draw per unique render key, its instances are listed after each other from its first one
+void Renderer::Frame::sort_draws(cmp_id render_id, size_t count)
+{
+	m_render_keys.resize(count);
+	m_render_keys_tmp.resize(count);
+	m_inst_draws.resize(count);
+	for (auto &cc : m_cull_chunks) {
+		auto r = cc.chunk->get<Render>(render_id);
+		for (uint32_t i = 0; i < cc.size; i++)
+			m_render_keys[cc.inst + i] = RenderKey{renderKey(r[i]), &r[i], cc.inst + i};
+	}
+	radixSort(m_render_keys.data(), m_render_keys_tmp.data(), count);
+
+	m_draws.resize(0);
+	for (size_t i = 0; i < count; i++) {
+		auto &k = m_render_keys[i];
+		if (i == 0 || k.key != m_render_keys[i - 1].key)
+			m_draws.emplace(Draw{*k.render, 0, static_cast<uint32_t>(i)});
+		m_inst_draws[k.inst] = static_cast<uint32_t>(m_draws.size() - 1);
+	}
+}
+
+// One draw per unique render key, reading the persistent instance dynamics
+// The cull pass then tests instance spheres against the frustum and appends visible ones to their draw, once per phase
+void Renderer::Frame::cull_subset(Map &map, cmp_id render_id, const Camera &camera)
+{
+	auto comps = sarray<cmp_id, 2>();
+	comps.data()[0] = Id::id;
+	comps.data()[1] = render_id;
+	m_cull_count = 0;
+
+	// chunks first, so each upload task gets its own range of instances
+	// the same chunks at the same instances with untouched renders keep last sort's draws
+	auto since = m_render_since;
+	m_render_since = map.tick();
+	bool changed = false;
+	size_t chunk_count = 0;
+	uint32_t inst = 0;
 	map.query(comps, [&](Brush &b){
-		auto r = b.get<Render>(render_id);
-		auto size = b.size();
-		for (size_t i = 0; i < size; i++) {
-			auto &n = r[i];
-			if (n != cur) {
-				if (streak > 0) {
-					if (cur.model->indexType == VK_INDEX_TYPE_NONE_KHR)
-						m_cmd_grender_pass.draw(cur.model->primitiveCount, streak, 0, 0);
-					else
-						m_cmd_grender_pass.drawIndexed(cur.model->primitiveCount, streak, 0, 0, 0);
-					streak = 0;
-				}
+		for (auto &c : b.chunks()) {
+			if (c.size() == 0)
+				continue;
+			CullChunk cc{&c, inst, static_cast<uint32_t>(c.size())};
+			if (chunk_count < m_cull_chunks.size()) {
+				auto &o = m_cull_chunks[chunk_count];
+				if (o.chunk != cc.chunk || o.inst != cc.inst || o.size != cc.size)
+					changed = true;
+				o = cc;
+			} else {
+				m_cull_chunks.emplace(cc);
+				changed = true;
+			}
+			if (c.version(render_id) > since)
+				changed = true;
+			chunk_count++;
+			inst += cc.size;
+		}
+	});
+	if (chunk_count != m_cull_chunks.size())
+		changed = true;
+	m_cull_chunks.resize(chunk_count);
+	size_t count = inst;
+	if (count == 0) {
+		m_draws.resize(0);
+		return;
+	}
+	if (changed)
+		sort_draws(render_id, count);
+	cullReserve(m_draws.size(), count);
+	// regions move when the instance buffer is laid out again
+	for (auto &d : m_draws)
+		d.dyn_offset = instanceRegion(dynStride(*d.render.pipeline));
+
+	// the whole layout is reserved first, so the dynamic buffer grows at most once
+	{
+		auto align = m_r.m_limits.minStorageBufferOffsetAlignment;
+		size_t total = sizeof(Cull) + count * sizeof(CullInstance);
+		total = (total + align - 1) / align * align + cull_phase_count * m_draws.size() * cull_draw_stride;
+		dynReserve(total);
+	}
+	auto staging = reinterpret_cast<uint8_t*>(m_dyn_buffer_ptr);
+	m_cull_offset = static_cast<uint32_t>(dynAlloc(sizeof(Cull) + count * sizeof(CullInstance)));
+	auto &cull = *reinterpret_cast<Cull*>(staging + m_cull_offset);
+	auto instances = reinterpret_cast<CullInstance*>(staging + m_cull_offset + sizeof(Cull));
+
+	struct Ctx {
+		Frame &f;
+		CullInstance *instances;
+	} ctx{*this, instances};
+	vector<ThreadPool::Task> tasks;
+	for (size_t i = 0; i < m_cull_chunks.size();) {
+		size_t end = i + 1;
+		size_t rows = m_cull_chunks[i].size;
+		while (end < m_cull_chunks.size() && rows < Map::par_grain)
+			rows += m_cull_chunks[end++].size;
+		tasks.emplace(ThreadPool::Task{[](void *data, void*, size_t begin, size_t end){
+			auto &ctx = *reinterpret_cast<Ctx*>(data);
+			for (size_t i = begin; i < end; i++)
+				ctx.f.cull_upload(ctx.f.m_cull_chunks[i], ctx.instances);
+		}, &ctx, nullptr, i, end});
+		i = end;
+	}
+	map.pool().run(tasks.data(), tasks.size());
+
+	auto frustum = Frustum::fromMatrix(camera.proj * camera.view);
+	for (size_t i = 0; i < 6; i++)
+		for (size_t j = 0; j < 4; j++)
+			cull.planes[i][j] = static_cast<float>(frustum.planes[i][j]);
+	cull.vp = camera.proj * camera.view;
+	cull.extent = glm::vec2(m_r.m_swapchain_extent.width, m_r.m_swapchain_extent.height);
+	cull.count = static_cast<uint32_t>(count);
+	cull.levels = m_r.m_swapchain_mip_levels;
+	m_cull_count = cull.count;
+
+	// draws start with no instance, the cull pass counts them in, the second phase lists its instances past the first one's
+	size_t draws_offset = dynAlloc(cull_phase_count * m_draws.size() * cull_draw_stride);
+	for (size_t p = 0; p < cull_phase_count; p++)
+		for (size_t i = 0; i < m_draws.size(); i++) {
+			auto cmd = reinterpret_cast<uint32_t*>(staging + draws_offset + (p * m_draws.size() + i) * cull_draw_stride);
+			auto &model = *m_draws[i].render.model;
+			for (size_t j = 0; j < cull_draw_stride / sizeof(uint32_t); j++)
+				cmd[j] = 0;
+			cmd[0] = model.primitiveCount;
+			uint32_t first_instance = m_draws[i].first + static_cast<uint32_t>(p * m_cull_instance_capacity);
+			// models share buffers, they start at their own vertex and index
+			if (model.indexType == VK_INDEX_TYPE_NONE_KHR) {
+				cmd[2] = model.firstVertex;
+				cmd[3] = first_instance;
+			} else {
+				cmd[2] = model.firstIndex;
+				cmd[3] = model.firstVertex;
+				cmd[4] = first_instance;
+			}
+		}
+	{
+		VkBufferCopy regions[cull_phase_count];
+		for (size_t p = 0; p < cull_phase_count; p++)
+			regions[p] = VkBufferCopy{draws_offset + p * m_draws.size() * cull_draw_stride, p * m_cull_draw_capacity * cull_draw_stride,
+				m_draws.size() * cull_draw_stride};
+		m_cmd_gtransfer.copyBuffer(dynHostBuffer(), m_cull_buffer, array_size(regions), regions);
+	}
+}
 
-				if (n.pipeline != cur.pipeline)
-					m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, *n.pipeline);
-				if (n.material != cur.material) {
-					if (n.pipeline->pushConstantRange > 0)
-						m_cmd_grender_pass.pushConstants(m_r.m_pipeline_layout_descriptor_set, Vk::ShaderStage::FragmentBit, 0, n.pipeline->pushConstantRange, n.material);
-				}
-				if (n.model != cur.model) {
-					m_cmd_grender_pass.bindVertexBuffer(0, n.model->vertexBuffer, 0);
-					if (n.model->indexType != VK_INDEX_TYPE_NONE_KHR)
-						m_cmd_grender_pass.bindIndexBuffer(n.model->indexBuffer, 0, n.model->indexType);
+uint32_t Renderer::Frame::dynStride(const Pipeline &pipeline)
+{
+	uint32_t res = 0;
+	for (size_t i = 0; i < pipeline.dynamicCount; i++)
+		res += static_cast<uint32_t>(Cmp::size[pipeline.dynamics[i]]);
+	return res;
+}
+
+uint32_t Renderer::Frame::instanceRegion(uint32_t stride) const
+{
+	for (size_t i = 0; i < m_instance_strides.size(); i++)
+		if (m_instance_strides[i] == stride)
+			return m_instance_regions[i];
+	throw std::runtime_error("No instance region for these dynamics");
+}
+
+// Reallocates the instance buffer for capacity slots per stride, its content is to be uploaded again
+void Renderer::Frame::instanceLayout(uint32_t capacity)
+{
+	if (m_instance_capacity > 0)
+		m_r.allocator.destroy(m_instance_buffer);
+	auto align = m_r.m_limits.minStorageBufferOffsetAlignment;
+	size_t size = 0;
+	m_instance_regions.resize(0);
+	for (auto &s : m_instance_strides) {
+		m_instance_regions.emplace(static_cast<uint32_t>(size));
+		size = (size + static_cast<size_t>(capacity) * s + align - 1) / align * align;
+	}
+	m_instance_capacity = capacity;
+	m_instance_buffer = m_r.createDynBuffer(max(size, static_cast<size_t>(align)), &m_instance_ptr);
+	writeDynamicBinding(0, m_instance_buffer);
+}
+
+// Chunks are sent whole, rows are scattered to their slot: in place when direct, otherwise through copies merged over consecutive slots
+// Rendered entities have an Id (see Map::brush_resolve): their slot indexes the instance dynamics and the visibility bits
+void Renderer::Frame::instance_upload(Map &map, cmp_id render_id)
+{
+	auto comps = sarray<cmp_id, 2>();
+	comps.data()[0] = Id::id;
+	comps.data()[1] = render_id;
+	m_instance_copies.resize(0);
+	auto since = m_instance_since;
+	m_instance_since = map.tick();
+
+	m_instance_chunks.resize(0);
+	uint32_t capacity = max(m_instance_capacity, instance_capacity_min);
+	bool relayout = m_instance_capacity == 0;
+	size_t staged = 0;
+	map.query(comps, [&](Brush &b){
+		for (auto &c : b.chunks()) {
+			auto r = c.get<Render>(render_id);
+			bool changed = c.version(render_id) > since;
+			const Pipeline *pip = nullptr;
+			for (size_t i = 0; i < c.size() && !changed; i++)
+				if (r[i].pipeline != pip) {
+					pip = r[i].pipeline;
+					for (size_t j = 0; j < pip->dynamicCount; j++)
+						changed = changed || c.version(pip->dynamics[j]) > since;
 				}
-				{
-					uint32_t dyn_off[] {static_cast<uint32_t>(m_dyn_buffer_size)};
-					m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_pipeline_layout_descriptor_set,
-						1, 1, &m_descriptor_set_dynamic, array_size(dyn_off), dyn_off);
+			if (!changed)
+				continue;
+
+			m_instance_chunks.emplace(&c);
+			auto ids = c.get<Id>();
+			pip = nullptr;
+			uint32_t stride = 0;
+			for (size_t i = 0; i < c.size(); i++) {
+				auto slot = Map::id_index(ids[i]);
+				if (slot >= cull_visibility_max)
+					throw std::runtime_error("Too many instances");
+				while (capacity <= slot)
+					capacity *= 2;
+				if (r[i].pipeline != pip) {
+					pip = r[i].pipeline;
+					stride = dynStride(*pip);
+					bool known = false;
+					for (auto &s : m_instance_strides)
+						known = known || s == stride;
+					if (!known) {
+						m_instance_strides.emplace(stride);
+						relayout = true;
+					}
 				}
-				cur = n;
+				staged += stride;
 			}
-
-			auto &pip = *r[i].pipeline;
-			for (size_t j = 0; j < pip.dynamicCount; j++) {
-				auto dyn = pip.dynamics[j];
+		}
+	});
+	if (relayout || capacity > m_instance_capacity) {
+		instanceLayout(capacity);
+		m_instance_since = 0;
+		instance_upload(map, render_id);
+		return;
+	}
+	if (m_instance_chunks.size() == 0)
+		return;
+
+	bool direct = m_r.m_dyn_direct;
+	size_t src = direct ? 0 : dynAlloc(staged);
+	auto staging = reinterpret_cast<uint8_t*>(m_dyn_buffer_ptr);
+	auto inst = reinterpret_cast<uint8_t*>(m_instance_ptr);
+	for (auto c : m_instance_chunks) {
+		auto r = c->get<Render>(render_id);
+		auto ids = c->get<Id>();
+		const Pipeline *pip = nullptr;
+		uint32_t stride = 0, region = 0;
+		for (size_t i = 0; i < c->size(); i++) {
+			if (r[i].pipeline != pip) {
+				pip = r[i].pipeline;
+				stride = dynStride(*pip);
+				region = instanceRegion(stride);
+			}
+			size_t dst_off = region + static_cast<size_t>(Map::id_index(ids[i])) * stride;
+			auto dst = direct ? inst + dst_off : staging + src;
+			for (size_t j = 0; j < pip->dynamicCount; j++) {
+				auto dyn = pip->dynamics[j];
 				auto size = Cmp::size[dyn];
-				std::memcpy(reinterpret_cast<uint8_t*>(m_dyn_buffer_staging_ptr) + m_dyn_buffer_size,
-					reinterpret_cast<const uint8_t*>(b.get(dyn)) + size * i, size);
-				m_dyn_buffer_size += size;
+				std::memcpy(dst, reinterpret_cast<const uint8_t*>(c->get(dyn)) + size * i, size);
+				dst += size;
 			}
-			streak++;
+			if (direct)
+				continue;
+			auto n = m_instance_copies.size();
+			if (n > 0 && m_instance_copies[n - 1].srcOffset + m_instance_copies[n - 1].size == src &&
+				m_instance_copies[n - 1].dstOffset + m_instance_copies[n - 1].size == dst_off)
+				m_instance_copies[n - 1].size += stride;
+			else
+				m_instance_copies.emplace(VkBufferCopy{src, dst_off, stride});
+			src += stride;
 		}
-	});
+	}
+	if (direct)
+		m_r.allocator.flushAllocation(m_instance_buffer, 0, VK_WHOLE_SIZE);
+}
+
+// Materials are written in place in the pool, so they are compared against the last ones sent
+void Renderer::Frame::material_upload(void)
+{
+	m_material_copy.size = 0;
+	auto &pool = m_r.m_material_pool;
+	size_t sent = m_materials.size();
+	size_t lo = pool.size;
+	size_t hi = 0;
+	for (size_t i = 0; i < pool.size; i++)
+		if (i >= sent || std::memcmp(&m_materials[i], &pool.data[i], sizeof(Material)) != 0) {
+			lo = min(lo, i);
+			hi = i + 1;
+		}
+	if (lo >= hi)
+		return;
+	m_materials.resize(pool.size);
+	size_t size = (hi - lo) * sizeof(Material);
+	std::memcpy(&m_materials[lo], &pool.data[lo], size);
+	size_t src = dynAlloc(size);
+	std::memcpy(reinterpret_cast<uint8_t*>(m_dyn_buffer_ptr) + src, &pool.data[lo], size);
+	m_material_copy = VkBufferCopy{src, lo * sizeof(Material), size};
+}
+
+// Writes the cull instances of one chunk, each row goes to the draw of its render key
+void Renderer::Frame::cull_upload(const CullChunk &cc, CullInstance *instances)
+{
+	auto &c = *cc.chunk;
+	auto trans = c.get<Transform>();
+	auto ids = c.get<Id>();
+	for (size_t i = 0; i < cc.size; i++) {
+		uint32_t draw = m_inst_draws[cc.inst + i];
+		auto &d = m_draws[draw];
+		auto &n = d.render;
+
+		auto &ci = instances[cc.inst + i];
+		auto &s = n.model->sphere;
+		for (size_t j = 0; j < 3; j++)
+			for (size_t k = 0; k < 4; k++)
+				ci.model[j][k] = trans == nullptr ? (j == k ? 1.0f : 0.0f) : static_cast<float>(trans[i][k][j]);
+		ci.sphere = trans == nullptr ? glm::vec4(0.0f, 0.0f, 0.0f, -1.0f) :
+			glm::vec4(s.center.x, s.center.y, s.center.z, s.radius);
+		// skipped by the GPU until the upload of the model landed, the frame does not wait for it
+		ci.draw = m_r.m_upload.landed(n.model->ticket) ? draw : draw_pending;
+		ci.first = d.first;
+		ci.slot = Map::id_index(ids[i]);
+		ci.material = static_cast<uint32_t>(n.material - m_r.m_material_pool.data);
+	}
+}
 
-	if (streak > 0) {
-		if (cur.model->indexType == VK_INDEX_TYPE_NONE_KHR)
-			m_cmd_grender_pass.draw(cur.model->primitiveCount, streak, 0, 0);
-		else
-			m_cmd_grender_pass.drawIndexed(cur.model->primitiveCount, streak, 0, 0, 0);
+// Phase 0 also waits on the visibility written by the previous frame, phase 1 on the depth pyramid of phase 0
+void Renderer::Frame::cull_dispatch(uint32_t phase)
+{
+	if (m_cull_count == 0)
+		return;
+	{
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ShaderWriteBit,
+			Vk::Access::ShaderReadBit | Vk::Access::ShaderWriteBit };
+		m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ComputeShaderBit, Vk::PipelineStage::ComputeShaderBit, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
 	}
+	m_cmd_grender_pass.bindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, m_r.m_cull_pipeline);
+	{
+		uint32_t dyn_off[] {0, m_cull_offset};
+		m_cmd_grender_pass.bindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE, m_r.m_cull_pipeline.pipelineLayout,
+			1, 1, &m_descriptor_set_dynamic, array_size(dyn_off), dyn_off);
+	}
+	CullPhase cp{phase, m_cull_draw_capacity, m_cull_instance_capacity};
+	m_cmd_grender_pass.pushConstants(m_r.m_cull_pipeline.pipelineLayout, Vk::ShaderStage::ComputeBit, 0, sizeof(CullPhase), &cp);
+	m_cmd_grender_pass.dispatch(divAlignUp(m_cull_count, 64), 1, 1);
+	{
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::ShaderWriteBit,
+			Vk::Access::IndirectCommandReadBit | Vk::Access::ShaderReadBit };
+		m_cmd_grender_pass.pipelineBarrier(Vk::PipelineStage::ComputeShaderBit, Vk::PipelineStage::DrawIndirectBit | Vk::PipelineStage::VertexShaderBit, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+	}
+}
+
+// Each task records a contiguous range of draws into its own secondary command buffers, one per phase
+void Renderer::Frame::record_subset(ThreadPool &pool)
+{
+	m_recorder_count = min(static_cast<uint32_t>(pool.size()), divAlignUp(static_cast<uint32_t>(m_draws.size()), record_grain));
+	if (m_recorder_count == 0)
+		return;
+	while (m_recorders.size() < m_recorder_count) {
+		Recorder rec{m_r.device.createCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+			m_r.m_queue_family_graphics), {}};
+		VkCommandBuffer cmds[cull_phase_count];
+		m_r.device.allocateCommandBuffers(rec.pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, cull_phase_count, cmds);
+		for (size_t i = 0; i < cull_phase_count; i++)
+			rec.cmds[i] = cmds[i];
+		m_recorders.emplace(rec);
+	}
+
+	ThreadPool::Task tasks[m_recorder_count];
+	for (uint32_t i = 0; i < m_recorder_count; i++)
+		tasks[i] = ThreadPool::Task{[](void *data, void*, size_t begin, size_t){
+			reinterpret_cast<Frame*>(data)->record_draws(begin);
+		}, this, nullptr, i, i + 1};
+	pool.run(tasks, m_recorder_count);
+}
+
+// Draws are issued even when the cull pass might empty them, their count then skips them on the GPU
+void Renderer::Frame::record_draws(size_t recorder)
+{
+	size_t begin = recorder * m_draws.size() / m_recorder_count;
+	size_t end = (recorder + 1) * m_draws.size() / m_recorder_count;
+	for (uint32_t phase = 0; phase < cull_phase_count; phase++) {
+		auto &cmd = m_recorders[recorder].cmds[phase];
+		{
+			VkCommandBufferInheritanceInfo ii{};
+			ii.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+			ii.renderPass = phase == 0 ? m_r.m_opaque_pass : m_r.m_opaque_load_pass;
+			ii.subpass = 0;
+			ii.framebuffer = m_opaque_fb;
+			cmd.beginSecondary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT, ii);
+		}
+		cmd.setExtent(m_r.m_swapchain_extent);
+		cmd.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_pipeline_layout_descriptor_set,
+			0, 1, &m_descriptor_set_0, 0, nullptr);
+
+		Render cur{nullptr, nullptr, nullptr};
+		VkBuffer cur_vertices = VK_NULL_HANDLE;
+		VkBuffer cur_indices = VK_NULL_HANDLE;
+		VkIndexType cur_index_type = VK_INDEX_TYPE_NONE_KHR;
+		uint32_t cur_dyn_offset = ~0U;
+		for (size_t i = begin; i < end; i++) {
+			auto &d = m_draws[i];
+			auto &n = d.render;
+			if (n.pipeline != cur.pipeline)
+				cmd.bindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, *n.pipeline);
+			// only a change of geometry block rebinds, offsets are in the draw records
+			if (n.model->vertices.buffer != cur_vertices) {
+				cur_vertices = n.model->vertices.buffer;
+				cmd.bindVertexBuffer(0, cur_vertices, 0);
+			}
+			if (n.model->indexType != VK_INDEX_TYPE_NONE_KHR &&
+				(n.model->indices.buffer != cur_indices || n.model->indexType != cur_index_type)) {
+				cur_indices = n.model->indices.buffer;
+				cur_index_type = n.model->indexType;
+				cmd.bindIndexBuffer(cur_indices, 0, cur_index_type);
+			}
+			// materials are read from the visible instances, only another instance region rebinds
+			if (d.dyn_offset != cur_dyn_offset) {
+				cur_dyn_offset = d.dyn_offset;
+				uint32_t dyn_off[] {d.dyn_offset, 0};
+				cmd.bindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, m_r.m_pipeline_layout_descriptor_set,
+					1, 1, &m_descriptor_set_dynamic, array_size(dyn_off), dyn_off);
+			}
+			cur = n;
+
+			VkDeviceSize off = (phase * m_cull_draw_capacity + i) * cull_draw_stride;
+			bool indexed = n.model->indexType != VK_INDEX_TYPE_NONE_KHR;
+			if (m_r.ext.draw_indirect_count) {
+				if (indexed)
+					cmd.drawIndexedIndirectCountKHR(m_cull_buffer, off, m_cull_buffer, off + 20, 1, cull_draw_stride);
+				else
+					cmd.drawIndirectCountKHR(m_cull_buffer, off, m_cull_buffer, off + 20, 1, cull_draw_stride);
+			} else {
+				if (indexed)
+					cmd.drawIndexedIndirect(m_cull_buffer, off, 1, cull_draw_stride);
+				else
+					cmd.drawIndirect(m_cull_buffer, off, 1, cull_draw_stride);
+			}
+		}
+		cmd.end();
+	}
+}
+
+// Within a render pass begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+void Renderer::Frame::render_subset(uint32_t phase)
+{
+	if (m_recorder_count == 0)
+		return;
+	VkCommandBuffer cmds[m_recorder_count];
+	for (uint32_t i = 0; i < m_recorder_count; i++)
+		cmds[i] = m_recorders[i].cmds[phase];
+	m_cmd_grender_pass.executeCommands(m_recorder_count, cmds);
 }
 
 }
\ No newline at end of file
@@ -4,6 +4,9 @@
 #include <condition_variable>
 #include <random>
 #include "vector.hpp"
+#include "Arena.hpp"
+#include "UploadQueue.hpp"
+#include "MeshCache.hpp"
 #include "Vk.hpp"
 #include "Map.hpp"
 #include "math.hpp"
@@ -120,17 +123,19 @@ class Renderer
 	VkSurfaceCapabilitiesKHR m_surface_capabilities;
 	uint32_t m_queue_family_graphics = ~0U;
 	uint32_t m_queue_family_compute = ~0U;
+	uint32_t m_queue_family_transfer = ~0U;	// transfer only when the device has one, graphics otherwise
 	VkPhysicalDevice m_physical_device;
+	bool m_dyn_direct = false;	// a large device local heap is host visible (ReBAR, UMA), frames write dynamic data in place
+	Vk::BufferAllocation createDynBuffer(size_t size, void **ppMappedData) const;
+	Vk::BufferAllocation createCullBuffer(size_t size) const;
 
 	struct Ext {
+		bool draw_indirect_count;
 		bool ray_tracing;
 		VkPhysicalDeviceRayTracingPipelinePropertiesKHR ray_tracing_props;
 	};
 public:
 	Ext ext;
-	VkSharingMode m_gc_sharing_mode;
-	uint32_t m_gc_unique_count;
-	uint32_t m_gc_uniques[2];
 	Vk::Device device;
 
 private:
@@ -138,6 +143,7 @@ private:
 
 public:
 	const VkFormat format_depth;
+	static inline constexpr VkFormat format_depth_pyramid = VK_FORMAT_R32G32_SFLOAT;
 
 private:
 	VkFormat getFormatDepth(void);
@@ -156,13 +162,23 @@ private:
 
 	Vk::Queue m_gqueue;
 	Vk::Queue m_cqueue;
+	Vk::Queue m_tqueue;
+
+	// Loads on the transfer queue landing on the graphics queue, and on the compute queue for the buffers only ray tracing reads
+	static inline constexpr size_t upload_capacity = static_cast<size_t>(64) << 20;
+	static inline constexpr size_t cupload_capacity = static_cast<size_t>(1) << 20;
+	UploadQueue m_upload;
+	UploadQueue m_cupload;
 
 public:
 	void waitIdle(void)
 	{
+		m_upload.wait(m_upload.ticket());
 		m_gqueue.waitIdle();
 		if (m_cqueue != VK_NULL_HANDLE)
 			m_cqueue.waitIdle();
+		if (m_tqueue != VK_NULL_HANDLE)
+			m_tqueue.waitIdle();
 	}
 
 private:
@@ -210,7 +226,7 @@ public:
 	static inline constexpr uint32_t materialPoolSize = 256;
 
 private:
-	static inline constexpr uint32_t const_sets_per_frame = 4;
+	static inline constexpr uint32_t const_sets_per_frame = 5;
 	static inline constexpr uint32_t sets_per_frame_mip = 1;
 
 	Vk::DescriptorSetLayout m_descriptor_set_layout_0;
@@ -219,6 +235,12 @@ private:
 	Vk::DescriptorSetLayout createDescriptorSetLayoutDynamic(void);
 	Vk::PipelineLayout m_pipeline_layout_descriptor_set;
 	Vk::PipelineLayout createPipelineLayoutDescriptorSet(void);
+	Pipeline m_cull_pipeline;
+	Pipeline createCullPipeline(void);
+	// One bit per entity slot, set when the entity passed the last occlusion test
+	static inline constexpr size_t cull_visibility_max = 1 << 22;
+	Vk::BufferAllocation m_cull_visibility;
+	Vk::BufferAllocation createCullVisibility(void);
 	Vk::ShaderModule m_fwd_p2_module;
 	VkSampleCountFlagBits m_sample_count;
 
@@ -232,10 +254,10 @@ public:
 			};
 
 			struct Sspt {
-				static inline constexpr uint32_t descriptorCombinedImageSamplerCount = 1 +	// depth_resolve
+				static inline constexpr uint32_t descriptorCombinedImageSamplerCount =
 					6 +
 					7;
-				static inline constexpr uint32_t msDescriptorCombinedImageSamplerCount = 1 +	// depth_resolve
+				static inline constexpr uint32_t msDescriptorCombinedImageSamplerCount =
 					3 +	// color_resolve
 					9 +
 					7;
@@ -253,20 +275,6 @@ public:
 					Vk::Framebuffer createColorResolveFb(Renderer &r);
 					VkDescriptorSet m_color_resolve_set;
 
-					Vk::ImageAllocation m_depth;
-					Vk::ImageView m_depth_view;
-					Vk::ImageView m_depth_first_mip_view;
-
-					Vk::Framebuffer m_depth_resolve_fb;
-					Vk::Framebuffer createDepthResolveFb(Renderer &r);
-					VkDescriptorSet m_depth_resolve_set;
-					vector<Vk::ImageView> m_depth_acc_views;
-					vector<Vk::ImageView> createDepthAccViews(Renderer &r);
-					vector<Vk::Framebuffer> m_depth_acc_fbs;
-					vector<Vk::Framebuffer> createDepthAccFbs(Renderer &r);
-					vector<VkDescriptorSet> m_depth_acc_sets;
-					vector<VkDescriptorSet> createDepthAccSets(Renderer &r, const VkDescriptorSet *pDescriptorSetsMip);
-
 					Vk::ImageAllocation m_step;
 					Vk::ImageView m_step_view;
 					Vk::ImageAllocation m_acc_path_pos;
@@ -473,7 +481,8 @@ private:
 	Vk::BufferAllocation createScreenVertexBuffer(void);
 
 	Vk::RenderPass m_opaque_pass;
-	Vk::RenderPass createOpaquePass(void);
+	Vk::RenderPass m_opaque_load_pass;	// second culling phase, draws over the first one
+	Vk::RenderPass createOpaquePass(bool load);
 
 	Vk::RenderPass m_color_resolve_pass;
 	Vk::RenderPass createColorResolvePass(void);
@@ -540,12 +549,56 @@ private:
 		VkDescriptorSet m_descriptor_set_0;
 		VkDescriptorSet m_descriptor_set_dynamic;
 
-		static inline constexpr size_t dyn_buffer_size = 2000000;	// large for now, to eventually reduce to 2MB
+		// Linear allocator over the dynamic buffer, reset every frame
+		// It grows by doubling until a copy out of it is recorded, as dynamic offsets are relative to a single descriptor
+		static inline constexpr size_t dyn_buffer_size = 1 << 21;	// initial capacity
+		static inline constexpr size_t dyn_buffer_slack = 1 << 16;	// kept free on growth for the small allocations of the frame
+		size_t m_dyn_buffer_capacity;
 		size_t m_dyn_buffer_size;
-		void *m_dyn_buffer_staging_ptr;
-		Vk::BufferAllocation m_dyn_buffer_staging;
-		Vk::BufferAllocation createDynBufferStaging(void);
+		bool m_dyn_buffer_locked;	// a copy out of the buffer was recorded, it can no longer move
 		Vk::BufferAllocation m_dyn_buffer;
+		void *m_dyn_buffer_ptr;	// host writes, in m_dyn_buffer itself when direct
+		Vk::BufferAllocation m_dyn_buffer_staging;	// none when direct
+		Vk::BufferAllocation createDynBufferStaging(void);
+		void dynReserve(size_t size);
+		size_t dynAlloc(size_t size);
+
+		// Source of copies out of host written data
+		VkBuffer dynHostBuffer(void)
+		{
+			m_dyn_buffer_locked = true;
+			return m_r.m_dyn_direct ? m_dyn_buffer : m_dyn_buffer_staging;
+		}
+
+		// Written by the cull pass: per phase and draw a 24 bytes record, indirect command then draw count at offset 20,
+		// then per phase entity slot and material of visible instances, which the vertex stage reads at gl_InstanceIndex
+		// Capacities are per phase, they double to fit the draws and instances of the frame and are pushed to the cull pass
+		static inline constexpr size_t cull_draw_stride = 24;
+		static inline constexpr size_t cull_phase_count = 2;
+		static inline constexpr uint32_t cull_draw_capacity_min = 1024;
+		static inline constexpr uint32_t cull_instance_capacity_min = 1 << 14;
+		uint32_t m_cull_draw_capacity;
+		uint32_t m_cull_instance_capacity;
+		Vk::BufferAllocation m_cull_buffer;
+		void cullReserve(size_t draws, size_t instances);
+		void writeCullBindings(void);
+
+		static size_t cullDrawsSize(uint32_t drawCapacity)
+		{
+			return cull_phase_count * drawCapacity * cull_draw_stride;
+		}
+
+		static size_t cullBufferSize(uint32_t drawCapacity, uint32_t instanceCapacity)
+		{
+			return cullDrawsSize(drawCapacity) + cull_phase_count * instanceCapacity * 2 * sizeof(uint32_t);
+		}
+
+		// Material pool as the fragment stage reads it, indexed by material
+		// The pool is compared against what this frame sent last, the changed span is copied with the instances
+		Vk::BufferAllocation m_material_buffer;
+		vector<Material> m_materials;
+		VkBufferCopy m_material_copy;	// size 0 when nothing changed
+		void material_upload(void);
 
 		friend class Renderer;
 
@@ -565,9 +618,23 @@ private:
 		Vk::ImageAllocation m_normal_geom;
 		Vk::ImageView m_normal_geom_view;
 
+		// Mip chain of cdepth, x is reduced with max for the SSGI march, y with min: the farthest depth under a texel, for occlusion
+		Vk::ImageAllocation m_depth_pyramid;
+		Vk::ImageView m_depth_pyramid_view;
+		Vk::ImageView m_depth_pyramid_first_mip_view;
+		Vk::Framebuffer m_depth_resolve_fb;
+		Vk::Framebuffer createDepthResolveFb(void);
+		VkDescriptorSet m_depth_resolve_set;
+		vector<Vk::ImageView> m_depth_acc_views;
+		vector<Vk::ImageView> createDepthAccViews(void);
+		vector<Vk::Framebuffer> m_depth_acc_fbs;
+		vector<Vk::Framebuffer> createDepthAccFbs(void);
+		vector<VkDescriptorSet> m_depth_acc_sets;
+		vector<VkDescriptorSet> createDepthAccSets(const VkDescriptorSet *pDescriptorSetsMip);
+		void buildDepthPyramid(void);
+
 		IllumTechnique::Data::Sspt::Fbs m_illum_ssgi_fbs;
-		IllumTechnique::Data::Sspt::Fbs createIllumSsgiFbs(VkDescriptorSet descriptorSetColorResolve, VkDescriptorSet descriptorSetDepthResolve,
-			const VkDescriptorSet *pDescriptorSetsMip);
+		IllumTechnique::Data::Sspt::Fbs createIllumSsgiFbs(VkDescriptorSet descriptorSetColorResolve);
 		IllumTechnique::Data::RayTracing::Fbs m_illum_rt;
 		IllumTechnique::Data::RayTracing::Fbs createIllumRtFbs(VkDescriptorSet descriptorSetRes);
 		IllumTechnique::Data::Rtpt::Fbs m_illum_rtpt;
@@ -627,14 +694,102 @@ private:
 			VkDescriptorSet descriptorSetIllum, VkDescriptorSet descriptorSetRayTracingRes,
 			VkDescriptorSet descriptorSetWsi,
 			const VkDescriptorSet *pDescriptorSetsMip,
-			Vk::BufferAllocation dynBuffer);
+			Vk::BufferAllocation dynBuffer, size_t dynBufferCapacity,
+			Vk::BufferAllocation cullBuffer, uint32_t cullDrawCapacity, uint32_t cullInstanceCapacity,
+			Vk::BufferAllocation materialBuffer);
 
 		void reset(void);
 		void render(Map &map, const Camera &camera);
 		void destroy(bool with_ext_res = false);
 
 	private:
-		void render_subset(Map &map, cmp_id render_id);
+		// Model matrix rows and model space bounding sphere, radius < 0 is never culled
+		static inline constexpr uint32_t draw_pending = ~0U;
+		struct CullInstance {
+			glm::vec4 model[3];
+			glm::vec4 sphere;
+			uint32_t draw;	// draw_pending while its model streams in
+			uint32_t first;	// firstInstance of the draw
+			uint32_t slot;	// entity slot: index in the instance region of the draw, bit in m_cull_visibility
+			uint32_t material;	// index in the material pool
+		};
+		// Precedes the instances
+		struct Cull {
+			glm::vec4 planes[6];
+			glm::mat4 vp;
+			glm::vec2 extent;	// screen size, in texels of the pyramid first level
+			uint32_t count;
+			uint32_t levels;
+		};
+		// Phase 0 draws what was visible last frame, phase 1 tests the rest against the depth pyramid
+		struct CullPhase {
+			uint32_t phase;
+			uint32_t draw_capacity;
+			uint32_t instance_capacity;
+		};
+		struct Draw {
+			Render render;
+			uint32_t dyn_offset;	// of the instance region
+			uint32_t first;
+		};
+		vector<Draw> m_draws;
+		uint32_t m_cull_offset;	// of Cull in the dynamic buffer
+		uint32_t m_cull_count;
+		// Instance of the first row, so chunks can be uploaded in parallel
+		struct CullChunk {
+			Brush::Chunk *chunk;
+			uint32_t inst;
+			uint32_t size;
+		};
+		vector<CullChunk> m_cull_chunks;
+
+		// Draws are the unique render keys in key order, pipeline first, then material, then model
+		// Keys are sorted again only when rows moved or a render column was written since the last sort of this frame
+		struct RenderKey {
+			uint64_t key;
+			const Render *render;
+			uint32_t inst;
+		};
+		vector<RenderKey> m_render_keys;
+		vector<RenderKey> m_render_keys_tmp;
+		vector<uint32_t> m_inst_draws;	// draw of each cull instance
+		uint64_t m_render_since = 0;
+
+		// Each recording task owns a command pool, with a secondary command buffer per culling phase
+		static inline constexpr size_t record_grain = 64;	// min draws per task
+		struct Recorder {
+			Vk::CommandPool pool;
+			Vk::CommandBuffer cmds[cull_phase_count];
+		};
+		vector<Recorder> m_recorders;
+		uint32_t m_recorder_count = 0;	// used this frame
+
+		// Persistent dynamics of the instances, one region per dynamics size, indexed by entity slot
+		// Only the chunks whose render or dynamics columns were written since the last upload of this frame are sent
+		static inline constexpr uint32_t instance_capacity_min = 1024;	// slots per region
+		Vk::BufferAllocation m_instance_buffer;
+		void *m_instance_ptr;	// mapped when direct
+		uint32_t m_instance_capacity = 0;	// no buffer when 0
+		vector<uint32_t> m_instance_strides;
+		vector<uint32_t> m_instance_regions;
+		uint64_t m_instance_since = 0;
+		vector<Brush::Chunk*> m_instance_chunks;
+		vector<VkBufferCopy> m_instance_copies;	// from the dynamic buffer, recorded once it can no longer grow
+
+		static uint32_t dynStride(const Pipeline &pipeline);
+		uint32_t instanceRegion(uint32_t stride) const;
+		void instanceLayout(uint32_t capacity);
+		void instance_upload(Map &map, cmp_id render_id);
+		void writeDynamicBinding(uint32_t binding, VkBuffer buffer);
+
+		uint64_t renderKey(const Render &render) const;
+		void sort_draws(cmp_id render_id, size_t count);
+		void cull_subset(Map &map, cmp_id render_id, const Camera &camera);
+		void cull_upload(const CullChunk &cc, CullInstance *instances);
+		void cull_dispatch(uint32_t phase);
+		void record_subset(ThreadPool &pool);
+		void record_draws(size_t recorder);
+		void render_subset(uint32_t phase);
 	};
 
 	vector<Frame> m_frames;
@@ -649,9 +804,9 @@ private:
 
 public:
 	//Pipeline createPipeline(const char *stagesPath, uint32_t pushConstantRange);
-	Pipeline createPipeline3D_pn(const char *stagesPath, uint32_t pushConstantRange);
-	Pipeline createPipeline3D_pnu(const char *stagesPath, uint32_t pushConstantRange);
-	Pipeline createPipeline3D_pntbu(const char *stagesPath, uint32_t pushConstantRange);
+	Pipeline createPipeline3D_pn(const char *stagesPath);
+	Pipeline createPipeline3D_pnu(const char *stagesPath);
+	Pipeline createPipeline3D_pntbu(const char *stagesPath);
 
 private:
 	Pool<Pipeline> m_pipeline_pool;
@@ -659,6 +814,19 @@ public:
 	Pool<Model> m_model_pool;
 	Pool<AccelerationStructure> m_acc_pool;
 private:
+	// Models of a format share a few large buffers, a block is never moved nor grown
+	struct GeometryBlock
+	{
+		Vk::BufferAllocation buffer;
+		Arena arena;
+	};
+	static inline constexpr size_t geometry_format_count = 4;
+	static inline constexpr size_t geometry_block_size = 32 * 1024 * 1024;	// larger ranges get a block of their own
+	vector<GeometryBlock> m_geometry_blocks[geometry_format_count];
+	size_t geometryAlign(GeometryFormat format);
+	uint32_t m_load_unique_count;
+	uint32_t m_load_uniques[3];
+	void loadSharing(VkBufferCreateInfo &bci);
 	Pool<Material> m_material_pool;
 	bool image_pool_not_bound = true;
 	Pool<Vk::ImageAllocation> m_image_pool;
@@ -677,8 +845,26 @@ public:
 
 	Vk::BufferAllocation createVertexBuffer(size_t size);
 	Vk::BufferAllocation createIndexBuffer(size_t size);
-	void loadBuffer(VkBuffer buffer, size_t size, const void *data);
+	GeometryRange allocateGeometry(GeometryFormat format, size_t size);
+	void freeGeometry(const GeometryRange &range);
+	void destroy(Model &model);
+	// Loads are batched and return before reaching the device, a ticket is done once every load before it is
+	UploadQueue::Ticket loadBuffer(VkBuffer buffer, size_t size, const void *data, size_t offset = 0);
+	UploadQueue::Ticket uploadTicket(void) const
+	{
+		return m_upload.ticket();
+	}
+	bool uploadDone(UploadQueue::Ticket ticket) const
+	{
+		return m_upload.done(ticket);
+	}
+	void waitUpload(UploadQueue::Ticket ticket)
+	{
+		m_upload.wait(ticket);
+	}
 	void loadBufferCompute(VkBuffer buffer, size_t size, const void *data, size_t offset = 0);
+	Model loadMeshRange(const MeshCache &cache, const MeshCache::Range &range, AccelerationStructure *acc);
+	// OBJ files are parsed once, later loads map their .rmesh cache
 	Model loadModel(const char *path, AccelerationStructure *acc);
 	Model loadModelTb(const char *path, AccelerationStructure *acc);
 	void instanciateModel(Map &map, const char *path, const char *filename);
@@ -686,7 +872,7 @@ public:
 	Vk::ImageAllocation loadHeightGenNormal(const char *path, bool gen_mips = true); // VK_FORMAT_R8G8B8A8_UNORM
 	Vk::ImageAllocation loadImage(size_t w, size_t h, void *data, bool gen_mips = true, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);	// assumes 32bpp
 
-	AccelerationStructure createBottomAccelerationStructure(uint32_t vertexCount, size_t vertexStride, VkBuffer vertices,
+	AccelerationStructure createBottomAccelerationStructure(uint32_t vertexCount, size_t vertexStride, VkBuffer vertices, VkDeviceSize verticesOffset,
 		VkIndexType indexType, uint32_t indexCount, VkBuffer indices, VkGeometryFlagsKHR flags);
 	void destroy(AccelerationStructure &accelerationStructure);
 
@@ -697,9 +883,9 @@ private:
 
 public:
 	void bindMaterials_albedo(uint32_t firstMaterial, uint32_t materialCount, Material_albedo *pMaterials);
-	void bindModel_pnu(uint32_t binding, VkBuffer vertexBuffer);
-	void bindModel_pn_i16(uint32_t binding, VkBuffer vertexBuffer, VkBuffer indexBuffer);
-	void bindModel_pntbu(uint32_t binding, VkBuffer vertexBuffer);
+	void bindModel_pnu(uint32_t binding, const GeometryRange &vertices);
+	void bindModel_pn_i16(uint32_t binding, const GeometryRange &vertices, VkBuffer indexBuffer);
+	void bindModel_pntbu(uint32_t binding, const GeometryRange &vertices);
 
 private:
 	bool m_keys_prev[GLFW_KEY_LAST];
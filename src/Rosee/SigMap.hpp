@@ -0,0 +1,96 @@
+#pragma once
+
+#include "Cmp.hpp"
+#include "vector.hpp"
+
+namespace Rosee {
+
+// Open-addressing hash map from component signature to Value
+// Entries are dense and kept in insertion order, addressed by index
+template <typename Value>
+class SigMap
+{
+	struct Entry
+	{
+		Cmp::Signature key;
+		Value value;
+	};
+
+	vector<Entry> m_entries;
+	uint32_t *m_table = nullptr;	// entry index + 1, 0 is empty
+	size_t m_capacity = 0;	// power of two
+
+	void rehash(size_t capacity)
+	{
+		std::free(m_table);
+		m_capacity = capacity;
+		m_table = reinterpret_cast<uint32_t*>(std::calloc(m_capacity, sizeof(uint32_t)));
+		size_t mask = m_capacity - 1;
+		for (size_t i = 0; i < m_entries.size(); i++) {
+			size_t s = m_entries[i].key.hash() & mask;
+			while (m_table[s] != 0)
+				s = (s + 1) & mask;
+			m_table[s] = i + 1;
+		}
+	}
+
+public:
+	static inline constexpr size_t npos = ~0ULL;
+
+	SigMap(void) = default;
+	SigMap(const SigMap&) = delete;
+	~SigMap(void)
+	{
+		std::free(m_table);
+	}
+
+	size_t size(void) const
+	{
+		return m_entries.size();
+	}
+
+	const Cmp::Signature& key(size_t ndx) const
+	{
+		return m_entries[ndx].key;
+	}
+
+	Value& operator[](size_t ndx)
+	{
+		return m_entries[ndx].value;
+	}
+
+	size_t find(const Cmp::Signature &key) const
+	{
+		if (m_capacity == 0)
+			return npos;
+		size_t mask = m_capacity - 1;
+		size_t s = key.hash() & mask;
+		while (m_table[s] != 0) {
+			size_t ndx = m_table[s] - 1;
+			if (m_entries[ndx].key == key)
+				return ndx;
+			s = (s + 1) & mask;
+		}
+		return npos;
+	}
+
+	// key must not be present already
+	template <typename ...Args>
+	size_t emplace(const Cmp::Signature &key, Args &&...args)
+	{
+		size_t res = m_entries.size();
+		m_entries.emplace(Entry{key, Value(std::forward<Args>(args)...)});
+		if ((res + 1) * 2 > m_capacity)
+			rehash(m_capacity == 0 ? 16 : m_capacity * 2);
+		else {
+			size_t mask = m_capacity - 1;
+			size_t s = key.hash() & mask;
+			while (m_table[s] != 0)
+				s = (s + 1) & mask;
+			m_table[s] = res + 1;
+		}
+		return res;
+	}
+};
+
+}
\ No newline at end of file
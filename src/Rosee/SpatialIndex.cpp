@@ -0,0 +1,258 @@
+#include "SpatialIndex.hpp"
+#include "Model.hpp"
+
+namespace Rosee {
+
+SpatialIndex::SpatialIndex(double margin) :
+	m_margin(margin)
+{
+}
+
+int32_t SpatialIndex::alloc(void)
+{
+	int32_t res;
+	if (m_free >= 0) {
+		res = m_free;
+		m_free = m_nodes[res].parent;
+	} else {
+		res = static_cast<int32_t>(m_nodes.size());
+		m_nodes.emplace();
+	}
+	auto &n = m_nodes[res];
+	n.parent = -1;
+	n.left = -1;
+	n.right = -1;
+	n.height = 0;
+	n.entity = ~0ULL;
+	return res;
+}
+
+void SpatialIndex::release(int32_t node)
+{
+	m_nodes[node].parent = m_free;
+	m_nodes[node].height = -1;
+	m_free = node;
+}
+
+// Descends towards the child whose box grows the least, then pairs the leaf with the node reached
+void SpatialIndex::insertLeaf(int32_t leaf)
+{
+	if (m_root < 0) {
+		m_root = leaf;
+		m_nodes[leaf].parent = -1;
+		return;
+	}
+
+	auto box = m_nodes[leaf].box;
+	int32_t sibling = m_root;
+	while (m_nodes[sibling].left >= 0) {
+		auto &s = m_nodes[sibling];
+		double area = s.box.halfArea();
+		double combined = s.box.merged(box).halfArea();
+		// cost of making a new parent here, and lower bound of pushing the leaf further down
+		double cost = 2.0 * combined;
+		double inherited = 2.0 * (combined - area);
+		auto child_cost = [&](int32_t c){
+			auto &cn = m_nodes[c];
+			double merged = cn.box.merged(box).halfArea();
+			return cn.left < 0 ? merged + inherited : merged - cn.box.halfArea() + inherited;
+		};
+		double cost_left = child_cost(s.left);
+		double cost_right = child_cost(s.right);
+		if (cost < cost_left && cost < cost_right)
+			break;
+		sibling = cost_left < cost_right ? s.left : s.right;
+	}
+
+	int32_t old_parent = m_nodes[sibling].parent;
+	int32_t parent = alloc();
+	auto &p = m_nodes[parent];
+	p.parent = old_parent;
+	p.box = m_nodes[sibling].box.merged(box);
+	p.height = m_nodes[sibling].height + 1;
+	p.left = sibling;
+	p.right = leaf;
+	m_nodes[sibling].parent = parent;
+	m_nodes[leaf].parent = parent;
+	if (old_parent < 0)
+		m_root = parent;
+	else if (m_nodes[old_parent].left == sibling)
+		m_nodes[old_parent].left = parent;
+	else
+		m_nodes[old_parent].right = parent;
+
+	fixUpwards(m_nodes[leaf].parent);
+}
+
+void SpatialIndex::removeLeaf(int32_t leaf)
+{
+	if (leaf == m_root) {
+		m_root = -1;
+		return;
+	}
+	int32_t parent = m_nodes[leaf].parent;
+	int32_t grand = m_nodes[parent].parent;
+	int32_t sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+	m_nodes[sibling].parent = grand;
+	release(parent);
+	if (grand < 0) {
+		m_root = sibling;
+		return;
+	}
+	if (m_nodes[grand].left == parent)
+		m_nodes[grand].left = sibling;
+	else
+		m_nodes[grand].right = sibling;
+	fixUpwards(grand);
+}
+
+void SpatialIndex::fixUpwards(int32_t node)
+{
+	while (node >= 0) {
+		node = balance(node);
+		auto &n = m_nodes[node];
+		n.height = 1 + max(m_nodes[n.left].height, m_nodes[n.right].height);
+		n.box = m_nodes[n.left].box.merged(m_nodes[n.right].box);
+		node = n.parent;
+	}
+}
+
+// Rotates the taller grandchild up when children heights differ by more than one, returns the subtree root
+int32_t SpatialIndex::balance(int32_t a)
+{
+	auto &na = m_nodes[a];
+	if (na.left < 0 || na.height < 2)
+		return a;
+	int32_t b = na.left;
+	int32_t c = na.right;
+	int32_t diff = m_nodes[c].height - m_nodes[b].height;
+	if (diff >= -1 && diff <= 1)
+		return a;
+
+	// up is the taller child, it takes the place of a
+	int32_t up = diff > 0 ? c : b;
+	auto &nu = m_nodes[up];
+	int32_t f = nu.left;
+	int32_t g = nu.right;
+
+	nu.left = a;
+	nu.parent = na.parent;
+	na.parent = up;
+	if (nu.parent < 0)
+		m_root = up;
+	else if (m_nodes[nu.parent].left == a)
+		m_nodes[nu.parent].left = up;
+	else
+		m_nodes[nu.parent].right = up;
+
+	// the taller grandchild stays under up, the other one replaces up under a
+	int32_t keep = m_nodes[f].height > m_nodes[g].height ? f : g;
+	int32_t give = keep == f ? g : f;
+	nu.right = keep;
+	if (diff > 0)
+		na.right = give;
+	else
+		na.left = give;
+	m_nodes[give].parent = a;
+
+	na.box = m_nodes[na.left].box.merged(m_nodes[na.right].box);
+	na.height = 1 + max(m_nodes[na.left].height, m_nodes[na.right].height);
+	nu.box = m_nodes[nu.left].box.merged(m_nodes[nu.right].box);
+	nu.height = 1 + max(m_nodes[nu.left].height, m_nodes[nu.right].height);
+	return up;
+}
+
+void SpatialIndex::track(Id::type entity)
+{
+	auto slot = Map::id_index(entity);
+	while (m_entities.size() <= slot) {
+		m_entities.emplace(~0ULL);
+		m_leaves.emplace(-1);
+	}
+	if (m_entities[slot] == entity)
+		return;
+	// the slot was reused by a new entity
+	if (m_entities[slot] != ~0ULL)
+		untrack(slot);
+	m_entities[slot] = entity;
+	m_tracked++;
+}
+
+void SpatialIndex::place(Id::type entity, const Aabb &box)
+{
+	track(entity);
+	auto slot = Map::id_index(entity);
+	auto leaf = m_leaves[slot];
+	if (leaf >= 0) {
+		if (m_nodes[leaf].box.contains(box))
+			return;
+		removeLeaf(leaf);
+	} else {
+		leaf = alloc();
+		m_nodes[leaf].entity = entity;
+		m_leaves[slot] = leaf;
+		m_leaf_count++;
+	}
+	auto d = box.max - box.min;
+	m_nodes[leaf].box = box.grown(m_margin * max(max(d[0], d[1]), d[2]));
+	insertLeaf(leaf);
+}
+
+void SpatialIndex::removeLeafOf(size_t slot)
+{
+	auto leaf = m_leaves[slot];
+	if (leaf < 0)
+		return;
+	removeLeaf(leaf);
+	release(leaf);
+	m_leaves[slot] = -1;
+	m_leaf_count--;
+}
+
+void SpatialIndex::untrack(size_t slot)
+{
+	removeLeafOf(slot);
+	m_entities[slot] = ~0ULL;
+	m_tracked--;
+}
+
+// Drops entities that were despawned or that lost a component of the query
+void SpatialIndex::sweep(Map &map)
+{
+	for (size_t i = 0; i < m_entities.size(); i++) {
+		if (m_entities[i] == ~0ULL)
+			continue;
+		auto b = map.find(m_entities[i]).first;
+		if (b == nullptr || !b->cmpIsPres<Id>() || !b->cmpIsPres<Transform>() || !b->cmpIsPres<OpaqueRender>())
+			untrack(i);
+	}
+}
+
+void SpatialIndex::update(Map &map)
+{
+	size_t rows = 0;
+	map.query<Id, Transform, OpaqueRender>([&](Brush &b){
+		rows += b.size();
+		for (auto &c : b.chunks()) {
+			if (c.version<Transform>() <= m_since && c.version<OpaqueRender>() <= m_since)
+				continue;
+			auto ids = c.get<Id>();
+			auto trans = c.get<Transform>();
+			auto render = c.get<OpaqueRender>();
+			for (size_t i = 0; i < c.size(); i++) {
+				auto model = render[i].model;
+				if (model == nullptr || model->aabb.empty()) {
+					track(ids[i]);
+					removeLeafOf(Map::id_index(ids[i]));
+				} else
+					place(ids[i], model->aabb.transformed(trans[i]));
+			}
+		}
+	});
+	// Each row of the query is tracked once, any extra entity is gone from it
+	if (m_tracked > rows)
+		sweep(map);
+	m_since = map.tick();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "Map.hpp"
+#include "Bounds.hpp"
+
+namespace Rosee {
+
+// Dynamic AABB tree over entities with Transform and OpaqueRender, bounds are the model box in world space
+// Leaves hold a box grown by a margin so small moves don't touch the tree, queries test that box so results are conservative
+class SpatialIndex
+{
+	struct Node
+	{
+		Aabb box;
+		int32_t parent;	// next free node when free
+		int32_t left;	// -1 for a leaf
+		int32_t right;
+		int32_t height;	// 0 for a leaf, -1 when free
+		Id::type entity;
+	};
+
+	double m_margin;
+	vector<Node> m_nodes;
+	int32_t m_root = -1;
+	int32_t m_free = -1;
+	size_t m_leaf_count = 0;
+	vector<Id::type> m_entities;	// tracked entity per slot, ~0 if none, with or without a leaf
+	vector<int32_t> m_leaves;	// leaf per entity slot, -1 if none
+	size_t m_tracked = 0;
+	vector<std::pair<int32_t, uint32_t>> m_stack;
+	uint64_t m_since = 0;
+
+	int32_t alloc(void);
+	void release(int32_t node);
+	void insertLeaf(int32_t leaf);
+	void removeLeaf(int32_t leaf);
+	int32_t balance(int32_t node);
+	void fixUpwards(int32_t node);
+
+	void track(Id::type entity);
+	void place(Id::type entity, const Aabb &box);
+	void removeLeafOf(size_t slot);
+	void untrack(size_t slot);
+	void sweep(Map &map);
+
+	// Callback gets the entity id, its brush and row, entities despawned since the last update are skipped
+	template <typename Callback>
+	void report(Map &map, Id::type entity, Callback &&callback)
+	{
+		auto [b, row] = map.find(entity);
+		if (b != nullptr)
+			callback(entity, *b, row);
+	}
+
+	template <typename Callback>
+	void reportSubtree(Map &map, int32_t node, Callback &&callback)
+	{
+		size_t base = m_stack.size();
+		m_stack.emplace(node, 0U);
+		while (m_stack.size() > base) {
+			auto n = m_stack[m_stack.size() - 1].first;
+			m_stack.resize(m_stack.size() - 1);
+			auto &nd = m_nodes[n];
+			if (nd.left < 0)
+				report(map, nd.entity, callback);
+			else {
+				m_stack.emplace(nd.left, 0U);
+				m_stack.emplace(nd.right, 0U);
+			}
+		}
+	}
+
+public:
+	// margin: fraction of the box size added on each side of leaves
+	SpatialIndex(double margin = 0.1);
+
+	size_t size(void) const
+	{
+		return m_leaf_count;
+	}
+
+	// Re-fits entities whose Transform or OpaqueRender changed since the last update, drops dead ones
+	void update(Map &map);
+
+	// callback(Id::type entity, Brush &b, size_t row)
+	template <typename Callback>
+	void frustum(Map &map, const Frustum &frustum, Callback &&callback)
+	{
+		if (m_root < 0)
+			return;
+		m_stack.resize(0);
+		m_stack.emplace(m_root, 0U);
+		while (m_stack.size() > 0) {
+			auto [n, inside] = m_stack[m_stack.size() - 1];
+			m_stack.resize(m_stack.size() - 1);
+			auto &nd = m_nodes[n];
+			inside = frustum.classify(nd.box, inside);
+			if (inside == ~0U)
+				continue;
+			if (inside == Frustum::all_inside) {
+				reportSubtree(map, n, callback);
+				continue;
+			}
+			if (nd.left < 0)
+				report(map, nd.entity, callback);
+			else {
+				m_stack.emplace(nd.left, inside);
+				m_stack.emplace(nd.right, inside);
+			}
+		}
+	}
+
+	template <typename Callback>
+	void sphere(Map &map, const glm::dvec3 &center, double radius, Callback &&callback)
+	{
+		if (m_root < 0)
+			return;
+		auto dist2 = [&](const Aabb &box){
+			double res = 0.0;
+			for (size_t i = 0; i < 3; i++) {
+				double d = max(max(box.min[i] - center[i], center[i] - box.max[i]), 0.0);
+				res += d * d;
+			}
+			return res;
+		};
+		double r2 = radius * radius;
+		m_stack.resize(0);
+		m_stack.emplace(m_root, 0U);
+		while (m_stack.size() > 0) {
+			auto n = m_stack[m_stack.size() - 1].first;
+			m_stack.resize(m_stack.size() - 1);
+			auto &nd = m_nodes[n];
+			if (dist2(nd.box) > r2)
+				continue;
+			if (nd.left < 0)
+				report(map, nd.entity, callback);
+			else {
+				m_stack.emplace(nd.left, 0U);
+				m_stack.emplace(nd.right, 0U);
+			}
+		}
+	}
+
+	// Entities whose box is crossed by the segment origin + t * dir, 0 <= t <= max_t
+	template <typename Callback>
+	void ray(Map &map, const glm::dvec3 &origin, const glm::dvec3 &dir, double max_t, Callback &&callback)
+	{
+		if (m_root < 0)
+			return;
+		glm::dvec3 inv;
+		for (size_t i = 0; i < 3; i++)
+			inv[i] = 1.0 / dir[i];
+		m_stack.resize(0);
+		m_stack.emplace(m_root, 0U);
+		while (m_stack.size() > 0) {
+			auto n = m_stack[m_stack.size() - 1].first;
+			m_stack.resize(m_stack.size() - 1);
+			auto &nd = m_nodes[n];
+			if (nd.box.rayEnter(origin, inv, max_t) < 0.0)
+				continue;
+			if (nd.left < 0)
+				report(map, nd.entity, callback);
+			else {
+				m_stack.emplace(nd.left, 0U);
+				m_stack.emplace(nd.right, 0U);
+			}
+		}
+	}
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "ThreadPool.hpp"
+
+namespace Rosee {
+
+thread_local size_t ThreadPool::s_worker_index = 0;
+
+ThreadPool::ThreadPool(size_t workerCount) :
+	m_worker_count(workerCount)
+{
+	if (m_worker_count == ~0ULL) {
+		size_t hw = std::thread::hardware_concurrency();
+		m_worker_count = hw > 1 ? hw - 1 : 0;
+	}
+	m_queues = new Queue[m_worker_count + 1];
+	m_threads = new std::thread[m_worker_count];
+	for (size_t i = 0; i < m_worker_count; i++)
+		m_threads[i] = std::thread([this, i](){
+			work(i + 1);
+		});
+}
+
+ThreadPool::~ThreadPool(void)
+{
+	{
+		std::lock_guard l(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for (size_t i = 0; i < m_worker_count; i++)
+		m_threads[i].join();
+	delete[] m_threads;
+	delete[] m_queues;
+}
+
+bool ThreadPool::pop(size_t queue, Job &job)
+{
+	auto &q = m_queues[queue];
+	std::lock_guard l(q.mutex);
+	if (q.jobs.empty())
+		return false;
+	job = q.jobs.back();
+	q.jobs.pop_back();
+	m_queued.fetch_sub(1, std::memory_order_relaxed);
+	return true;
+}
+
+bool ThreadPool::steal(size_t thief, Job &job)
+{
+	size_t count = size();
+	for (size_t i = 1; i < count; i++) {
+		auto &q = m_queues[(thief + i) % count];
+		std::lock_guard l(q.mutex);
+		if (q.jobs.empty())
+			continue;
+		job = q.jobs.front();
+		q.jobs.pop_front();
+		m_queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::tryRun(size_t queue)
+{
+	Job job;
+	if (!pop(queue, job) && !steal(queue, job))
+		return false;
+	try {
+		job.task.fun(job.task.data, job.task.ctx, job.task.begin, job.task.end);
+	} catch (...) {
+		std::lock_guard l(job.batch->mutex);
+		if (!job.batch->error)
+			job.batch->error = std::current_exception();
+	}
+	job.batch->pending.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+void ThreadPool::work(size_t index)
+{
+	s_worker_index = index;
+	while (true) {
+		if (tryRun(index))
+			continue;
+		std::unique_lock l(m_mutex);
+		m_cv.wait(l, [this](){
+			return m_stop || m_queued.load(std::memory_order_relaxed) > 0;
+		});
+		if (m_stop && m_queued.load(std::memory_order_relaxed) == 0)
+			return;
+	}
+}
+
+void ThreadPool::run(const Task *tasks, size_t count)
+{
+	if (count == 0)
+		return;
+	if (m_worker_count == 0 || count == 1) {
+		for (size_t i = 0; i < count; i++)
+			tasks[i].fun(tasks[i].data, tasks[i].ctx, tasks[i].begin, tasks[i].end);
+		return;
+	}
+
+	Batch batch;
+	batch.pending.store(count, std::memory_order_relaxed);
+	{
+		std::lock_guard l(m_mutex);
+		m_queued.fetch_add(count, std::memory_order_relaxed);
+	}
+	size_t self = s_worker_index;
+	size_t qcount = size();
+	for (size_t q = 0; q < qcount; q++) {
+		auto &queue = m_queues[(self + q) % qcount];
+		std::lock_guard l(queue.mutex);
+		for (size_t i = q; i < count; i += qcount)
+			queue.jobs.push_back(Job{tasks[i], &batch});
+	}
+	m_cv.notify_all();
+
+	while (batch.pending.load(std::memory_order_acquire) > 0)
+		if (!tryRun(self))
+			std::this_thread::yield();
+	// no job refers to the batch anymore
+	if (batch.error)
+		std::rethrow_exception(batch.error);
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <exception>
+
+namespace Rosee {
+
+// Work-stealing pool: each worker owns a deque, pops from its back and steals from the front of the others.
+// The thread calling run() takes part in the work until the whole batch is done.
+// A task may throw: the rest of the batch still runs, then run() rethrows the first exception.
+class ThreadPool
+{
+public:
+	struct Task
+	{
+		using Fun = void (void *data, void *ctx, size_t begin, size_t end);
+
+		Fun *fun;
+		void *data;
+		void *ctx;
+		size_t begin;
+		size_t end;
+	};
+
+private:
+	// Lives on the stack of run(), which returns only once pending is 0
+	struct Batch
+	{
+		std::atomic<size_t> pending;
+		std::mutex mutex;
+		std::exception_ptr error;	// first one thrown by a task
+	};
+
+	struct Job
+	{
+		Task task;
+		Batch *batch;
+	};
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	size_t m_worker_count;
+	Queue *m_queues;	// m_worker_count + 1, first one is for threads outside of the pool
+	std::thread *m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::atomic<size_t> m_queued = 0;
+	bool m_stop = false;
+
+	static thread_local size_t s_worker_index;
+
+	bool pop(size_t queue, Job &job);
+	bool steal(size_t thief, Job &job);
+	bool tryRun(size_t queue);
+	void work(size_t index);
+
+public:
+	ThreadPool(size_t workerCount = ~0ULL);	// ~0ULL: one worker per hardware thread, minus the caller
+	~ThreadPool(void);
+
+	// Workers + the calling thread
+	size_t size(void) const
+	{
+		return m_worker_count + 1;
+	}
+
+	// In [0, size()), 0 for any thread not owned by the pool
+	static size_t workerIndex(void)
+	{
+		return s_worker_index;
+	}
+
+	void run(const Task *tasks, size_t count);
+};
+
+}
\ No newline at end of file
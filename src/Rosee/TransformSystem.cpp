@@ -0,0 +1,328 @@
+#include <stdexcept>
+#include <algorithm>
+#include <numeric>
+#include "TransformSystem.hpp"
+#include "math.hpp"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#define ROSEE_X86
+#include <immintrin.h>
+#endif
+
+namespace Rosee {
+
+// Kernels read matrices as 16 contiguous column-major scalars
+static_assert(sizeof(Transform) == sizeof(double[16]));
+static_assert(sizeof(MVP) == sizeof(float[16]));
+static_assert(sizeof(MV_normal) == sizeof(float[12]));
+static_assert(sizeof(MW_local) == sizeof(float[12]));
+
+void TransformSystem::kernel_scalar(const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+	MVP *mvp, MV_normal *mv_normal, MW_local *mw_local)
+{
+	auto a = &vp[0][0];
+	auto v = &view[0][0];
+	for (size_t i = 0; i < count; i++) {
+		auto t = reinterpret_cast<const double*>(&trans[i]);
+		if (mvp) {
+			auto dst = reinterpret_cast<float*>(&mvp[i]);
+			for (size_t c = 0; c < 4; c++)
+				for (size_t r = 0; r < 4; r++)
+					dst[c * 4 + r] = static_cast<float>(a[r] * t[c * 4] + a[4 + r] * t[c * 4 + 1] + a[8 + r] * t[c * 4 + 2] + a[12 + r] * t[c * 4 + 3]);
+		}
+		if (mv_normal) {
+			auto dst = reinterpret_cast<float*>(&mv_normal[i]);
+			for (size_t c = 0; c < 3; c++)
+				for (size_t r = 0; r < 4; r++)
+					dst[c * 4 + r] = static_cast<float>(v[r] * t[c * 4] + v[4 + r] * t[c * 4 + 1] + v[8 + r] * t[c * 4 + 2] + v[12 + r] * t[c * 4 + 3]);
+		}
+		if (mw_local) {
+			auto dst = reinterpret_cast<float*>(&mw_local[i]);
+			for (size_t j = 0; j < 12; j++)
+				dst[j] = static_cast<float>(t[j]);
+		}
+	}
+}
+
+#ifdef ROSEE_X86
+
+// m * t, m given as low and high halves of its columns
+__attribute__((target("sse2")))
+static inline __m128 column_sse2(const __m128d *lo, const __m128d *hi, const double *t)
+{
+	__m128d x = _mm_set1_pd(t[0]), y = _mm_set1_pd(t[1]), z = _mm_set1_pd(t[2]), w = _mm_set1_pd(t[3]);
+	__m128d rlo = _mm_add_pd(_mm_add_pd(_mm_mul_pd(lo[0], x), _mm_mul_pd(lo[1], y)), _mm_add_pd(_mm_mul_pd(lo[2], z), _mm_mul_pd(lo[3], w)));
+	__m128d rhi = _mm_add_pd(_mm_add_pd(_mm_mul_pd(hi[0], x), _mm_mul_pd(hi[1], y)), _mm_add_pd(_mm_mul_pd(hi[2], z), _mm_mul_pd(hi[3], w)));
+	return _mm_movelh_ps(_mm_cvtpd_ps(rlo), _mm_cvtpd_ps(rhi));
+}
+
+// SSE2 is part of x86-64, two registers per column
+__attribute__((target("sse2")))
+void TransformSystem::kernel_sse2(const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+	MVP *mvp, MV_normal *mv_normal, MW_local *mw_local)
+{
+	__m128d a_lo[4], a_hi[4], v_lo[4], v_hi[4];
+	for (size_t k = 0; k < 4; k++) {
+		a_lo[k] = _mm_loadu_pd(&vp[k][0]);
+		a_hi[k] = _mm_loadu_pd(&vp[k][2]);
+		v_lo[k] = _mm_loadu_pd(&view[k][0]);
+		v_hi[k] = _mm_loadu_pd(&view[k][2]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		auto t = reinterpret_cast<const double*>(&trans[i]);
+		if (mvp) {
+			auto dst = reinterpret_cast<float*>(&mvp[i]);
+			for (size_t c = 0; c < 4; c++)
+				_mm_storeu_ps(dst + c * 4, column_sse2(a_lo, a_hi, t + c * 4));
+		}
+		if (mv_normal) {
+			auto dst = reinterpret_cast<float*>(&mv_normal[i]);
+			for (size_t c = 0; c < 3; c++)
+				_mm_storeu_ps(dst + c * 4, column_sse2(v_lo, v_hi, t + c * 4));
+		}
+		if (mw_local) {
+			auto dst = reinterpret_cast<float*>(&mw_local[i]);
+			for (size_t c = 0; c < 3; c++)
+				_mm_storeu_ps(dst + c * 4, _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(t + c * 4)), _mm_cvtpd_ps(_mm_loadu_pd(t + c * 4 + 2))));
+		}
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m128 column_avx2(const __m256d *m, const double *t)
+{
+	__m256d r = _mm256_mul_pd(m[0], _mm256_broadcast_sd(t));
+	r = _mm256_fmadd_pd(m[1], _mm256_broadcast_sd(t + 1), r);
+	r = _mm256_fmadd_pd(m[2], _mm256_broadcast_sd(t + 2), r);
+	r = _mm256_fmadd_pd(m[3], _mm256_broadcast_sd(t + 3), r);
+	return _mm256_cvtpd_ps(r);
+}
+
+// One register per column, one fma per source row
+__attribute__((target("avx2,fma")))
+void TransformSystem::kernel_avx2(const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+	MVP *mvp, MV_normal *mv_normal, MW_local *mw_local)
+{
+	__m256d a[4], v[4];
+	for (size_t k = 0; k < 4; k++) {
+		a[k] = _mm256_loadu_pd(&vp[k][0]);
+		v[k] = _mm256_loadu_pd(&view[k][0]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		auto t = reinterpret_cast<const double*>(&trans[i]);
+		if (mvp) {
+			auto dst = reinterpret_cast<float*>(&mvp[i]);
+			for (size_t c = 0; c < 4; c++)
+				_mm_storeu_ps(dst + c * 4, column_avx2(a, t + c * 4));
+		}
+		if (mv_normal) {
+			auto dst = reinterpret_cast<float*>(&mv_normal[i]);
+			for (size_t c = 0; c < 3; c++)
+				_mm_storeu_ps(dst + c * 4, column_avx2(v, t + c * 4));
+		}
+		if (mw_local) {
+			auto dst = reinterpret_cast<float*>(&mw_local[i]);
+			for (size_t c = 0; c < 3; c++)
+				_mm_storeu_ps(dst + c * 4, _mm256_cvtpd_ps(_mm256_loadu_pd(t + c * 4)));
+		}
+	}
+}
+
+bool TransformSystem::isaSupported(Isa isa)
+{
+	switch (isa) {
+	case Isa::Scalar:
+		return true;
+	case Isa::Sse2:
+		return __builtin_cpu_supports("sse2");
+	case Isa::Avx2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	}
+	return false;
+}
+
+#else
+
+void TransformSystem::kernel_sse2(const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+	MVP *mvp, MV_normal *mv_normal, MW_local *mw_local)
+{
+	kernel_scalar(trans, count, vp, view, mvp, mv_normal, mw_local);
+}
+
+void TransformSystem::kernel_avx2(const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+	MVP *mvp, MV_normal *mv_normal, MW_local *mw_local)
+{
+	kernel_scalar(trans, count, vp, view, mvp, mv_normal, mw_local);
+}
+
+bool TransformSystem::isaSupported(Isa isa)
+{
+	return isa == Isa::Scalar;
+}
+
+#endif
+
+TransformSystem::Isa TransformSystem::isaBest(void)
+{
+	if (isaSupported(Isa::Avx2))
+		return Isa::Avx2;
+	if (isaSupported(Isa::Sse2))
+		return Isa::Sse2;
+	return Isa::Scalar;
+}
+
+TransformSystem::Kernel* TransformSystem::kernelGet(Isa isa)
+{
+	if (!isaSupported(isa))
+		throw std::runtime_error("Transform kernel not supported by this CPU");
+	switch (isa) {
+	case Isa::Sse2:
+		return kernel_sse2;
+	case Isa::Avx2:
+		return kernel_avx2;
+	default:
+		return kernel_scalar;
+	}
+}
+
+TransformSystem::TransformSystem(Isa isa) :
+	m_kernel(kernelGet(isa))
+{
+}
+
+// Depths are only recomputed when a Parent column changed, brushes are then reordered by depth if needed
+void TransformSystem::sortHierarchy(Map &map)
+{
+	bool changed = false;
+	size_t total = 0;
+	map.query<Parent>([&](Brush &b){
+		for (auto &c : b.chunks())
+			if (c.version<Parent>() > m_since)
+				changed = true;
+		total += b.size();
+	});
+	if (!changed)
+		return;
+
+	m_max_depth = 0;
+	map.query<Parent>([&](Brush &b){
+		for (size_t i = 0; i < b.size(); i++) {
+			uint32_t depth = 1;
+			auto [pb, prow] = map.find(b.at<Parent>(i).entity);
+			while (pb != nullptr && pb->cmpIsPres<Parent>()) {
+				if (depth > total)
+					throw std::runtime_error("Parent cycle");
+				depth++;
+				std::tie(pb, prow) = map.find(pb->at<Parent>(prow).entity);
+			}
+			b.at<Parent>(i).depth = depth;
+			m_max_depth = max(m_max_depth, depth);
+		}
+	});
+
+	vector<size_t> order;
+	map.query<Parent>([&](Brush &b){
+		bool sorted = true;
+		for (size_t i = 1; i < b.size(); i++)
+			if (b.at<Parent>(i - 1).depth > b.at<Parent>(i).depth) {
+				sorted = false;
+				break;
+			}
+		if (sorted)
+			return;
+		order.resize(b.size());
+		std::iota(order.data(), order.data() + order.size(), static_cast<size_t>(0));
+		std::stable_sort(order.data(), order.data() + order.size(), [&](size_t l, size_t r){
+			return b.at<Parent>(l).depth < b.at<Parent>(r).depth;
+		});
+		b.permute(order.data());
+	});
+}
+
+// One sweep per depth level, over contiguous rows: a row is recomputed when its LocalTransform or Parent changed,
+// or when the chunk holding its parent Transform did, which covers whole dirty subtrees level by level
+// Until some Transform changed, chunks whose own columns are clean are skipped without looking up their parents
+void TransformSystem::propagate(Map &map)
+{
+	sortHierarchy(map);
+	bool moved = false;
+	map.query<Transform>([&](Brush &b){
+		for (auto &c : b.chunks())
+			if (c.version<Transform>() > m_since)
+				moved = true;
+	});
+	for (uint32_t d = 1; d <= m_max_depth; d++)
+		map.query<Parent, LocalTransform, Transform>([&](Brush &b){
+			auto first_of = [&](uint32_t depth){
+				size_t lo = 0, hi = b.size();
+				while (lo < hi) {
+					size_t mid = (lo + hi) / 2;
+					if (b.at<Parent>(mid).depth < depth)
+						lo = mid + 1;
+					else
+						hi = mid;
+				}
+				return lo;
+			};
+			size_t end = first_of(d + 1);
+			for (size_t i = first_of(d); i < end;) {
+				size_t chunk = i / b.chunkCapacity();
+				size_t chunk_end = min(end, (chunk + 1) * b.chunkCapacity());
+				auto &c = b.chunks()[chunk];
+				bool dirty = c.version<LocalTransform>() > m_since || c.version<Parent>() > m_since;
+				if (!dirty && !moved) {
+					i = chunk_end;
+					continue;
+				}
+				for (; i < chunk_end; i++) {
+					auto [pb, prow] = map.find(b.at<Parent>(i).entity);
+					if (pb == nullptr || !pb->cmpIsPres<Transform>()) {
+						// orphan: local is world
+						if (dirty) {
+							b.at<Transform>(i) = b.at<LocalTransform>(i);
+							b.touch(Transform::id, i);
+							moved = true;
+						}
+						continue;
+					}
+					if (!dirty && pb->chunks()[prow / pb->chunkCapacity()].version<Transform>() <= m_since)
+						continue;
+					b.at<Transform>(i) = pb->at<Transform>(prow) * b.at<LocalTransform>(i);
+					b.touch(Transform::id, i);
+					moved = true;
+				}
+			}
+		});
+}
+
+void TransformSystem::update(Map &map, const glm::dmat4 &view, const glm::dmat4 &proj)
+{
+	propagate(map);
+
+	auto vp = proj * view;
+	bool camera = m_first || vp != m_vp;
+	auto cb = [&](Brush &b, Brush::Chunk &c){
+		bool moved = c.version<Transform>() > m_since;
+		auto mvp = c.get<MVP>();
+		auto mv_normal = c.get<MV_normal>();
+		auto mw_local = moved ? c.get<MW_local>() : nullptr;
+		if (mvp == nullptr && mv_normal == nullptr && mw_local == nullptr)
+			return;
+		m_kernel(c.get<Transform>(), c.size(), vp, view, mvp, mv_normal, mw_local);
+		if (mvp)
+			b.touch<MVP>(c);
+		if (mv_normal)
+			b.touch<MV_normal>(c);
+		if (mw_local)
+			b.touch<MW_local>(c);
+	};
+	if (camera)
+		map.query_par<Transform>(cb);
+	else
+		map.query_changed<Transform>(m_since, cb);
+	m_vp = vp;
+	m_first = false;
+	m_since = map.tick();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Map.hpp"
+
+namespace Rosee {
+
+// Computes MVP, MV_normal and MW_local from Transform in one pass over each chunk
+// Math stays in double precision, results are narrowed to float on store
+class TransformSystem
+{
+public:
+	enum class Isa {
+		Scalar,
+		Sse2,
+		Avx2
+	};
+
+	// Any output may be nullptr
+	using Kernel = void (const Transform *trans, size_t count, const glm::dmat4 &vp, const glm::dmat4 &view,
+		MVP *mvp, MV_normal *mv_normal, MW_local *mw_local);
+
+	static Kernel kernel_scalar;
+	static Kernel kernel_sse2;
+	static Kernel kernel_avx2;
+
+	static bool isaSupported(Isa isa);
+	static Isa isaBest(void);
+	static Kernel* kernelGet(Isa isa);
+
+private:
+	Kernel *m_kernel;
+	uint64_t m_since = 0;
+	glm::dmat4 m_vp;
+	bool m_first = true;
+	uint32_t m_max_depth = 0;
+
+	void sortHierarchy(Map &map);
+	void propagate(Map &map);
+
+public:
+	TransformSystem(Isa isa = isaBest());
+
+	// First, Transform = parent Transform * LocalTransform for entities with a Parent, parents first
+	// Then every entity when the camera moved, otherwise only the ones whose Transform changed since the last update
+	void update(Map &map, const glm::dmat4 &view, const glm::dmat4 &proj);
+};
+
+}
\ No newline at end of file
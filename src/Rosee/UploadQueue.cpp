@@ -0,0 +1,268 @@
+#include "UploadQueue.hpp"
+#include "math.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace Rosee {
+
+UploadQueue::UploadQueue(Vk::Device device, Vk::Allocator allocator, Vk::Queue queue, uint32_t family, Vk::Queue dstQueue, uint32_t dstFamily,
+	size_t capacity) :
+	m_device(device),
+	m_allocator(allocator),
+	m_queue(queue),
+	m_family(family),
+	m_dst_queue(dstQueue),
+	m_dst_family(dstFamily),
+	m_capacity(capacity),
+	m_copied(family != dstFamily ? device.createTimelineSemaphore(0) : Vk::Semaphore(VK_NULL_HANDLE)),
+	m_timeline(device.createTimelineSemaphore(0)),
+	m_command_pool(device.createCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, family)),
+	m_dst_command_pool(family != dstFamily ?
+		device.createCommandPool(VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT, dstFamily) :
+		Vk::CommandPool(VK_NULL_HANDLE))
+{
+	VkBufferCreateInfo bci{};
+	bci.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bci.size = capacity;
+	bci.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	VmaAllocationCreateInfo aci{};
+	aci.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	aci.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+	void *data;
+	m_staging = allocator.createBuffer(bci, aci, &data);
+	m_staging_ptr = reinterpret_cast<uint8_t*>(data);
+
+	VkCommandBuffer cmds[batch_count];
+	device.allocateCommandBuffers(m_command_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, batch_count, cmds);
+	for (size_t i = 0; i < batch_count; i++)
+		m_batches[i].cmd = cmds[i];
+	if (split())
+		device.allocateCommandBuffers(m_dst_command_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, batch_count, cmds);
+	for (size_t i = 0; i < batch_count; i++)
+		m_batches[i].dst_cmd = cmds[i];
+}
+
+void UploadQueue::destroy(void)
+{
+	wait(ticket());
+	if (split()) {
+		m_device.destroy(m_dst_command_pool);
+		m_device.destroy(m_copied);
+	}
+	m_device.destroy(m_command_pool);
+	m_device.destroy(m_timeline);
+	m_allocator.destroy(m_staging);
+}
+
+// ticket must be in flight
+UploadQueue::Batch& UploadQueue::batch(Ticket ticket)
+{
+	return m_batches[(m_first + (ticket - m_batches[m_first].ticket)) % batch_count];
+}
+
+UploadQueue::Batch& UploadQueue::open(void)
+{
+	if (m_open)
+		return batch(m_next - 1);
+	reclaim();
+	if (m_count == batch_count)
+		retire();
+	auto &res = m_batches[(m_first + m_count) % batch_count];
+	m_count++;
+	m_open = true;
+	res.ticket = m_next++;
+	res.end = m_head;
+	res.cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	if (split())
+		res.dst_cmd.beginPrimary(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+	return res;
+}
+
+// Submits the destination side of the batches up to copied, their copies are done so the destination queue never waits on them
+void UploadQueue::land(Ticket copied)
+{
+	while (m_landed < copied) {
+		auto &b = batch(m_landed + 1);
+		b.dst_cmd.end();
+
+		VkPipelineStageFlags wait_stage = Vk::PipelineStage::AllCommandsBit;
+		VkTimelineSemaphoreSubmitInfoKHR ti{};
+		ti.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+		ti.waitSemaphoreValueCount = 1;
+		ti.pWaitSemaphoreValues = &b.ticket;
+		ti.signalSemaphoreValueCount = 1;
+		ti.pSignalSemaphoreValues = &b.ticket;
+		VkSubmitInfo submit{};
+		submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit.pNext = &ti;
+		submit.waitSemaphoreCount = 1;
+		submit.pWaitSemaphores = m_copied.ptr();
+		submit.pWaitDstStageMask = &wait_stage;
+		submit.commandBufferCount = 1;
+		submit.pCommandBuffers = b.dst_cmd.ptr();
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = m_timeline.ptr();
+		m_dst_queue.submit(1, &submit, VK_NULL_HANDLE);
+		m_landed = b.ticket;
+	}
+}
+
+// Gives back the ring space of the batches already done, without blocking
+void UploadQueue::reclaim(void)
+{
+	size_t submitted = m_count - (m_open ? 1 : 0);
+	if (submitted == 0)
+		return;
+	auto reached = m_device.getSemaphoreCounterValue(m_timeline);
+	while (submitted > 0 && m_batches[m_first].ticket <= reached) {
+		m_tail = m_batches[m_first].end;
+		m_first = (m_first + 1) % batch_count;
+		m_count--;
+		submitted--;
+	}
+}
+
+// Waits for the oldest batch, which must be submitted
+void UploadQueue::retire(void)
+{
+	auto &b = m_batches[m_first];
+	if (!landed(b.ticket)) {
+		m_device.wait(m_copied, b.ticket);
+		land(b.ticket);
+	}
+	m_device.wait(m_timeline, b.ticket);
+	m_tail = b.end;
+	m_first = (m_first + 1) % batch_count;
+	m_count--;
+}
+
+uint8_t* UploadQueue::stage(size_t size, VkDeviceSize &offset)
+{
+	if (size > maxStage())
+		throw std::runtime_error("Upload larger than the staging ring allows");
+	uint64_t pos = (m_head + staging_align - 1) / staging_align * staging_align;
+	if (pos % m_capacity + size > m_capacity)
+		pos = (pos / m_capacity + 1) * m_capacity;
+	while (pos + size > m_tail + m_capacity) {
+		// the open batch alone holds the space: send it before waiting on it
+		if (m_open && m_count == 1)
+			submit();
+		retire();
+	}
+	auto &b = open();
+	m_head = pos + size;
+	b.end = m_head;
+	offset = pos % m_capacity;
+	return m_staging_ptr + offset;
+}
+
+Vk::CommandBuffer& UploadQueue::cmd(void)
+{
+	return open().cmd;
+}
+
+Vk::CommandBuffer& UploadQueue::dstCmd(void)
+{
+	return open().dst_cmd;
+}
+
+UploadQueue::Ticket UploadQueue::buffer(VkBuffer dst, size_t size, const void *data, size_t offset)
+{
+	auto src = reinterpret_cast<const uint8_t*>(data);
+	while (size > 0) {
+		size_t n = min(size, maxStage());
+		VkDeviceSize s;
+		std::memcpy(stage(n, s), src, n);
+		VkBufferCopy region;
+		region.srcOffset = s;
+		region.dstOffset = offset;
+		region.size = n;
+		cmd().copyBuffer(m_staging, dst, 1, &region);
+		src += n;
+		offset += n;
+		size -= n;
+	}
+	return ticket();
+}
+
+// Release on the copy queue then acquire on the destination queue, the acquire runs once the copies signaled
+void UploadQueue::transferImage(VkImage image, VkImageLayout layout, const VkImageSubresourceRange &range)
+{
+	if (!split())
+		return;
+	VkImageMemoryBarrier release { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, 0,
+		layout, layout, m_family, m_dst_family, image, range };
+	cmd().pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::BottomOfPipeBit, 0,
+		0, nullptr, 0, nullptr, 1, &release);
+	VkImageMemoryBarrier acquire { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER, nullptr, 0, Vk::Access::TransferReadBit | Vk::Access::TransferWriteBit,
+		layout, layout, m_family, m_dst_family, image, range };
+	dstCmd().pipelineBarrier(Vk::PipelineStage::TopOfPipeBit, Vk::PipelineStage::TransferBit, 0,
+		0, nullptr, 0, nullptr, 1, &acquire);
+}
+
+void UploadQueue::submit(void)
+{
+	if (!m_open)
+		return;
+	auto &b = batch(m_next - 1);
+	{
+		VkMemoryBarrier barrier { VK_STRUCTURE_TYPE_MEMORY_BARRIER, nullptr, Vk::Access::TransferWriteBit, Vk::Access::MemoryReadBit };
+		b.dst_cmd.pipelineBarrier(Vk::PipelineStage::TransferBit, Vk::PipelineStage::AllCommandsBit, 0,
+			1, &barrier, 0, nullptr, 0, nullptr);
+	}
+	b.cmd.end();
+	m_allocator.flushAllocation(m_staging, 0, m_capacity);
+
+	VkTimelineSemaphoreSubmitInfoKHR ti{};
+	ti.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	ti.signalSemaphoreValueCount = 1;
+	ti.pSignalSemaphoreValues = &b.ticket;
+	VkSubmitInfo submit{};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = &ti;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = b.cmd.ptr();
+	submit.signalSemaphoreCount = 1;
+	submit.pSignalSemaphores = split() ? m_copied.ptr() : m_timeline.ptr();
+	m_queue.submit(1, &submit, VK_NULL_HANDLE);
+	m_open = false;
+	if (!split())
+		m_landed = b.ticket;
+}
+
+void UploadQueue::poll(void)
+{
+	submit();
+	if (split())
+		land(m_device.getSemaphoreCounterValue(m_copied));
+	reclaim();
+}
+
+void UploadQueue::flush(void)
+{
+	submit();
+	if (!landed(ticket())) {
+		m_device.wait(m_copied, ticket());
+		land(ticket());
+	}
+	reclaim();
+}
+
+bool UploadQueue::done(Ticket ticket) const
+{
+	return m_device.getSemaphoreCounterValue(m_timeline) >= ticket;
+}
+
+void UploadQueue::wait(Ticket ticket)
+{
+	if (m_open && ticket == m_next - 1)
+		submit();
+	if (!landed(ticket)) {
+		m_device.wait(m_copied, ticket);
+		land(ticket);
+	}
+	m_device.wait(m_timeline, ticket);
+	reclaim();
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Vk.hpp"
+
+namespace Rosee {
+
+// Uploads are staged in a persistent ring and recorded into the open batch, so one submit carries many copies
+// Each submitted batch signals its ticket on a timeline semaphore, its ring space comes back once the ticket is reached
+// When the copies run on another family than the destination queue (a transfer only queue), a batch lands in two steps:
+// its copies signal the copied timeline, then once they are done a second command buffer acquires the images on the destination queue
+class UploadQueue
+{
+public:
+	using Ticket = uint64_t;
+	static inline constexpr size_t staging_align = 16;	// texel size and copy offset alignment
+
+private:
+	static inline constexpr size_t batch_count = 4;
+
+	struct Batch
+	{
+		Vk::CommandBuffer cmd;
+		Vk::CommandBuffer dst_cmd;	// on the destination family, cmd when the families match
+		Ticket ticket;
+		uint64_t end;	// ring position past its staged data
+	};
+
+	Vk::Device m_device;
+	Vk::Allocator m_allocator;
+	Vk::Queue m_queue;
+	uint32_t m_family;
+	Vk::Queue m_dst_queue;
+	uint32_t m_dst_family;
+	size_t m_capacity;
+	Vk::BufferAllocation m_staging;
+	uint8_t *m_staging_ptr;
+	Vk::Semaphore m_copied;	// signaled by the copies, only when split
+	Vk::Semaphore m_timeline;	// signaled once landed on the destination queue
+	Vk::CommandPool m_command_pool;
+	Vk::CommandPool m_dst_command_pool;	// only when split
+	// positions only grow, the staging offset is position % capacity
+	uint64_t m_head = 0;
+	uint64_t m_tail = 0;
+	// in flight from the oldest, the open batch is the newest one
+	Batch m_batches[batch_count];
+	size_t m_first = 0;
+	size_t m_count = 0;
+	bool m_open = false;
+	Ticket m_next = 1;
+	Ticket m_landed = 0;	// last batch submitted on the destination queue
+
+	bool split(void) const
+	{
+		return m_family != m_dst_family;
+	}
+
+	Batch& batch(Ticket ticket);
+	Batch& open(void);
+	void land(Ticket copied);
+	void reclaim(void);
+	void retire(void);
+
+public:
+	// Copies run on queue, what they write is used on dstQueue, which may be queue
+	UploadQueue(Vk::Device device, Vk::Allocator allocator, Vk::Queue queue, uint32_t family, Vk::Queue dstQueue, uint32_t dstFamily,
+		size_t capacity);
+	void destroy(void);
+
+	VkBuffer staging(void) const
+	{
+		return m_staging;
+	}
+
+	VkSemaphore timeline(void) const
+	{
+		return m_timeline;
+	}
+
+	// Largest single stage, larger uploads are split
+	size_t maxStage(void) const
+	{
+		return (m_capacity - staging_align) / 2;
+	}
+
+	// Staging memory read by the open batch, offset is in the staging buffer, may submit the open batch to make room
+	uint8_t* stage(size_t size, VkDeviceSize &offset);
+	// Commands of the open batch, they read what was staged since it opened
+	Vk::CommandBuffer& cmd(void);
+	// Commands of the open batch on the destination queue, they run after its copies
+	Vk::CommandBuffer& dstCmd(void);
+	// Of the open batch, or of the last submitted one
+	Ticket ticket(void) const
+	{
+		return m_next - 1;
+	}
+
+	// Signaled by the copies of the batches, the timeline when not split
+	VkSemaphore copied(void) const
+	{
+		return split() ? m_copied : m_timeline;
+	}
+
+	// Submitted on the destination queue: any later submit there is ordered after it
+	bool landed(Ticket ticket) const
+	{
+		return ticket <= m_landed;
+	}
+
+	// dst must be shared with the destination family, buffers get no ownership transfer
+	Ticket buffer(VkBuffer dst, size_t size, const void *data, size_t offset = 0);
+	// Hands an image written by cmd() to the destination family, in the same layout, so dstCmd() may use it
+	void transferImage(VkImage image, VkImageLayout layout, const VkImageSubresourceRange &range);
+
+	// Submits the open batch if any, it ends with a barrier for every later command on the destination queue
+	void submit(void);
+	// Submits the open batch, then lands the batches whose copies are done, never blocks
+	void poll(void);
+	// Submits the open batch and lands every batch, blocks on their copies only
+	void flush(void);
+	bool done(Ticket ticket) const;
+	// Submits the open batch first when it holds ticket
+	void wait(Ticket ticket);
+};
+
+}
\ No newline at end of file
@@ -98,6 +98,15 @@ void Vk::CommandBuffer::beginPrimary(VkCommandBufferUsageFlags flags)
 	vkAssert(vkBeginCommandBuffer(*this, &bi));
 }
 
+void Vk::CommandBuffer::beginSecondary(VkCommandBufferUsageFlags flags, const VkCommandBufferInheritanceInfo &inheritanceInfo)
+{
+	VkCommandBufferBeginInfo bi{};
+	bi.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	bi.flags = flags;
+	bi.pInheritanceInfo = &inheritanceInfo;
+	vkAssert(vkBeginCommandBuffer(*this, &bi));
+}
+
 void Vk::CommandBuffer::end(void)
 {
 	vkAssert(vkEndCommandBuffer(*this));
@@ -113,6 +122,23 @@ void Vk::Device::reset(VkFence fence) const
 	vkAssert(vkResetFences(*this, 1, &fence));
 }
 
+void Vk::Device::wait(VkSemaphore timeline, uint64_t value) const
+{
+	VkSemaphoreWaitInfoKHR wi{};
+	wi.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+	wi.semaphoreCount = 1;
+	wi.pSemaphores = &timeline;
+	wi.pValues = &value;
+	vkAssert(ext.vkWaitSemaphoresKHR(*this, &wi, ~0ULL));
+}
+
+uint64_t Vk::Device::getSemaphoreCounterValue(VkSemaphore timeline) const
+{
+	uint64_t res;
+	vkAssert(ext.vkGetSemaphoreCounterValueKHR(*this, timeline, &res));
+	return res;
+}
+
 VkDeviceAddress Vk::Device::getBufferDeviceAddressKHR(VkBuffer buffer) const
 {
 	VkBufferDeviceAddressInfo ai{};
@@ -160,6 +186,21 @@ Vk::Semaphore Vk::Device::createSemaphore(void) const
 	return res;
 }
 
+Vk::Semaphore Vk::Device::createTimelineSemaphore(uint64_t initialValue) const
+{
+	VkSemaphoreTypeCreateInfoKHR ti{};
+	ti.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	ti.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	ti.initialValue = initialValue;
+	VkSemaphoreCreateInfo ci{};
+	ci.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	ci.pNext = &ti;
+
+	VkSemaphore res;
+	vkAssert(vkCreateSemaphore(*this, &ci, nullptr, &res));
+	return res;
+}
+
 void Vk::Device::allocateDescriptorSets(VkDescriptorPool descriptorPool, uint32_t desciptorSetCount, const VkDescriptorSetLayout *pSetLayouts, VkDescriptorSet *pDescriptorSets) const
 {
 	VkDescriptorSetAllocateInfo ai{};
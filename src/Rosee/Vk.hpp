@@ -54,6 +54,14 @@ struct Ext {
 	EXT(vkGetRayTracingShaderGroupHandlesKHR);
 	EXT(vkGetRayTracingShaderGroupStackSizeKHR);
 
+	// VK_KHR_draw_indirect_count
+	EXT(vkCmdDrawIndirectCountKHR);
+	EXT(vkCmdDrawIndexedIndirectCountKHR);
+
+	// VK_KHR_timeline_semaphore
+	EXT(vkGetSemaphoreCounterValueKHR);
+	EXT(vkWaitSemaphoresKHR);
+
 	// VK_VERSION_1_1
 	EXT(vkGetPhysicalDeviceProperties2);
 #undef EXT
@@ -160,6 +168,7 @@ public:
 	}
 
 	void beginPrimary(VkCommandBufferUsageFlags flags);
+	void beginSecondary(VkCommandBufferUsageFlags flags, const VkCommandBufferInheritanceInfo &inheritanceInfo);
 	void end(void);
 
 	void beginRenderPass(const VkRenderPassBeginInfo &bi, VkSubpassContents contents)
@@ -172,6 +181,11 @@ public:
 		vkCmdEndRenderPass(*this);
 	}
 
+	void executeCommands(uint32_t commandBufferCount, const VkCommandBuffer *pCommandBuffers)
+	{
+		vkCmdExecuteCommands(*this, commandBufferCount, pCommandBuffers);
+	}
+
 	void bindPipeline(VkPipelineBindPoint pipelineBindPoint, VkPipeline pipeline)
 	{
 		vkCmdBindPipeline(*this, pipelineBindPoint, pipeline);
@@ -229,6 +243,11 @@ public:
 		vkCmdCopyBuffer(*this, srcBuffer, dstBuffer, regionCount, pRegions);
 	}
 
+	void fillBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size, uint32_t data)
+	{
+		vkCmdFillBuffer(*this, dstBuffer, dstOffset, size, data);
+	}
+
 	void bindDescriptorSets(VkPipelineBindPoint pipelineBindPoint, VkPipelineLayout layout,
 		uint32_t firstSet, uint32_t descriptorSetCount, const VkDescriptorSet *pDescriptorSets,
 		uint32_t dynamicOffsetCount, const uint32_t *pDynamicOffsets)
@@ -246,6 +265,28 @@ public:
 		vkCmdDrawIndexed(*this, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
 	}
 
+	void drawIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndirect(*this, buffer, offset, drawCount, stride);
+	}
+
+	void drawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint32_t drawCount, uint32_t stride)
+	{
+		vkCmdDrawIndexedIndirect(*this, buffer, offset, drawCount, stride);
+	}
+
+	void drawIndirectCountKHR(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset,
+		uint32_t maxDrawCount, uint32_t stride)
+	{
+		ext.vkCmdDrawIndirectCountKHR(*this, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+	}
+
+	void drawIndexedIndirectCountKHR(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset,
+		uint32_t maxDrawCount, uint32_t stride)
+	{
+		ext.vkCmdDrawIndexedIndirectCountKHR(*this, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+	}
+
 	void copyBufferToImage(VkBuffer srcBuffer, VkImage dstImage, VkImageLayout dstImageLayout, uint32_t regionCount, const VkBufferImageCopy *pRegions)
 	{
 		vkCmdCopyBufferToImage(*this, srcBuffer, dstImage, dstImageLayout, regionCount, pRegions);
@@ -355,6 +396,8 @@ public:
 	Queue getQueue(uint32_t family, uint32_t index) const;
 	void wait(VkFence fence) const;
 	void reset(VkFence fence) const;
+	void wait(VkSemaphore timeline, uint64_t value) const;
+	uint64_t getSemaphoreCounterValue(VkSemaphore timeline) const;
 	VkDeviceAddress getBufferDeviceAddressKHR(VkBuffer buffer) const;
 	VkDeviceAddress getAccelerationStructureDeviceAddressKHR(VkAccelerationStructureKHR accelerationStructure) const;
 
@@ -378,6 +421,7 @@ public:
 
 	Fence createFence(VkFenceCreateFlags flags) const;
 	Semaphore createSemaphore(void) const;
+	Semaphore createTimelineSemaphore(uint64_t initialValue) const;
 
 	Framebuffer createFramebuffer(const VkFramebufferCreateInfo &ci) const
 	{
@@ -749,6 +793,13 @@ public:
 		vmaDestroyAllocator(*this);
 	}
 
+	void* getMappedData(VmaAllocation allocation) const
+	{
+		VmaAllocationInfo alloc_info;
+		vmaGetAllocationInfo(*this, allocation, &alloc_info);
+		return alloc_info.pMappedData;
+	}
+
 	void flushAllocation(VmaAllocation allocation, VkDeviceSize offset, VkDeviceSize size) const
 	{
 		vkAssert(vmaFlushAllocation(*this, allocation, offset, size));
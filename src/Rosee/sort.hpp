@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+namespace Rosee {
+
+// Stable LSD radix sort on the uint64_t key member, one byte per pass, the result ends up in items
+// Bytes every key shares are skipped, tmp holds count items
+template <typename T>
+void radixSort(T *items, T *tmp, size_t count)
+{
+	if (count == 0)
+		return;
+	size_t hist[8][256];
+	std::memset(hist, 0, sizeof(hist));
+	for (size_t i = 0; i < count; i++)
+		for (size_t b = 0; b < 8; b++)
+			hist[b][(items[i].key >> (b * 8)) & 0xFF]++;
+
+	T *src = items;
+	T *dst = tmp;
+	for (size_t b = 0; b < 8; b++) {
+		auto &h = hist[b];
+		if (h[(src[0].key >> (b * 8)) & 0xFF] == count)
+			continue;
+		size_t off = 0;
+		for (size_t d = 0; d < 256; d++) {
+			size_t n = h[d];
+			h[d] = off;
+			off += n;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[h[(src[i].key >> (b * 8)) & 0xFF]++] = src[i];
+		std::swap(src, dst);
+	}
+	if (src != items)
+		std::memcpy(items, src, count * sizeof(T));
+}
+
+}
\ No newline at end of file
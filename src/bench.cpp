@@ -0,0 +1,198 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include "Rosee/TransformSystem.hpp"
+#include "Rosee/SpatialIndex.hpp"
+#include "Rosee/Model.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+using namespace Rosee;
+
+// Matrices per second for each transform kernel, then for TransformSystem::update over a Map on the pool
+// Then SpatialIndex queries against a brute-force scan, after moves and despawns, exits with 1 on a mismatch
+int main(void)
+{
+	static constexpr size_t count = 1 << 16;
+	static constexpr double duration = 0.5;
+
+	vector<Transform> trans(count);
+	vector<MVP> mvp(count);
+	vector<MV_normal> mv_normal(count);
+	vector<MW_local> mw_local(count);
+	std::mt19937_64 rng(0);
+	std::uniform_real_distribution<double> dist(-1000.0, 1000.0);
+	for (size_t i = 0; i < count; i++)
+		for (size_t c = 0; c < 4; c++)
+			for (size_t r = 0; r < 4; r++)
+				trans[i][c][r] = c == 3 ? (r == 3 ? 1.0 : dist(rng)) : (r == 3 ? 0.0 : dist(rng) / 1000.0);
+	glm::dmat4 view(1.0), proj(1.0);
+	view[3][0] = 12.0;
+	proj[2][3] = 1.0;
+	auto vp = proj * view;
+
+	using clock = std::chrono::high_resolution_clock;
+	auto bench = [&](const char *name, auto &&fun, const char *unit = "matrices"){
+		size_t done = 0;
+		auto bef = clock::now();
+		double elapsed;
+		do {
+			done += fun();
+			elapsed = static_cast<std::chrono::duration<double>>(clock::now() - bef).count();
+		} while (elapsed < duration);
+		std::cout << name << ": " << static_cast<double>(done) / elapsed / 1.0e6 << " M " << unit << "/s" << std::endl;
+	};
+
+	const char *names[] {"scalar", "sse2", "avx2"};
+	TransformSystem::Isa isas[] {TransformSystem::Isa::Scalar, TransformSystem::Isa::Sse2, TransformSystem::Isa::Avx2};
+	for (size_t i = 0; i < 3; i++) {
+		if (!TransformSystem::isaSupported(isas[i])) {
+			std::cout << names[i] << ": not supported" << std::endl;
+			continue;
+		}
+		auto kernel = TransformSystem::kernelGet(isas[i]);
+		bench(names[i], [&](){
+			kernel(trans.data(), count, vp, view, mvp.data(), mv_normal.data(), mw_local.data());
+			return count;
+		});
+	}
+
+	Map m;
+	auto [b, first] = m.addBrush<Id, Transform, MVP, MV_normal, MW_local>(count * 4);
+	for (size_t i = 0; i < count * 4; i++)
+		b.at<Transform>(first + i) = trans[i % count];
+	TransformSystem system;
+	bench("update, moving camera", [&](){
+		view[3][1] += 1.0;
+		system.update(m, view, proj);
+		return count * 4;
+	});
+	bench("update, static camera, 1/64 moved", [&](){
+		// only the touched chunks are recomputed
+		size_t moved = 0;
+		for (size_t i = 0; i < count * 4; i += 64 * b.chunkCapacity())
+			for (size_t j = 0; j < b.chunkCapacity() && i + j < count * 4; j++) {
+				b.at<Transform>(i + j)[3][0] += 1.0;
+				b.touch(Transform::id, i + j);
+				moved++;
+			}
+		system.update(m, view, proj);
+		return moved;
+	});
+
+	{
+		static constexpr size_t ent_count = 1 << 14;
+		Model model;
+		model.aabb.extend(glm::dvec3(-1.0));
+		model.aabb.extend(glm::dvec3(1.0));
+		Map sm;
+		auto [sb, sfirst] = sm.addBrush<Id, Transform, OpaqueRender>(ent_count);
+		for (size_t i = 0; i < ent_count; i++) {
+			auto &t = sb.at<Transform>(sfirst + i);
+			t = glm::dmat4(1.0);
+			t[3] = glm::dvec4(dist(rng), dist(rng) * 0.1, dist(rng), 1.0);
+			sb.at<OpaqueRender>(sfirst + i).model = &model;
+		}
+		SpatialIndex index;
+		index.update(sm);
+
+		// move one entity in 8, despawn one in 16
+		for (size_t i = 0; i < sb.size(); i += 8) {
+			sb.at<Transform>(i)[3][0] += dist(rng) * 0.01;
+			sb.touch(Transform::id, i);
+		}
+		vector<Id::type> despawned;
+		for (size_t i = 0; i < ent_count / 16; i++)
+			despawned.emplace(sb.at<Id>(i * 13 % sb.size()));
+		for (auto &e : despawned)
+			if (sm.find(e).first != nullptr)
+				sm.remove(e);
+		index.update(sm);
+		if (index.size() != sb.size()) {
+			std::cout << "spatial index: " << index.size() << " entities, expected " << sb.size() << std::endl;
+			return 1;
+		}
+
+		// Every entity whose box passes must be reported exactly once, conservative extras are counted
+		size_t queries = 0, extras = 0;
+		vector<uint8_t> seen;
+		auto check = [&](const char *name, auto &&query, auto &&passes){
+			seen.resize(0);
+			for (size_t i = 0; i < ent_count * 2; i++)
+				seen.emplace(0);
+			bool ok = true;
+			query([&](Id::type e, Brush&, size_t){
+				if (seen[Map::id_index(e)]++ > 0)
+					ok = false;
+			});
+			for (size_t i = 0; i < sb.size(); i++) {
+				auto s = seen[Map::id_index(sb.at<Id>(i))];
+				if (passes(model.aabb.transformed(sb.at<Transform>(i))))
+					ok &= s == 1;
+				else
+					extras += s;
+			}
+			if (!ok)
+				std::cout << "spatial index: " << name << " query differs from the brute-force scan" << std::endl;
+			queries++;
+			return ok;
+		};
+
+		bool ok = true;
+		for (size_t q = 0; q < 64; q++) {
+			glm::dvec3 p(dist(rng), dist(rng) * 0.1, dist(rng));
+			glm::dvec3 dir = glm::normalize(glm::dvec3(dist(rng), dist(rng), dist(rng)));
+			auto fview = glm::lookAt(p, p + dir, glm::dvec3(0.0, 1.0, 0.0));
+			auto fproj = glm::perspectiveLH_ZO(1.2, 1.5, 1.0, 300.0);
+			auto frustum = Frustum::fromMatrix(fproj * fview);
+			ok &= check("frustum", [&](auto &&cb){
+				index.frustum(sm, frustum, cb);
+			}, [&](const Aabb &box){
+				return frustum.classify(box) != ~0U;
+			});
+			double radius = 50.0;
+			ok &= check("sphere", [&](auto &&cb){
+				index.sphere(sm, p, radius, cb);
+			}, [&](const Aabb &box){
+				double d2 = 0.0;
+				for (size_t i = 0; i < 3; i++) {
+					double d = max(max(box.min[i] - p[i], p[i] - box.max[i]), 0.0);
+					d2 += d * d;
+				}
+				return d2 <= radius * radius;
+			});
+			double max_t = 500.0;
+			ok &= check("ray", [&](auto &&cb){
+				index.ray(sm, p, dir, max_t, cb);
+			}, [&](const Aabb &box){
+				double t0 = 0.0, t1 = max_t;
+				for (size_t i = 0; i < 3; i++) {
+					double a = (box.min[i] - p[i]) / dir[i];
+					double b = (box.max[i] - p[i]) / dir[i];
+					if (a > b)
+						std::swap(a, b);
+					t0 = max(t0, a);
+					t1 = min(t1, b);
+				}
+				return t0 <= t1;
+			});
+		}
+		if (!ok)
+			return 1;
+		std::cout << "spatial index: " << queries << " queries match the brute-force scan, " << extras << " extra conservative results" << std::endl;
+
+		auto frustum = Frustum::fromMatrix(glm::perspectiveLH_ZO(1.2, 1.5, 1.0, 300.0) * glm::lookAt(glm::dvec3(0.0), glm::dvec3(1.0, 0.0, 0.0), glm::dvec3(0.0, 1.0, 0.0)));
+		size_t hits = 0;
+		bench("spatial index frustum", [&](){
+			index.frustum(sm, frustum, [&](Id::type, Brush&, size_t){
+				hits++;
+			});
+			return 1;
+		}, "queries");
+		bench("brute-force frustum", [&](){
+			for (size_t i = 0; i < sb.size(); i++)
+				hits += frustum.classify(model.aabb.transformed(sb.at<Transform>(i))) != ~0U;
+			return 1;
+		}, "queries");
+	}
+	return 0;
+}
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include <iostream>
 #include "Rosee/Map.hpp"
 #include "Rosee/Renderer.hpp"
+#include "Rosee/TransformSystem.hpp"
+#include "Rosee/SpatialIndex.hpp"
 #include <chrono>
 #include <thread>
 #include <mutex>
@@ -137,13 +139,18 @@ public:
 
 		Model res;
 		res.primitiveCount = ind_count;
+		for (auto &v : vertices)
+			res.aabb.extend(glm::dvec3(v.p));
+		res.sphere = res.aabb.sphere();
 		size_t buf_size = vert_count * sizeof(Vertex::pn);
 		size_t ind_size = ind_count * sizeof(uint16_t);
-		res.vertexBuffer = r.createVertexBuffer(buf_size);
-		res.indexBuffer = r.createIndexBuffer(ind_size);
+		res.vertices = r.allocateGeometry(GeometryFormat::Pn, buf_size);
+		res.firstVertex = static_cast<uint32_t>(res.vertices.offset / sizeof(Vertex::pn));
+		res.indices = r.allocateGeometry(GeometryFormat::Index, ind_size);
+		res.firstIndex = static_cast<uint32_t>(res.indices.offset / sizeof(uint16_t));
 		res.indexType = VK_INDEX_TYPE_UINT16;
-		r.loadBuffer(res.vertexBuffer, buf_size, vertices);
-		r.loadBuffer(res.indexBuffer, ind_size, indices);
+		r.loadBuffer(res.vertices.buffer, buf_size, vertices, res.vertices.offset);
+		res.ticket = r.loadBuffer(res.indices.buffer, ind_size, indices, res.indices.offset);
 
 		if (r.needsAccStructure()) {
 			size_t a_ind_stride = (chunk_size_gen - 1) * 6;
@@ -163,7 +170,7 @@ public:
 			auto indexBuffer = r.createIndexBuffer(sizeof(a_indices));
 			r.loadBuffer(indexBuffer, sizeof(a_indices), a_indices);
 
-			*acc = r.createBottomAccelerationStructure(vert_count, sizeof(Vertex::pn), res.vertexBuffer, VK_INDEX_TYPE_UINT16, a_ind_count, indexBuffer, VK_GEOMETRY_OPAQUE_BIT_KHR);
+			*acc = r.createBottomAccelerationStructure(vert_count, sizeof(Vertex::pn), res.vertices.buffer, res.vertices.offset, VK_INDEX_TYPE_UINT16, a_ind_count, indexBuffer, VK_GEOMETRY_OPAQUE_BIT_KHR);
 			acc->indexType = VK_INDEX_TYPE_UINT16;
 			acc->indexBuffer = indexBuffer;
 		}
@@ -186,6 +193,8 @@ class Game
 	Renderer m_r;
 	Map m_m;
 	World m_w;
+	TransformSystem m_transforms;
+	SpatialIndex m_spatial;
 
 	static int64_t next_chunk_size_n(int64_t val)
 	{
@@ -222,18 +231,18 @@ class Game
 		auto off = glm::dvec3(cpos.x * scav * World::chunk_size, 0.0, cpos.y * scav * World::chunk_size);
 		//std::cout << "chunk kj: " << k << ", " << j << std::endl;
 		//std::cout << "chunk: " << off.x << ", " << off.y << std::endl;
-		b.get<Transform>()[n] = glm::translate(off);
-		auto &r = b.get<OpaqueRender>()[n];
+		b.at<Transform>(n) = glm::translate(off);
+		auto &r = b.at<OpaqueRender>(n);
 		r.pipeline = pipeline;
 		r.material = material;
 		r.model = model;
 		if (m_r.needsAccStructure()) {
-			auto &rt = b.get<RT_instance>()[n];
+			auto &rt = b.at<RT_instance>(n);
 			rt.mask = 1;
 			rt.instanceShaderBindingTableRecordOffset = 1;
 			rt.accelerationStructureReference = acc->reference;
 			rt.model = model_index;
-			m_r.bindModel_pn_i16(model_index, r.model->vertexBuffer, acc->indexBuffer);
+			m_r.bindModel_pn_i16(model_index, r.model->vertices, acc->indexBuffer);
 			rt.material = 0;
 		}
 	}
@@ -303,8 +312,8 @@ public:
 
 		/*{
 			auto [b, n] = m_m.addBrush<Id, Transform, MVP, MV_normal, OpaqueRender, RT_instance>(1);
-			b.get<Transform>()[n] = glm::scale(glm::dvec3(100.0));
-			auto &r = b.get<OpaqueRender>()[n];
+			b.at<Transform>(n) = glm::scale(glm::dvec3(100.0));
+			auto &r = b.at<OpaqueRender>(n);
 			r.pipeline = m_r.pipeline_opaque_tb;
 			r.material = &mat[1];
 			uint32_t model_ndx = m_r.m_model_pool.currentIndex();
@@ -312,7 +321,7 @@ public:
 			AccelerationStructure *acc = m_r.needsAccStructure() ? m_r.m_acc_pool.allocate() : nullptr;
 			*r.model = m_r.loadModelTb("res/mod/vokselia_spawn.obj", acc);
 			if (m_r.needsAccStructure()) {
-				auto &rt = b.get<RT_instance>()[n];
+				auto &rt = b.at<RT_instance>(n);
 				rt.mask = 1;
 				rt.instanceShaderBindingTableRecordOffset = 2;
 				rt.accelerationStructureReference = acc->reference;
@@ -325,8 +334,8 @@ public:
 		m_r.instanciateModel(m_m, "res/mod/Sponza-master/", "sponza.obj");
 		/*{
 			auto [b, n] = m_m.addBrush<Id, Transform, MVP, MV_normal, OpaqueRender, RT_instance>(1);
-			b.get<Transform>()[n] = glm::scale(glm::dvec3(1.0));
-			auto &r = b.get<OpaqueRender>()[n];
+			b.at<Transform>(n) = glm::scale(glm::dvec3(1.0));
+			auto &r = b.at<OpaqueRender>(n);
 			r.pipeline = pipeline_opaque_tb;
 			r.material = material_albedo;
 			uint32_t model_ndx = model_pool.currentIndex();
@@ -334,7 +343,7 @@ public:
 			AccelerationStructure *acc = m_r.needsAccStructure() ? acc_pool.allocate() : nullptr;
 			*r.model = m_r.loadModelFull("res/mod/sponza/", "sponza.obj", acc);
 			if (m_r.needsAccStructure()) {
-				auto &rt = b.get<RT_instance>()[n];
+				auto &rt = b.at<RT_instance>(n);
 				rt.mask = 1;
 				rt.instanceShaderBindingTableRecordOffset = 2;
 				rt.accelerationStructureReference = acc->reference;
@@ -476,34 +485,26 @@ public:
 				view = view_rot * glm::translate(-camera_pos);
 				if (first_it)
 					last_view = view;
-				auto vp = proj * view;
-
-				m_m.query<MVP>([&](Brush &b){
-					auto size = b.size();
-					auto mvp = b.get<MVP>();
-					auto mv_normal = b.get<MV_normal>();
-					auto trans = b.get<Transform>();
-					for (size_t i = 0; i < size; i++) {
-						mvp[i] = vp * trans[i];
-						auto normal = view * trans[i];
-						for (size_t j = 0; j < 3; j++)
-							for (size_t k = 0; k < 3; k++) {
-								mv_normal[i][j][k] = normal[j][k];
-							}
-					}
-				});
-
-				m_m.query<MW_local>([&](Brush &b){
-					auto size = b.size();
-					auto mw_local = b.get<MW_local>();
-					auto trans = b.get<Transform>();
-					for (size_t i = 0; i < size; i++) {
-						for (size_t j = 0; j < 3; j++)
-							for (size_t k = 0; k < 3; k++) {
-								mw_local[i][j][k] = trans[i][j][k];
-							}
-					}
-				});
+				m_transforms.update(m_m, view, proj);
+				m_spatial.update(m_m);
+				if (m_r.keyReleased(GLFW_KEY_F)) {
+					// nearest model box under the crosshair
+					glm::dvec3 inv;
+					for (size_t i = 0; i < 3; i++)
+						inv[i] = 1.0 / dir_fwd[i];
+					Id::type pointed = ~0ULL;
+					double pointed_t = far;
+					m_spatial.ray(m_m, camera_pos, dir_fwd, far, [&](Id::type e, Brush &b, size_t row){
+						auto box = b.at<OpaqueRender>(row).model->aabb.transformed(b.at<Transform>(row));
+						auto t = box.rayEnter(camera_pos, inv, pointed_t);
+						if (t >= 0.0) {
+							pointed = e;
+							pointed_t = t;
+						}
+					});
+					if (pointed != ~0ULL)
+						std::cout << "Pointing at entity " << pointed << ", " << pointed_t << " away" << std::endl;
+				}
 			}
 			m_r.render(m_m, Camera{last_view, view, proj, static_cast<float>(far), static_cast<float>(near), glm::vec2(ratio, -1.0) * glm::vec2(std::tan(fov / 2.0))});
 			first_it = false;